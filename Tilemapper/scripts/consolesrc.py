@@ -133,6 +133,64 @@ def scan_source(filename):
                 except IncompatibleDeclaration as e:
                     print(e, 'in', repr(filename), file=sys.stderr)
 
+# Must match console_hash in console.cpp
+def console_hash(name, seed):
+    h = (2166136261 ^ seed) & 0xFFFFFFFF
+    for byte in name.encode('utf-8'):
+        h = ((h ^ byte) * 16777619) & 0xFFFFFFFF
+    h ^= h >> 16
+    h = (h * 0x7FEB352D) & 0xFFFFFFFF
+    h ^= h >> 15
+    return h
+
+def _pow2_at_least(n):
+    size = 1
+    while size < n:
+        size *= 2
+    return size
+
+def perfect_hash(names):
+    """Builds a two-level (hash and displace) perfect hash over names.
+
+    Returns (seeds, slots): a name lives at
+    slots[console_hash(name, seeds[console_hash(name, 0) & (len(seeds) - 1)]) & (len(slots) - 1)]
+    and every slot holds an index into names, or -1.
+    """
+    n_buckets = _pow2_at_least(max(1, len(names) // 2))
+    n_slots = _pow2_at_least(max(1, len(names) + len(names) // 4))
+    buckets = [[] for _ in range(n_buckets)]
+    for i, name in enumerate(names):
+        buckets[console_hash(name, 0) & (n_buckets - 1)].append(i)
+
+    seeds = [0] * n_buckets
+    slots = [-1] * n_slots
+    # Place the most crowded buckets first while the table is still mostly empty
+    for b in sorted(range(n_buckets), key=lambda b: -len(buckets[b])):
+        bucket = buckets[b]
+        if not bucket:
+            continue
+        seed = 1
+        while True:
+            placed = [console_hash(names[i], seed) & (n_slots - 1) for i in bucket]
+            if len(set(placed)) == len(placed) and all(slots[s] == -1 for s in placed):
+                break
+            seed += 1
+        seeds[b] = seed
+        for i, s in zip(bucket, placed):
+            slots[s] = i
+    return seeds, slots
+
+def output_hash_table(prefix, names, out):
+    seeds, slots = perfect_hash(names)
+    print(f"const u32 {prefix}_hash_seeds[] = {{ {', '.join(map(str, seeds))} }};", file=out)
+    print(f"const i32 {prefix}_hash_slots[] = {{ {', '.join(map(str, slots))} }};", file=out)
+    print(
+        f"const ConsoleHashTable {prefix}_table = {{ "
+        f"{prefix}_hash_seeds, {prefix}_hash_slots, {len(seeds) - 1}, {len(slots) - 1} }};",
+        file=out
+    )
+    print(file=out)
+
 def output_console_bindings(decls, out=sys.stdout):
     variables = {}
     realvars = set()
@@ -149,6 +207,10 @@ def output_console_bindings(decls, out=sys.stdout):
                 raise NameCollision(decl.name)
             functions[decl.name] = decl
 
+    # Tables are sorted by name so that completion can binary search them
+    variables = dict(sorted(variables.items()))
+    functions = dict(sorted(functions.items()))
+
     # Set up variable linkage
     for decl in variables.values():
         print('extern', c_format(decl.type), decl.realname + ';', file=out)
@@ -159,6 +221,7 @@ def output_console_bindings(decls, out=sys.stdout):
     print("};", file=out)
     print(f"const size_t n_console_vars = {len(variables)};", file=out)
     print(file=out)
+    output_hash_table('console_var', list(variables), out)
 
     # declare function types so that we can call them
     for decl in functions.values():
@@ -179,8 +242,8 @@ def output_console_bindings(decls, out=sys.stdout):
         if decl.ret_type == ('void',):
             print(f"\t{call};", file=out)
         else:
-            print(f"\t{c_format(param.type)} __result = {call};", file=out)
-            print(f"\t*(({c_format(param.type)}*)__ret_ptr) = __result;", file=out)
+            print(f"\t{c_format(decl.ret_type)} __result = {call};", file=out)
+            print(f"\t*(({c_format(decl.ret_type)}*)__ret_ptr) = __result;", file=out)
         print("\treturn CMD_OK;", file=out)
         print("}", file=out)
         print(file=out)
@@ -196,7 +259,7 @@ def output_console_bindings(decls, out=sys.stdout):
         print("\t{", file=out)
         print(f"\t\t&{decl.name}__wrapper, \"{decl.name}\", ", file=out)
         print(f"\t\t{len(decl.params)}, {{", file=out)
-        for param in decl.params:
+        for i, param in enumerate(decl.params):
             default = (
                 f'(void*)&{decl.name}__arg{i}_default'
                 if param.default is not None else 'nullptr'
@@ -207,6 +270,8 @@ def output_console_bindings(decls, out=sys.stdout):
         print("\t},", file=out)
     print("};", file=out)
     print(f"const size_t n_console_funcs = {len(functions)};", file=out)
+    print(file=out)
+    output_hash_table('console_func', list(functions), out)
 
 if __name__ == '__main__':
     parser = argparse.ArgumentParser()
@@ -2,6 +2,7 @@ import argparse
 import itertools
 import shlex
 import os
+import struct
 import sys
 
 PIXEL_ALIAS = {'X': 255, 'o': 127}
@@ -11,7 +12,6 @@ def split_unquoted(line, max_split):
     lexer = shlex.shlex(line, posix=True) # TEMP: this handles some cases weirdly
     lexer.whitespace = ':'
     lexer.whitespace_split = True
-    lexer.punctuation_chars = ''
     result = []
     while True:
         token = lexer.get_token()
@@ -47,7 +47,7 @@ def read_font(filename):
         else:
             raise ValueError(f"Can't interpret character: {ch!r}")
 
-    with open(filename) as fp:
+    with open(filename, encoding='utf-8') as fp:
         f = iter(fp)
         for l in f:
             line = l.strip()
@@ -139,6 +139,237 @@ def read_font(filename):
         'kerning': kerning,
     }
 
+def unicode_glyphs(font_data):
+    """Everything outside of printable ASCII goes through the font's unicode glyph map.
+    U+FFFD doubles as the fallback for missing glyphs, so there is always at least one entry."""
+    result = {
+        ord(c): glyph
+        for c, glyph in font_data['glyphs'].items()
+        if not 0x21 <= ord(c) < 0x7f
+    }
+    result.setdefault(0xFFFD, font_data['placeholder'])
+    return sorted(result.items())
+
+def kerning_pairs(font_data):
+    return [
+        (a, b, offset)
+        for (a, b), offset in sorted(font_data['kerning'].items())
+        if offset
+    ]
+
+KERN_CLASS_RANGE = 256
+
+def kerning_classes(font_data):
+    """Boil kerning pairs down to classes of glyphs that kern identically and a dense class x class matrix.
+    Class 0 is for glyphs that never kern, so its row and column are all zeros."""
+    pairs = {}
+    for a, b, offset in kerning_pairs(font_data):
+        if a >= KERN_CLASS_RANGE or b >= KERN_CLASS_RANGE:
+            print(f"WARNING: kerning between U+{a:04X} and U+{b:04X} is out of range and will be ignored", file=sys.stderr)
+            continue
+        if not -128 <= offset <= 127:
+            raise ValueError(f"Kerning offset {offset} between {chr(a)!r} and {chr(b)!r} doesn't fit in a byte")
+        pairs[a, b] = offset
+    lefts = sorted({a for a, _ in pairs})
+    rights = sorted({b for _, b in pairs})
+
+    def classify(keys, signature):
+        classes = [0] * KERN_CLASS_RANGE
+        seen = {}
+        for key in keys:
+            classes[key] = seen.setdefault(signature(key), len(seen) + 1)
+        return classes, len(seen) + 1
+
+    left_class, n_left = classify(lefts, lambda a: tuple(pairs.get((a, b), 0) for b in rights))
+    right_class, n_right = classify(rights, lambda b: tuple(pairs.get((a, b), 0) for a in lefts))
+    matrix = [0] * (n_left * n_right)
+    for (a, b), offset in pairs.items():
+        matrix[left_class[a] * n_right + right_class[b]] = offset
+    return left_class, right_class, n_left, n_right, matrix
+
+def glyph_record(glyph, size=7):
+    """Pad out a glyph tuple to all of GlyphData's fields (offsets default to 0)"""
+    return [int(x) for x in glyph] + [0] * (size - len(glyph))
+
+INVERSE_PHI32 = 2654435769
+UNICODE_GLYPH_BASE = 95
+
+def glyph_map(codepoints):
+    """Same open-addressed layout as create_glyph_map in text.cpp, so the loader can use it in place"""
+    capacity, shift = 16, 28
+    while capacity < len(codepoints) * 2:
+        capacity <<= 1
+        shift -= 1
+    slots = [(0, 0)] * capacity
+    max_probe_count = 0
+    for i, codepoint in enumerate(codepoints):
+        index = ((codepoint * INVERSE_PHI32) & 0xFFFFFFFF) >> shift
+        probe_count = 0
+        while slots[index][0] not in (0, codepoint):
+            index = (index + 1) & (capacity - 1)
+            probe_count += 1
+        slots[index] = (codepoint, UNICODE_GLYPH_BASE + i)
+        max_probe_count = max(max_probe_count, probe_count)
+    return slots, shift, max_probe_count
+
+EDT_INF = 1e20
+
+def squared_distances_1d(f):
+    """Felzenszwalb & Huttenlocher: the lower envelope of parabolas rooted at each sample of f"""
+    n = len(f)
+    hull = [0] * n
+    bounds = [0.0] * (n + 1)
+    bounds[0], bounds[1] = -EDT_INF, EDT_INF
+    k = 0
+    for q in range(1, n):
+        while True:
+            v = hull[k]
+            s = ((f[q] + q * q) - (f[v] + v * v)) / (2 * q - 2 * v)
+            if s > bounds[k]:
+                break
+            k -= 1
+        k += 1
+        hull[k] = q
+        bounds[k] = s
+        bounds[k + 1] = EDT_INF
+    result = [0.0] * n
+    k = 0
+    for q in range(n):
+        while bounds[k + 1] < q:
+            k += 1
+        result[q] = (q - hull[k]) ** 2 + f[hull[k]]
+    return result
+
+def squared_distances(grid):
+    """Squared distance from every cell of a 2D grid of bools to the nearest True cell"""
+    rows = [[0.0 if cell else EDT_INF for cell in row] for row in grid]
+    width, height = len(rows[0]), len(rows)
+    for x in range(width):
+        column = squared_distances_1d([rows[y][x] for y in range(height)])
+        for y in range(height):
+            rows[y][x] = column[y]
+    return [squared_distances_1d(row) for row in rows]
+
+def distance_field(font_data, rect, scale, padding):
+    """One glyph as a signed distance field, scale texels per font pixel with padding texels around it.
+    128 is right on the glyph's edge; 255 and 0 are padding texels inside and outside."""
+    x, y, w, h = rect
+    bitmap = font_data['bitmap']
+    width, height = w * scale + 2 * padding, h * scale + 2 * padding
+    inside = [
+        [
+            0 <= col - padding < w * scale and 0 <= row - padding < h * scale
+            and bitmap[y + (row - padding) // scale][x + (col - padding) // scale] >= 128
+            for col in range(width)
+        ]
+        for row in range(height)
+    ]
+    to_inside = squared_distances(inside)
+    to_outside = squared_distances([[not cell for cell in row] for row in inside])
+    field = []
+    for row in range(height):
+        for col in range(width):
+            if inside[row][col]:
+                dist = -(to_outside[row][col] ** 0.5 - 0.5)
+            else:
+                dist = to_inside[row][col] ** 0.5 - 0.5
+            field.append(max(0, min(255, round(128 - dist * 128 / padding))))
+    return width, height, field
+
+SDF_ATLAS_WIDTH = 256
+
+def distance_field_font(font_data, scale, padding):
+    """Re-render every glyph as a distance field in its own padded cell of a new atlas.
+    Glyph metrics stay in font pixels; only the atlas bounds change, and those are in atlas texels."""
+    glyphs = {c: glyph_record(glyph) for c, glyph in font_data['glyphs'].items()}
+    cursor = glyph_record(font_data['cursor'], 6)
+    placeholder = glyph_record(font_data['placeholder'])
+    rects = sorted(
+        {tuple(glyph[:4]) for glyph in [*glyphs.values(), cursor, placeholder] if glyph[2] > 0 and glyph[3] > 0},
+        key=lambda rect: (-rect[3], rect),
+    )
+
+    # Shelf-pack the cells, tallest first
+    fields = {}
+    placed = {}
+    shelf_x, shelf_y, shelf_height = 0, 0, 0
+    atlas_width = max(SDF_ATLAS_WIDTH, *(rect[2] * scale + 2 * padding for rect in rects))
+    for rect in rects:
+        w, h, field = distance_field(font_data, rect, scale, padding)
+        if shelf_x + w > atlas_width:
+            shelf_x, shelf_y, shelf_height = 0, shelf_y + shelf_height, 0
+        placed[rect] = (shelf_x, shelf_y, w, h)
+        fields[rect] = field
+        shelf_x += w
+        shelf_height = max(shelf_height, h)
+    atlas_height = max(shelf_y + shelf_height, OPENGL_MIN_TEX_SIZE)
+
+    atlas = [[0] * atlas_width for _ in range(atlas_height)]
+    for rect, (x, y, w, h) in placed.items():
+        field = fields[rect]
+        for row in range(h):
+            atlas[y + row][x:x + w] = field[row * w:(row + 1) * w]
+
+    def moved(glyph):
+        return [*placed.get(tuple(glyph[:4]), (0, 0, 0, 0)), *glyph[4:]]
+
+    return {
+        **font_data,
+        'bitmap': atlas,
+        'glyphs': {c: moved(glyph) for c, glyph in glyphs.items()},
+        'cursor': moved(cursor),
+        'placeholder': moved(placeholder),
+        'sdf_scale': scale,
+        'sdf_padding': padding,
+    }
+
+FONT_FILE_VERSION = 3
+FONT_HEADER = struct.Struct('<4sHBBiiiiIIIIIIIIIIII' + 'i' * (7 * 94 + 6))
+
+def output_binary(font_data):
+    """Write the binary font format that load_font maps in (see FontFileHeader in text.cpp)"""
+    glyphs = font_data['glyphs']
+    ascii_glyphs = [glyph_record(glyphs[chr(c)]) for c in range(0x21, 0x7f)]
+    cursor = glyph_record(font_data['cursor'], 6)
+    extra = unicode_glyphs(font_data)
+    left_class, right_class, n_left, n_right, matrix = kerning_classes(font_data)
+    slots, shift, max_probe_count = glyph_map([codepoint for codepoint, _ in extra])
+
+    bitmap = bytes(pixel for row in font_data['bitmap'] for pixel in row)
+    bounds = b''.join(struct.pack('<4i', *glyph[:4]) for glyph in ascii_glyphs)
+    bounds += struct.pack('<4i', *cursor[:4])
+    bounds += b''.join(struct.pack('<4i', *glyph_record(glyph)[:4]) for _, glyph in extra)
+    sections = [
+        bitmap,
+        bounds,
+        b''.join(struct.pack('<II', *slot) for slot in slots),
+        b''.join(struct.pack('<7i', *glyph_record(glyph)) for _, glyph in extra),
+        bytes(left_class + right_class),
+        struct.pack(f'<{len(matrix)}b', *matrix),
+    ]
+    offsets = []
+    offset = FONT_HEADER.size
+    for section in sections:
+        offset = (offset + 15) & ~15
+        offsets.append(offset)
+        offset += len(section)
+
+    header = FONT_HEADER.pack(
+        b'FONT', FONT_FILE_VERSION, font_data.get('sdf_scale', 0), font_data.get('sdf_padding', 0),
+        int(font_data['space']), int(font_data['height']),
+        len(font_data['bitmap'][0]), len(font_data['bitmap']),
+        UNICODE_GLYPH_BASE + len(extra), len(extra), shift, max_probe_count, n_left, n_right,
+        *offsets,
+        *(field for glyph in ascii_glyphs for field in glyph),
+        *cursor,
+    )
+    out.write(header)
+    written = len(header)
+    for offset, section in zip(offsets, sections):
+        out.write(b'\0' * (offset - written))
+        out.write(section)
+        written = offset + len(section)
+
 def output_c_header(font_data):
     name = font_data['name']
     glyphs = font_data['glyphs']
@@ -150,17 +381,37 @@ def output_c_header(font_data):
         print(*row, sep=', ', end=',\n', file=out)
     print('};\n', file=out)
 
-    print(f"constexpr int {name}__n_kern_pairs = {len(font_data['kerning'])};", file=out)
+    kern_pairs = kerning_pairs(font_data)
+    print(f"constexpr int {name}__n_kern_pairs = {len(kern_pairs)};", file=out)
     print(f'const KernPair {name}__kerning[] = {{', file=out)
-    for (a, b), offset in sorted(font_data['kerning'].items()):
-        if offset:
-            print(f"{{ {a}, {b}, {offset} }},", file=out)
+    for a, b, offset in kern_pairs:
+        print(f"{{ {a}, {b}, {offset} }},", file=out)
+    print('};\n', file=out)
+
+    left_class, right_class, n_left, n_right, matrix = kerning_classes(font_data)
+    print(f'const u8 {name}__kern_left_class[{KERN_CLASS_RANGE}] = {{', file=out)
+    for row in range(0, KERN_CLASS_RANGE, 32):
+        print(*left_class[row:row + 32], sep=', ', end=',\n', file=out)
+    print('};', file=out)
+    print(f'const u8 {name}__kern_right_class[{KERN_CLASS_RANGE}] = {{', file=out)
+    for row in range(0, KERN_CLASS_RANGE, 32):
+        print(*right_class[row:row + 32], sep=', ', end=',\n', file=out)
+    print('};', file=out)
+    print(f'const i8 {name}__kern_matrix[{n_left} * {n_right}] = {{', file=out)
+    for row in range(n_left):
+        print(*matrix[row * n_right:(row + 1) * n_right], sep=', ', end=',\n', file=out)
+    print('};\n', file=out)
+
+    print(f"constexpr int {name}__n_unicode_glyphs = {len(unicode_glyphs(font_data))};", file=out)
+    print(f'const UnicodeGlyph {name}__unicode_glyphs[] = {{', file=out)
+    for codepoint, glyph in unicode_glyphs(font_data):
+        print(f"  {{ 0x{codepoint:04X}, {{ {', '.join(map(str, glyph))} }} }},", file=out)
     print('};\n', file=out)
 
     print(f'Font {name} = {{', file=out)
     print( '  nullptr,', file=out)
     print( '  nullptr,', file=out)
-    print( '  -1,', file=out)
+    print( '  (GLuint) -1,', file=out)
     print( '  {', file=out)
     for ascii_glyph in range(0x21, 0x7f):
         c = chr(ascii_glyph)
@@ -169,7 +420,9 @@ def output_c_header(font_data):
     print(f"  {{ {', '.join(map(str, font_data['cursor']))} }},", file=out)
     print(f"  {font_data['space']},", file=out)
     print(f"  {font_data['height']},", file=out)
-    # print(f"  {name}__kerning, {len(font_data['kerning'])}", file=out)
+    print(f"  {{ {name}__kern_left_class, {name}__kern_right_class, {name}__kern_matrix, {n_right} }},", file=out)
+    print(f"  {font_data.get('sdf_scale', 0)},", file=out)
+    print(f"  {font_data.get('sdf_padding', 0)},", file=out)
     print( '};', file=out)
 
 if __name__ == '__main__':
@@ -177,7 +430,9 @@ if __name__ == '__main__':
 
     parser.add_argument('file')
     parser.add_argument('-o', '--outfile')
-    parser.add_argument('-f', '--format', default='c_header')
+    parser.add_argument('-f', '--format', default='c_header', choices=['c_header', 'binary'])
+    parser.add_argument('--sdf', type=int, default=0, metavar='SCALE', help="Convert the font to a signed distance field with SCALE atlas texels per font pixel.")
+    parser.add_argument('--sdf-padding', type=int, default=4, help="Texels of distance field around each glyph (default: %(default)s)")
     parser.add_argument('--lazy', action='store_true', help="Update the outfile only if it is older than all its sources.")
 
     args = parser.parse_args()
@@ -189,16 +444,25 @@ if __name__ == '__main__':
             if os.stat(args.file).st_mtime < outstat.st_mtime:
                 print("Outfile is newer than its source. Nothing to do.", file=sys.stderr)
                 sys.exit(0)
-        out = open(args.outfile, 'w')
+        out = open(args.outfile, 'wb' if args.format == 'binary' else 'w')
     else:
         out = sys.stdout
 
     font_data = read_font(args.file)
-    if args.format == 'c_header':
-        try:
-            output_c_header(font_data)
-        except Exception:
-            if out is not sys.stdout:
-                out.close()
-                os.remove(args.outfile)
-            raise
+    if args.sdf > 0:
+        if not 0 < args.sdf_padding < 256 or args.sdf > 255:
+            parser.error("--sdf and --sdf-padding must fit in a byte")
+        font_data = distance_field_font(font_data, args.sdf, args.sdf_padding)
+    if args.format == 'binary' and out is sys.stdout:
+        out = sys.stdout.buffer
+    outputs = {
+        'c_header': output_c_header,
+        'binary': output_binary,
+    }
+    try:
+        outputs[args.format](font_data)
+    except Exception:
+        if args.outfile:
+            out.close()
+            os.remove(args.outfile)
+        raise
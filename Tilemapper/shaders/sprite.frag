@@ -2,18 +2,39 @@
 
 in vec2 frag_uv;
 flat in ivec4 frag_src_bounds;
+flat in int frag_sheet;
 flat in uint frag_cset;
 flat in vec4 color_filter;
 flat in uint show_color0;
 
-uniform usampler2DRect spritesheet;
+uniform usampler2DArray spritesheet; // 2 bits per pixel, 4 pixels per texel (leftmost in the low bits)
 uniform samplerBuffer palette;
 
+uniform vec3 palette_mul = vec3(1.0);
+uniform vec3 palette_add = vec3(0.0);
+uniform vec4 palette_lerp = vec4(0.0); // rgb = color to blend toward, a = amount
+uniform bool use_cset_fx = false;
+uniform samplerBuffer cset_fx; // 3 texels per cset: multiply, add, lerp
+
+vec3 transform_color(vec3 color, uint cset) {
+    if (use_cset_fx) {
+        int base = int(cset) * 3;
+        color = color * texelFetch(cset_fx, base).rgb + texelFetch(cset_fx, base + 1).rgb;
+        vec4 lerp_to = texelFetch(cset_fx, base + 2);
+        color = mix(color, lerp_to.rgb, lerp_to.a);
+    }
+    color = color * palette_mul + palette_add;
+    return clamp(mix(color, palette_lerp.rgb, palette_lerp.a), 0.0, 1.0);
+}
+
 out vec4 frag_color;
 
 void main() {
     vec2 size = vec2(frag_src_bounds.zw);
-    uint color_index = texelFetch(spritesheet, frag_src_bounds.xy + ivec2(size * frag_uv)).r % 4u;
+    ivec2 pixel = frag_src_bounds.xy + ivec2(size * frag_uv);
+    uint texel = texelFetch(spritesheet, ivec3(pixel.x >> 2, pixel.y, frag_sheet), 0).r;
+    uint color_index = (texel >> (uint(pixel.x & 3) * 2u)) & 3u;
     if ((color_index | show_color0) == 0u) discard;
-    frag_color = vec4(texelFetch(palette, int(frag_cset * 4u + color_index)).rgb, 1.0) * color_filter;
+    vec3 color = transform_color(texelFetch(palette, int(frag_cset * 4u + color_index)).rgb, frag_cset);
+    frag_color = vec4(color, 1.0) * color_filter;
 }
@@ -7,11 +7,13 @@ layout (location = 1) in ivec4 vert_src_bounds;
 layout (location = 4) in uint flags; // includes cset
 layout (location = 2) in vec2 position;
 layout (location = 3) in int layer;
+layout (location = 5) in int sheet; // layer within the spritesheet array
 
 uniform mat4 camera;
 
 out vec2 frag_uv;
 flat out ivec4 frag_src_bounds;
+flat out int frag_sheet;
 flat out uint frag_cset;
 flat out vec4 color_filter;
 flat out uint show_color0;
@@ -45,6 +47,7 @@ void main() {
     );
 
     frag_src_bounds = vert_src_bounds;
+    frag_sheet = sheet;
     frag_cset = flags & 0xFFu;
     color_filter = vec4(
         1.0 - float((flags & 0x1F000000u) >> 24u) / 31.0,
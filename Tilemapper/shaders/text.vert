@@ -10,6 +10,10 @@ layout (location = 3) in uint rgba;
 uniform mat4 camera;
 uniform float layer = 50.0;
 uniform isamplerBuffer glyph_bounds;
+uniform float scale = 1.0; // of the text relative to the font's size
+// Distance field atlases have more than one texel per font pixel, and padding around each glyph
+uniform float texel_size = 1.0; // in font pixels
+uniform float padding = 0.0; // in texels
 
 out vec2 frag_uv;
 flat out ivec4 src_bounds;
@@ -19,7 +23,7 @@ void main() {
     src_bounds = texelFetch(glyph_bounds, int(glyph_id));
     vec2 size = vec2(src_bounds.zw);
     gl_Position = camera * vec4(
-        position + quad_vert * size,
+        position + (quad_vert * size - padding) * texel_size * scale,
         layer,
         1.0
     );
@@ -0,0 +1,19 @@
+#version 330 core
+
+in vec2 frag_uv;
+flat in ivec4 src_bounds;
+flat in vec4 color_filter;
+
+uniform sampler2DRect glyph_atlas;
+
+out vec4 frag_color;
+
+void main() {
+    // 0.5 is right on the glyph's edge; anti-alias across about a screen pixel whatever the scale
+    vec2 size = vec2(src_bounds.zw);
+    float dist = texture(glyph_atlas, src_bounds.xy + size * frag_uv).r;
+    float edge = max(fwidth(dist) * 0.5, 0.001);
+    float alpha = smoothstep(0.5 - edge, 0.5 + edge, dist);
+    if (alpha <= 0.0625) discard;
+    frag_color = vec4(1.0, 1.0, 1.0, alpha) * color_filter;
+}
@@ -5,15 +5,36 @@ flat in uint frag_tile;
 flat in uint frag_cset;
 flat in vec4 color_filter;
 
-uniform usampler2DArray tileset;
+uniform usampler2DArray tileset; // 2 bits per pixel, 4 pixels per texel (leftmost in the low bits)
 uniform samplerBuffer palette;
 uniform float alpha = 1.0;
 uniform bool transparent_color0;
 
+uniform vec3 palette_mul = vec3(1.0);
+uniform vec3 palette_add = vec3(0.0);
+uniform vec4 palette_lerp = vec4(0.0); // rgb = color to blend toward, a = amount
+uniform bool use_cset_fx = false;
+uniform samplerBuffer cset_fx; // 3 texels per cset: multiply, add, lerp
+
+vec3 transform_color(vec3 color, uint cset) {
+    if (use_cset_fx) {
+        int base = int(cset) * 3;
+        color = color * texelFetch(cset_fx, base).rgb + texelFetch(cset_fx, base + 1).rgb;
+        vec4 lerp_to = texelFetch(cset_fx, base + 2);
+        color = mix(color, lerp_to.rgb, lerp_to.a);
+    }
+    color = color * palette_mul + palette_add;
+    return clamp(mix(color, palette_lerp.rgb, palette_lerp.a), 0.0, 1.0);
+}
+
 out vec4 frag_color;
 
 void main() {
-    uint color_index = texture(tileset, vec3(frag_uv, float(frag_tile))).r % 4u;
+    int tile_size = textureSize(tileset, 0).y; // tiles are square; x is the packed width
+    ivec2 pixel = min(ivec2(frag_uv * float(tile_size)), ivec2(tile_size - 1));
+    uint texel = texelFetch(tileset, ivec3(pixel.x >> 2, pixel.y, int(frag_tile)), 0).r;
+    uint color_index = (texel >> (uint(pixel.x & 3) * 2u)) & 3u;
     if (color_index == 0u && transparent_color0) discard;
-    frag_color = vec4(texelFetch(palette, int(frag_cset * 4u + color_index)).rgb, clamp(alpha, 0.0, 1.0)) * color_filter;
+    vec3 color = transform_color(texelFetch(palette, int(frag_cset * 4u + color_index)).rgb, frag_cset);
+    frag_color = vec4(color, clamp(alpha, 0.0, 1.0)) * color_filter;
 }
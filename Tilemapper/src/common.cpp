@@ -3,11 +3,25 @@
 #include <cstring>
 #include <cstdlib>
 #include <cassert>
+#include <cerrno>
+#include <chrono>
+
+#ifdef _WIN32
+#define WIN32_LEAN_AND_MEAN
+#define NOMINMAX
+#include <windows.h>
+#else
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <fcntl.h>
+#include <unistd.h>
+#endif
 
 #include <glad/glad.h>
 #include <glfw3.h>
 
 #include "common.h"
+#include "stats.h"
 
 char* readFile(const char* filename) {
 	FILE* file = fopen(filename, "rb");
@@ -29,6 +43,56 @@ char* readFile(const char* filename) {
 	}
 }
 
+#ifdef _WIN32
+bool map_file(const char* filename, MappedFile* out) {
+	HANDLE file = CreateFileA(filename, GENERIC_READ, FILE_SHARE_READ, nullptr, OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL, nullptr);
+	if (file == INVALID_HANDLE_VALUE) return false;
+	LARGE_INTEGER size;
+	if (!GetFileSizeEx(file, &size) || size.QuadPart == 0) {
+		CloseHandle(file);
+		return false;
+	}
+	HANDLE mapping = CreateFileMappingA(file, nullptr, PAGE_READONLY, 0, 0, nullptr);
+	CloseHandle(file); // the mapping keeps the file open
+	if (mapping == nullptr) return false;
+	void* view = MapViewOfFile(mapping, FILE_MAP_READ, 0, 0, 0);
+	if (view == nullptr) {
+		CloseHandle(mapping);
+		return false;
+	}
+	*out = { (const u8*) view, (size_t) size.QuadPart, mapping };
+	return true;
+}
+
+void unmap_file(MappedFile* file) {
+	if (file->data == nullptr) return;
+	UnmapViewOfFile(file->data);
+	CloseHandle((HANDLE) file->_handle);
+	*file = {};
+}
+#else
+bool map_file(const char* filename, MappedFile* out) {
+	int fd = open(filename, O_RDONLY);
+	if (fd < 0) return false;
+	struct stat st;
+	if (fstat(fd, &st) != 0 || st.st_size == 0) {
+		close(fd);
+		return false;
+	}
+	void* view = mmap(nullptr, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+	close(fd); // the mapping keeps the file open
+	if (view == MAP_FAILED) return false;
+	*out = { (const u8*) view, (size_t) st.st_size, nullptr };
+	return true;
+}
+
+void unmap_file(MappedFile* file) {
+	if (file->data == nullptr) return;
+	munmap((void*) file->data, file->size);
+	*file = {};
+}
+#endif
+
 const char* glslTypeName(GLenum type) {
 	switch (type) {
 	case GL_FLOAT: return "float";
@@ -66,6 +130,12 @@ const char* glEnumName(GLenum type) {
 }
 #undef T
 
+double get_time() {
+	// Counted from the first call, like glfwGetTime counts from glfwInit, so it stays precise as a float
+	static const auto start = std::chrono::steady_clock::now();
+	return std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+}
+
 int _logOpenGLErrors(const char* caller, const char* file, int lineNo) {
 	GLenum err;
 	int err_count = 0;
@@ -118,9 +188,9 @@ StatusCode parse_hex_color(const char* str, const char** end, HexColor* color) {
 	}
 	auto count = (*end - str);
 	for (int i = 0; i < count; i++) {
-		if (!(str[i] >= '0' && str[i] <= '9'
-			|| str[i] >= 'A' && str[i] <= 'F'
-			|| str[i] >= 'a' && str[i] <= 'f')) {
+		if (!((str[i] >= '0' && str[i] <= '9')
+			|| (str[i] >= 'A' && str[i] <= 'F')
+			|| (str[i] >= 'a' && str[i] <= 'f'))) {
 			return INVALID_CHARS;
 		}
 	}
@@ -150,10 +220,12 @@ StatusCode parse_bool(const char* str, const char** end, bool* out) {
 	// TEMP
 	if (strcmp(str, "true") == 0) {
 		*out = true;
+		if (end) *end = str + 4;
 		return OK;
 	}
 	else if (strcmp(str, "false") == 0) {
 		*out = false;
+		if (end) *end = str + 5;
 		return OK;
 	}
 	else {
@@ -166,38 +238,211 @@ StatusCode parse_bool(const char* str, const char** end, bool* out) {
 // MAYBE? have this be opt-in per thread since the audio mixer thread (and possibly others) might not need it.
 
 #ifndef TEMP_STORAGE_SIZE
-#define TEMP_STORAGE_SIZE (64 * 1024) // 64KB
+#define TEMP_STORAGE_SIZE (64 * 1024) // 64KB; the smallest the arena ever gets
+#endif
+#ifndef ARENA_SHRINK_FRAMES
+#define ARENA_SHRINK_FRAMES 300 // frames of using under a quarter of an arena before it halves
 #endif
 
-thread_local char* TEMP_STORAGE = nullptr;
-thread_local char* temp_storage_current = nullptr;
+// An arena is a chain of blocks. A frame that outgrows the current block spills into a new one,
+// and at the next arena_clear the chain is swapped for a single block big enough for that frame.
+struct ArenaBlock {
+	ArenaBlock* next;
+	size_t size;
+
+	char* data() { return (char*)(this + 1); } // 16-byte aligned, like malloc
+};
+
+struct Arena {
+	ArenaBlock* first = nullptr;
+	ArenaBlock* current = nullptr;
+	char* next = nullptr;
+	char* end = nullptr;
+	size_t used_before_current = 0; // bytes in the blocks before current, counting alignment waste
+	size_t frame_peak = 0;
+	size_t last_frame_peak = 0;
+	int low_use_frames = 0;
 
-void* _temp_alloc(size_t n_bytes) {
-	if (TEMP_STORAGE == nullptr) {
-		temp_storage_current = TEMP_STORAGE = alloc(char, TEMP_STORAGE_SIZE);
-		assert(TEMP_STORAGE && "Unable to initialize temp storage.");
+	const size_t min_size;
+	const int peak_counter; // StatCounter, or -1
+
+	constexpr Arena(size_t min_size, int peak_counter): min_size(min_size), peak_counter(peak_counter) {}
+};
+
+static ArenaBlock* make_arena_block(size_t size) {
+	auto block = (ArenaBlock*) malloc(sizeof(ArenaBlock) + size);
+	if (block) *block = { nullptr, size };
+	return block;
+}
+
+static void use_arena_block(Arena* arena, ArenaBlock* block) {
+	arena->current = block;
+	arena->next = block->data();
+	arena->end = block->data() + block->size;
+}
+
+static void free_arena_blocks(Arena* arena) {
+	for (ArenaBlock* block = arena->first; block; ) {
+		ArenaBlock* next = block->next;
+		free(block);
+		block = next;
 	}
+	arena->first = arena->current = nullptr;
+	arena->next = arena->end = nullptr;
+	arena->used_before_current = 0;
+}
+
+static bool replace_arena_blocks(Arena* arena, size_t size) {
+	free_arena_blocks(arena);
+	arena->first = make_arena_block(size);
+	if (!arena->first) return false;
+	use_arena_block(arena, arena->first);
+	return true;
+}
+
+static size_t arena_block_size(const Arena* arena, size_t n) {
+	size_t size = arena->min_size;
+	while (size < n) size *= 2;
+	return size;
+}
+
+// Moves on to the next block (adding one if need be) until there are n contiguous bytes at arena->next
+static bool make_room(Arena* arena, size_t n) {
+	if (arena->first == nullptr) {
+		return replace_arena_blocks(arena, arena_block_size(arena, n));
+	}
+	while ((size_t)(arena->end - arena->next) < n) {
+		if (!arena->current->next) {
+			arena->current->next = make_arena_block(max(arena->current->size * 2, arena_block_size(arena, n)));
+			if (!arena->current->next) return false;
+		}
+		arena->used_before_current += arena->current->size;
+		use_arena_block(arena, arena->current->next);
+	}
+	return true;
+}
+
+static void note_arena_use(Arena* arena) {
+	size_t used = arena->used_before_current + (arena->next - arena->current->data());
+	if (used > arena->frame_peak) {
+		arena->frame_peak = used;
+		if (arena->peak_counter >= 0) peak_stat((StatCounter) arena->peak_counter, used);
+	}
+}
+
+Arena* make_arena(size_t min_size, int peak_counter) {
+	return new Arena(min_size, peak_counter);
+}
+
+void free_arena(Arena* arena) {
+	if (!arena) return;
+	free_arena_blocks(arena);
+	delete arena;
+}
+
+void* arena_alloc(Arena* arena, size_t n_bytes, size_t align) {
+	assert(align && (align & (align - 1)) == 0);
 	if (n_bytes == 0) return nullptr;
-	if (temp_storage_current + n_bytes > TEMP_STORAGE + TEMP_STORAGE_SIZE) {
+	for (;;) {
+		if (arena->first) {
+			char* ret = (char*)(((uintptr_t) arena->next + align - 1) & ~(uintptr_t)(align - 1));
+			if (ret <= arena->end && n_bytes <= (size_t)(arena->end - ret)) {
+				arena->next = ret + n_bytes;
+				note_arena_use(arena);
+				return ret;
+			}
+		}
+		if (!make_room(arena, n_bytes + align - 1)) return nullptr;
+	}
+}
+
+char* arena_reserve(Arena* arena, size_t min_bytes, size_t* available) {
+	if (!make_room(arena, min_bytes)) {
+		*available = 0;
 		return nullptr;
 	}
+	*available = arena->end - arena->next;
+	return arena->next;
+}
+
+void arena_clear(Arena* arena) {
+	if (arena->first == nullptr) return;
+	size_t peak = arena->frame_peak;
+	size_t size = arena->first->size;
+	if (arena->first->next) {
+		// Spilled this frame; next time it all fits in one block
+		replace_arena_blocks(arena, arena_block_size(arena, max(peak, size)));
+		arena->low_use_frames = 0;
+	}
+	else if (size > arena->min_size && peak < size / 4) {
+		if (++arena->low_use_frames >= ARENA_SHRINK_FRAMES) {
+			replace_arena_blocks(arena, size / 2);
+			arena->low_use_frames = 0;
+		}
+	}
 	else {
-		char* ret = temp_storage_current;
-		temp_storage_current += n_bytes;
-		// align to the nearest 8 bytes;
-		temp_storage_current += 7;
-		*(intptr_t*)&temp_storage_current &= ~7;
-		return ret;
+		arena->low_use_frames = 0;
+	}
+	if (arena->first) use_arena_block(arena, arena->first);
+	arena->used_before_current = 0;
+	arena->last_frame_peak = peak;
+	arena->frame_peak = 0;
+}
+
+ArenaMark arena_mark(const Arena* arena) {
+	return { arena->current, arena->next, arena->used_before_current };
+}
+
+void arena_reset(Arena* arena, const ArenaMark& mark) {
+	if (arena->first == nullptr) return;
+	if (mark.block == nullptr) { // taken before the arena had any blocks, i.e. with nothing allocated
+		use_arena_block(arena, arena->first);
+		arena->used_before_current = 0;
+		return;
 	}
+	// Blocks after the mark's stay in the chain, to be reused
+	use_arena_block(arena, (ArenaBlock*) mark.block);
+	arena->next = mark.next;
+	arena->used_before_current = mark.used_before;
 }
 
-void* _temp_alloc0(size_t n_bytes) {
-	void* mem = _temp_alloc(n_bytes);
+ArenaStats get_arena_stats(const Arena* arena) {
+	ArenaStats stats = {};
+	for (ArenaBlock* block = arena->first; block; block = block->next) {
+		stats.capacity += block->size;
+		stats.n_blocks++;
+	}
+	stats.frame_peak = arena->frame_peak;
+	stats.last_frame_peak = arena->last_frame_peak;
+	return stats;
+}
+
+// Temp storage is an arena per thread
+thread_local Arena temp_arena(TEMP_STORAGE_SIZE, STAT_TEMP_STORAGE_PEAK);
+
+void* _temp_alloc(size_t n_bytes, size_t align) {
+	return arena_alloc(&temp_arena, n_bytes, max(align, (size_t) 8));
+}
+
+void* _temp_alloc0(size_t n_bytes, size_t align) {
+	void* mem = _temp_alloc(n_bytes, align);
 	if (mem == nullptr) return nullptr;
 	memset(mem, 0, n_bytes);
 	return mem;
 }
 
 void temp_storage_clear() {
-	temp_storage_current = TEMP_STORAGE;
-}
\ No newline at end of file
+	arena_clear(&temp_arena);
+}
+
+ArenaMark temp_storage_mark() {
+	return arena_mark(&temp_arena);
+}
+
+void temp_storage_reset(const ArenaMark& mark) {
+	arena_reset(&temp_arena, mark);
+}
+
+ArenaStats get_temp_storage_stats() {
+	return get_arena_stats(&temp_arena);
+}
@@ -2,6 +2,7 @@
 
 #include <cstdint>
 #include <cmath>
+#include <cstring>
 
 typedef int8_t i8;
 typedef uint8_t u8;
@@ -27,11 +28,23 @@ StatusCode parse_bool(const char* str, const char** end, bool* out);
 
 char* readFile(const char* filename);
 
+/// A read-only view of a whole file, mapped into memory rather than read
+struct MappedFile {
+	const u8* data;
+	size_t size;
+	void* _handle; // platform mapping handle, if any
+};
+bool map_file(const char* filename, MappedFile* out);
+void unmap_file(MappedFile* file);
+
 constexpr float PI = 3.1415926535f;
 constexpr float TAU = (float)(3.141592653589793238 * 2.0);
 
 int _logOpenGLErrors(const char* caller, const char* file, int lineNo);
 
+/// Seconds on a monotonic clock since the first call. Unlike glfwGetTime, it works without GLFW, e.g. when rendering headless.
+double get_time();
+
 #define XY(VEC) VEC.x, VEC.y
 #define XZ(VEC) VEC.x, VEC.z
 #define XYZ(VEC) VEC.x, VEC.y, VEC.z
@@ -45,6 +58,22 @@ int _logOpenGLErrors(const char* caller, const char* file, int lineNo);
 #define BITSET(X, B) ((X) |= BIT(B))
 #define BITCLEAR(X, B) ((X) &= ~BIT(B))
 
+// Bit counting that behaves like MSVC's popcnt/lzcnt/tzcnt everywhere; zero has 32 or 64 leading (or trailing) zeros
+#ifdef _MSC_VER
+#include <intrin.h>
+inline int popcount64(u64 x) { return (int) __popcnt64(x); }
+inline int leading_zeros32(u32 x) { return (int) __lzcnt(x); }
+inline int leading_zeros64(u64 x) { return (int) __lzcnt64(x); }
+inline int trailing_zeros64(u64 x) { return (int) _tzcnt_u64(x); }
+inline u64 rotl64(u64 x, int n) { return _rotl64(x, n); }
+#else
+inline int popcount64(u64 x) { return __builtin_popcountll(x); }
+inline int leading_zeros32(u32 x) { return x ? __builtin_clz(x) : 32; }
+inline int leading_zeros64(u64 x) { return x ? __builtin_clzll(x) : 64; }
+inline int trailing_zeros64(u64 x) { return x ? __builtin_ctzll(x) : 64; }
+inline u64 rotl64(u64 x, int n) { return (x << (n & 63)) | (x >> (-n & 63)); }
+#endif
+
 template<typename T>
 inline T max(T a, T b) {
 	return a > b? a : b;
@@ -68,26 +97,85 @@ inline T clamp(T a, T lo = 0, T hi = 1) {
 #define PATH_SEP '/'
 #endif
 #define __FILE_BASENAME__ (strrchr(__FILE__, PATH_SEP) + 1)
+
+enum LogLevel {
+	LOG_DEBUG = 0,
+	LOG_INFO,
+	LOG_WARNING,
+	LOG_ERROR,
+};
+
+/// Queue a log message for the console (see log.h). Safe to call from any thread and never blocks;
+/// if the queue is full the message is dropped and counted instead.
+void log_message(LogLevel level, const char* fmt, ...);
+
 #ifdef NDEBUG
 #define ERR_LOG(FMT, ...) do{}while(0)
 #define DBG_LOG(FMT, ...) do{}while(0)
 #define logOpenGLErrors() do{}while(0)
 #else
-#define ERR_LOG(FMT, ...) fprintf(stderr, "[%s (line %03d in %s)] " FMT "\n", __func__, __LINE__, __FILE_BASENAME__, __VA_ARGS__)
-#define DBG_LOG(FMT, ...) printf("[%s (line %03d in %s)] " FMT "\n", __func__, __LINE__, __FILE_BASENAME__, __VA_ARGS__)
+#define ERR_LOG(FMT, ...) log_message(LOG_ERROR, "[%s (line %03d in %s)] " FMT, __func__, __LINE__, __FILE_BASENAME__, ##__VA_ARGS__)
+#define DBG_LOG(FMT, ...) log_message(LOG_DEBUG, "[%s (line %03d in %s)] " FMT, __func__, __LINE__, __FILE_BASENAME__, ##__VA_ARGS__)
 #define logOpenGLErrors() _logOpenGLErrors(__func__, __FILE_BASENAME__, __LINE__)
 #endif
 
-/// Allocate some bytes from temp storage
-void* _temp_alloc(size_t n_bytes);
+/// A growable scratch allocator: a chain of blocks that's consolidated into one at each arena_clear,
+/// sized for the busiest recent frame and halved after a long stretch of light use.
+struct Arena;
+/// peak_counter is a StatCounter (see stats.h) to report the arena's use to, or -1
+Arena* make_arena(size_t min_size, int peak_counter = -1);
+void free_arena(Arena* arena);
+/// Returns null only if the system is out of memory
+void* arena_alloc(Arena* arena, size_t n_bytes, size_t align = 8);
+/// Makes sure at least min_bytes are free in one piece and returns where they start, without using them.
+/// Writing there and then calling arena_alloc(arena, n, 1) with n <= *available gives back the same pointer.
+char* arena_reserve(Arena* arena, size_t min_bytes, size_t* available);
+/// Frees everything at once, and resizes the arena if it spilled or has been mostly idle
+void arena_clear(Arena* arena);
+
+/// A position in an arena. Resetting to it frees everything allocated since,
+/// for work that loops many times within one frame or wants to clean up after itself.
+struct ArenaMark {
+	void* block;
+	char* next;
+	size_t used_before;
+};
+ArenaMark arena_mark(const Arena* arena);
+void arena_reset(Arena* arena, const ArenaMark& mark);
+
+struct ArenaStats {
+	size_t capacity; // across all blocks
+	int n_blocks;
+	size_t frame_peak; // bytes used since the last clear, counting alignment padding
+	size_t last_frame_peak;
+};
+ArenaStats get_arena_stats(const Arena* arena);
+
+/// Allocate some bytes from this thread's temp storage arena. Alignment is at least 8 bytes.
+void* _temp_alloc(size_t n_bytes, size_t align = 8);
 
 /// Allocate and zero from temp storage
-void* _temp_alloc0(size_t n_bytes);
+void* _temp_alloc0(size_t n_bytes, size_t align = 8);
 
 /// This should be run at the end of every frame in each thread that uses temp storage
 void temp_storage_clear();
 
-#define temp_alloc(TYPE, N) ((TYPE*) _temp_alloc(sizeof(TYPE) * N))
-#define temp_alloc0(TYPE, N) ((TYPE*) _temp_alloc0(sizeof(TYPE) * N))
+ArenaMark temp_storage_mark();
+void temp_storage_reset(const ArenaMark& mark);
+
+/// Frees whatever was allocated from temp storage in its scope
+struct TempScope {
+	ArenaMark mark;
+	TempScope(): mark(temp_storage_mark()) {}
+	~TempScope() { temp_storage_reset(mark); }
+	TempScope(const TempScope&) = delete;
+	TempScope& operator=(const TempScope&) = delete;
+};
+
+/// For the calling thread
+ArenaStats get_temp_storage_stats();
+
+#define temp_alloc(TYPE, N) ((TYPE*) _temp_alloc(sizeof(TYPE) * N, alignof(TYPE)))
+#define temp_alloc0(TYPE, N) ((TYPE*) _temp_alloc0(sizeof(TYPE) * N, alignof(TYPE)))
 #define alloc(TYPE, N) ((TYPE*) malloc(sizeof(TYPE) * N))
 #define alloc0(TYPE, N) ((TYPE*) calloc(N, sizeof(TYPE)))
@@ -4,10 +4,39 @@
 
 #include <glfw3.h>
 
+#ifndef _WIN32
+#include <poll.h>
+#include <unistd.h>
+#include <errno.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <sys/un.h>
+#endif
+
 #include "text.h"
+#include "log.h"
 #include "console.h"
 
 #define PROMPT_PREFIX "$ "
+
+#ifndef CONSOLE_SCROLLBACK_LINES
+#define CONSOLE_SCROLLBACK_LINES 4096
+#endif
+#ifndef CONSOLE_SCROLLBACK_TEXT_SIZE
+#define CONSOLE_SCROLLBACK_TEXT_SIZE (256 * 1024) // 256KB
+#endif
+#ifndef CONSOLE_GLYPH_RUNS
+#define CONSOLE_GLYPH_RUNS 512 // scrollback lines with cached layouts
+#endif
+#ifndef CONSOLE_GLYPH_RUN_GLYPHS
+#define CONSOLE_GLYPH_RUN_GLYPHS (16 * 1024)
+#endif
+#ifndef CONSOLE_HISTORY_LINES
+#define CONSOLE_HISTORY_LINES 256
+#endif
+#ifndef CONSOLE_HISTORY_TEXT_SIZE
+#define CONSOLE_HISTORY_TEXT_SIZE (16 * 1024) // 16KB
+#endif
 #define RESPONSE_PREFIX "==> "
 
 constexpr int MOD_SHIFT = GLFW_MOD_SHIFT   << GLFW_TO_CONSOLE_SHIFT;
@@ -150,6 +179,7 @@ static const char* status_string(CommandStatus status) {
 	case CMD_NOT_FOUND: return "Command/variable not found";
 	case CMD_ARG_NAME_NOT_FOUND: return "Invalid argument name";
 	}
+	return "Unknown error";
 }
 
 static HexColor status_color(CommandStatus status) {
@@ -190,8 +220,84 @@ struct ConsoleFunc {
 	ConsoleDataType ret_type;
 };
 
+// Perfect hash emitted by consolesrc.py. The slot for a name is found by hashing it once to pick a bucket
+// and again with that bucket's seed; slots hold an index into the (name-sorted) table, or -1.
+struct ConsoleHashTable {
+	const u32* seeds;
+	const i32* slots;
+	u32 bucket_mask;
+	u32 slot_mask;
+};
+
+// Fixed-capacity FIFO of strings whose text shares one ring of bytes. Appending evicts the oldest entries
+// to make room (by count or by bytes), so memory stays bounded and nothing is allocated after init.
+template<typename Meta>
+struct TextRing {
+	struct Entry {
+		u32 offset;
+		u32 length;
+		Meta meta;
+	};
+
+	char* text = nullptr;
+	Entry* entries = nullptr;
+	u32 text_capacity = 0;
+	u32 max_entries = 0;
+	u32 first = 0; // slot of the oldest entry
+	u32 count = 0;
+	u32 write_pos = 0; // where the next entry's text goes
+	u64 n_evicted = 0; // so entries can be identified by first_id() + index across evictions
+
+	void init(u32 max_entries, u32 text_capacity) {
+		this->text = alloc(char, text_capacity);
+		this->entries = alloc(Entry, max_entries);
+		this->text_capacity = text_capacity;
+		this->max_entries = max_entries;
+		assert(text && entries);
+		first = count = write_pos = 0;
+	}
+
+	u32 size() const { return count; }
+	u64 first_id() const { return n_evicted; }
+	const Entry& operator[](u32 index) const { return entries[(first + index) % max_entries]; }
+	Entry& operator[](u32 index) { return entries[(first + index) % max_entries]; }
+	const char* text_of(const Entry& entry) const { return text + entry.offset; }
+
+	void clear() {
+		n_evicted += count;
+		first = count = write_pos = 0;
+	}
+
+	void pop_front() {
+		first = (first + 1) % max_entries;
+		count--;
+		n_evicted++;
+		if (count == 0) first = write_pos = 0;
+	}
+
+	void push_back(const char* str, size_t len, Meta meta) {
+		if (len > text_capacity) len = text_capacity;
+		if (count == max_entries) pop_front();
+		if (write_pos + len > text_capacity) {
+			// Entries past write_pos are from the previous lap, so they're the oldest; they go first.
+			while (count > 0 && (*this)[0].offset >= write_pos) pop_front();
+			write_pos = 0;
+		}
+		while (count > 0 && (*this)[0].offset >= write_pos && (*this)[0].offset < write_pos + len) pop_front();
+		memcpy(text + write_pos, str, len);
+		entries[(first + count) % max_entries] = { write_pos, (u32)len, meta };
+		count++;
+		write_pos += len;
+	}
+
+	void push_back(const std::string& str, Meta meta) {
+		push_back(str.c_str(), str.size(), meta);
+	}
+};
+
+constexpr u64 NO_GLYPH_RUN = ~0ULL;
+
 struct ConsoleScrollback {
-	std::string contents;
 	enum { 
 		BLANK_LINE, 
 		COMMAND, 
@@ -199,6 +305,8 @@ struct ConsoleScrollback {
 		LOG 
 	} type = COMMAND;
 	CommandStatus resp_status = CMD_OK;
+	LogLevel log_level = LOG_INFO; // for LOG lines
+	u64 glyph_run = NO_GLYPH_RUN; // id of the line's laid-out glyphs in console_glyph_runs, once it has been shown
 };
 
 #include "generated/console_commands.h"
@@ -207,11 +315,18 @@ struct ConsoleScrollback {
 static STB_TexteditState console_state;
 static std::string console_line;
 static std::string console_line_saved;
-// a deque might be better, but console command performance doesn't matter much and I don't care how much command history I allocate.
-static std::vector<std::string> console_history;
-static std::vector<ConsoleScrollback> console_scrollback;
+static TextRing<ConsoleScrollback> console_scrollback;
+static TextRing<char> console_history; // entries don't need any metadata
+// Scrollback lines are laid out the first time they're shown, at (0, 0); drawing them just copies and offsets the glyphs.
+// The bytes are GlyphRenderData, and since every run is a whole number of them, so is every offset.
+static TextRing<char> console_glyph_runs;
+static const Font* console_glyph_font = nullptr;
 static int history_pos;
 
+static void add_scrollback(const std::string& text, decltype(ConsoleScrollback::type) type, CommandStatus status = CMD_OK) {
+	console_scrollback.push_back(text, { type, status });
+}
+
 //    void stb_textedit_initialize_state(STB_TexteditState *state, int is_single_line)
 //
 //    void stb_textedit_click(STB_TEXTEDIT_STRING *str, STB_TexteditState *state, float x, float y)
@@ -271,24 +386,33 @@ public:
 	}
 };
 
-static const ConsoleFunc* lookup_command(const char* cmd) {
-	for (int i = 0; i < n_console_funcs; i++) { // TEMP: is linear search
-		const ConsoleFunc& func = console_funcs[i];
-		if (strcmp(cmd, func.name) == 0) {
-			return &func;
-		}
+// Must match console_hash in consolesrc.py
+static u32 console_hash(const char* name, u32 seed) {
+	u32 h = 2166136261u ^ seed;
+	for (const char* c = name; *c; c++) {
+		h = (h ^ (u8)*c) * 16777619u;
 	}
-	return nullptr;
+	h ^= h >> 16;
+	h *= 0x7feb352du;
+	h ^= h >> 15;
+	return h;
+}
+
+static int console_hash_lookup(const ConsoleHashTable& table, const char* name) {
+	u32 seed = table.seeds[console_hash(name, 0) & table.bucket_mask];
+	return table.slots[console_hash(name, seed) & table.slot_mask];
+}
+
+static const ConsoleFunc* lookup_command(const char* cmd) {
+	int i = console_hash_lookup(console_func_table, cmd);
+	if (i < 0 || strcmp(cmd, console_funcs[i].name) != 0) return nullptr;
+	return &console_funcs[i];
 }
 
 static const ConsoleVar* lookup_variable(const char* var_name) {
-	for (int i = 0; i < n_console_vars; i++) { // TEMP: is linear search
-		const ConsoleVar& var = console_vars[i];
-		if (strcmp(var_name, var.name) == 0) {
-			return &var;
-		}
-	}
-	return nullptr;
+	int i = console_hash_lookup(console_var_table, var_name);
+	if (i < 0 || strcmp(var_name, console_vars[i].name) != 0) return nullptr;
+	return &console_vars[i];
 }
 
 static CommandStatus set_variable(const char* var_name, const char* str_value) {
@@ -313,7 +437,7 @@ static CommandStatus set_variable(const char* var_name, const char* str_value) {
 	}
 	case T_FLOAT: {
 		float value = strtof(str_value, nullptr);
-		if (!isnan(value) && !isinf(value)) {
+		if (!std::isnan(value) && !std::isinf(value)) {
 			*((float*)var->ptr) = value;
 			return CMD_OK;
 		}
@@ -377,7 +501,8 @@ static CommandStatus get_func_args(const ConsoleFunc& func, ConsoleLexer &lexer,
 		// Actually interpret the token according to the target argument type
 		switch (func.params[actual_arg].type) {
 		case T_STRING:
-			return CMD_FAILURE;
+			args[actual_arg].v_string = val; // lives in the lexer's buffer until the command returns
+			break;
 		case T_HEX_COLOR: {
 			HexColor color;
 			switch (parse_hex_color(val, nullptr, &color)) {
@@ -391,7 +516,7 @@ static CommandStatus get_func_args(const ConsoleFunc& func, ConsoleLexer &lexer,
 		}
 		case T_FLOAT: {
 			float value = strtof(val, nullptr);
-			if (!isnan(value) && !isinf(value)) {
+			if (!std::isnan(value) && !std::isinf(value)) {
 				args[actual_arg].v_float = value;
 				break;
 			}
@@ -438,9 +563,15 @@ static CommandStatus get_func_args(const ConsoleFunc& func, ConsoleLexer &lexer,
 	return {};
 }
 
-static CommandStatus console_submit_command(std::string& response) {
-	ConsoleLexer lexer(console_line);
+static int console_exec_file_depth(const char* filename, int depth);
+
+static CommandStatus console_submit_command(const std::string& line, std::string& response, int exec_depth = 0) {
+	ConsoleLexer lexer(line);
 	char* cmd = lexer.emit_token();
+	if (cmd == nullptr) { // nothing but whitespace
+		response.clear();
+		return CMD_OK;
+	}
 	char* equals = strchr(cmd, '=');
 	if (equals) {
 		*equals = 0;
@@ -464,6 +595,22 @@ static CommandStatus console_submit_command(std::string& response) {
 		auto var = lexer.emit_token();
 		return get_variable(var);
 	}
+	else if (strcmp(cmd, "exec") == 0) {
+		auto filename = lexer.emit_token();
+		if (!filename) {
+			response = status_string(CMD_NOT_ENOUGH_ARGS);
+			return CMD_NOT_ENOUGH_ARGS;
+		}
+		int failed = console_exec_file_depth(filename, exec_depth + 1);
+		if (failed < 0) {
+			response = "Unable to run \"";
+			response += filename;
+			response += "\"";
+			return CMD_FAILURE;
+		}
+		response = std::to_string(failed) + " command(s) failed";
+		return failed == 0 ? CMD_OK : CMD_FAILURE;
+	}
 	else {
 		auto func = lookup_command(cmd);
 		if (func == nullptr) {
@@ -508,6 +655,83 @@ static CommandStatus console_submit_command(std::string& response) {
 	}
 }
 
+// Names console_submit_command handles itself rather than through the generated tables
+static const char* const BUILTIN_COMMANDS[] = { "clear", "exec", "get", "set" };
+constexpr int MAX_COMPLETIONS_SHOWN = 32;
+
+// The generated tables are sorted by name, so every name starting with a prefix is a contiguous range
+template<typename T>
+static void prefix_range(const T* table, size_t n, const char* prefix, size_t len, size_t* first, size_t* last) {
+	size_t lo = 0, hi = n;
+	while (lo < hi) {
+		size_t mid = (lo + hi) / 2;
+		if (strncmp(table[mid].name, prefix, len) < 0) lo = mid + 1;
+		else hi = mid;
+	}
+	*first = lo;
+	hi = n;
+	while (lo < hi) {
+		size_t mid = (lo + hi) / 2;
+		if (strncmp(table[mid].name, prefix, len) <= 0) lo = mid + 1;
+		else hi = mid;
+	}
+	*last = lo;
+}
+
+struct CompletionState {
+	const char* first_match = nullptr;
+	size_t common_len = 0;
+	int n_matches = 0;
+	std::string listing;
+
+	void add(const char* name) {
+		if (!first_match) {
+			first_match = name;
+			common_len = strlen(name);
+		}
+		else {
+			size_t i = 0;
+			while (i < common_len && name[i] == first_match[i]) i++;
+			common_len = i;
+		}
+		if (n_matches < MAX_COMPLETIONS_SHOWN) {
+			if (n_matches > 0) listing += "  ";
+			listing += name;
+		}
+		else if (n_matches == MAX_COMPLETIONS_SHOWN) {
+			listing += "  ...";
+		}
+		n_matches++;
+	}
+};
+
+static void console_complete() {
+	int cursor = console_state.cursor;
+	int start = cursor;
+	while (start > 0 && memchr(WORD_CHARS, console_line[start - 1], N_WORD_CHARS)) start--;
+	const char* prefix = console_line.c_str() + start;
+	size_t len = cursor - start;
+
+	CompletionState completion;
+	size_t first, last;
+	prefix_range(console_funcs, n_console_funcs, prefix, len, &first, &last);
+	for (size_t i = first; i < last; i++) completion.add(console_funcs[i].name);
+	prefix_range(console_vars, n_console_vars, prefix, len, &first, &last);
+	for (size_t i = first; i < last; i++) completion.add(console_vars[i].name);
+	for (const char* builtin : BUILTIN_COMMANDS) {
+		if (strncmp(builtin, prefix, len) == 0) completion.add(builtin);
+	}
+
+	if (completion.n_matches == 0) return;
+	if (completion.common_len > len) {
+		std::string suffix(completion.first_match + len, completion.common_len - len);
+		stb_textedit_paste(&console_line, &console_state, suffix.c_str(), suffix.size());
+	}
+	else if (completion.n_matches > 1) {
+		add_scrollback(completion.listing, ConsoleScrollback::RESPONSE);
+	}
+}
+
 static void console_history_scroll(int offset) {
 	auto len = console_history.size();
 	if (len == 0) return;
@@ -520,7 +744,8 @@ static void console_history_scroll(int offset) {
 		if (history_pos > len) {
 			history_pos = len;
 		}
-		console_line = console_history[len - history_pos];
+		const auto& entry = console_history[len - history_pos];
+		console_line.assign(console_history.text_of(entry), entry.length);
 	}
 	else {
 		history_pos = 0;
@@ -532,24 +757,26 @@ static void console_history_scroll(int offset) {
 
 void init_console() {
 	stb_textedit_initialize_state(&console_state, true);
-	console_scrollback.push_back({ "EXAMPLE LOG MESSAGE", ConsoleScrollback::LOG });
+	console_scrollback.init(CONSOLE_SCROLLBACK_LINES, CONSOLE_SCROLLBACK_TEXT_SIZE);
+	console_history.init(CONSOLE_HISTORY_LINES, CONSOLE_HISTORY_TEXT_SIZE);
+	console_glyph_runs.init(CONSOLE_GLYPH_RUNS, CONSOLE_GLYPH_RUN_GLYPHS * sizeof(GlyphRenderData));
 }
 
 int console_type_key(int keycode) {
 	if (keycode == GLFW_KEY_ENTER || keycode == GLFW_KEY_KP_ENTER) {
 		if (console_line.size() > 0) {
 			std::string response;
-			auto status = console_submit_command(response);
+			auto status = console_submit_command(console_line, response);
 			// TODO: print some sort of response in a command history
-			console_scrollback.push_back({console_line, ConsoleScrollback::COMMAND});
-			console_scrollback.push_back({response, ConsoleScrollback::RESPONSE, status});
-			console_history.push_back(console_line);
+			add_scrollback(console_line, ConsoleScrollback::COMMAND);
+			add_scrollback(response, ConsoleScrollback::RESPONSE, status);
+			console_history.push_back(console_line, 0);
 			history_pos = 0;
 			console_line.clear();
 			stb_textedit_initialize_state(&console_state, true);
 		}
 		else {
-			console_scrollback.push_back({ "", ConsoleScrollback::BLANK_LINE });
+			add_scrollback("", ConsoleScrollback::BLANK_LINE);
 		}
 	}
 	else if (keycode == GLFW_KEY_UP) {
@@ -559,7 +786,7 @@ int console_type_key(int keycode) {
 		console_history_scroll(+1);
 	}
 	else if (keycode == GLFW_KEY_TAB) {
-		// TODO: autocomplete
+		console_complete();
 	}
 	else {
 		stb_textedit_key(&console_line, &console_state, keycode);
@@ -567,10 +794,293 @@ int console_type_key(int keycode) {
 	return 0;
 }
 
-static size_t escape_hash(char* const dest, const std::string& src, size_t buf_size) {
+// Batch execution: scripts, stdin and the console socket send whole lines straight to console_submit_command,
+// skipping the line editor and history. Commands still land in the scrollback so a run can be inspected afterwards.
+
+constexpr int MAX_EXEC_DEPTH = 8;
+constexpr size_t MAX_INPUT_LINE = 4096;
+
+static bool is_script_comment(const std::string& line) {
+	auto start = line.find_first_not_of(" \t");
+	if (start == std::string::npos) return true; // blank
+	return line[start] == '#' || line.compare(start, 2, "//") == 0;
+}
+
+static CommandStatus console_exec_line(const std::string& line, std::string& response, int exec_depth) {
+	CommandStatus status;
+	{
+		// Long scripts run in a single frame, so don't let each command's lexer buffers pile up
+		TempScope scope;
+		status = console_submit_command(line, response, exec_depth);
+	}
+	add_scrollback(line, ConsoleScrollback::COMMAND);
+	add_scrollback(response, ConsoleScrollback::RESPONSE, status);
+	return status;
+}
+
+bool console_exec(const char* line) {
+	std::string response;
+	return console_exec_line(line, response, 0) == CMD_OK;
+}
+
+static int console_exec_file_depth(const char* filename, int depth) {
+	if (depth > MAX_EXEC_DEPTH) {
+		ERR_LOG("Not running '%s': scripts are nested more than %d deep", filename, MAX_EXEC_DEPTH);
+		return -1;
+	}
+	char* contents = readFile(filename);
+	if (!contents) {
+		ERR_LOG("Unable to read console script '%s'", filename);
+		return -1;
+	}
+	int failed = 0;
+	std::string line;
+	std::string response;
+	for (char* cur = contents; *cur; ) {
+		char* end = strchr(cur, '\n');
+		if (!end) end = cur + strlen(cur);
+		line.assign(cur, end - cur);
+		if (!line.empty() && line.back() == '\r') line.pop_back();
+		if (!is_script_comment(line) && console_exec_line(line, response, depth) != CMD_OK) {
+			ERR_LOG("%s: '%s' ==> %s", filename, line.c_str(), response.c_str());
+			failed++;
+		}
+		cur = *end ? end + 1 : end;
+	}
+	free(contents);
+	return failed;
+}
+
+int console_exec_file(const char* filename) {
+	return console_exec_file_depth(filename, 0);
+}
+
+#ifndef _WIN32
+
+struct ConsoleInput {
+	int fd;
+	bool is_socket;
+	bool closed = false;
+	std::string pending = {}; // bytes read but not yet run
+};
+
+static std::vector<ConsoleInput> console_inputs;
+static int console_listen_fd = -1;
+static std::string console_socket_path;
+
+bool console_listen_stdin() {
+	for (auto& input : console_inputs) {
+		if (input.fd == STDIN_FILENO) return true;
+	}
+	console_inputs.push_back({ STDIN_FILENO, false });
+	return true;
+}
+
+bool console_listen_socket(const char* path) {
+	if (console_listen_fd >= 0) return false;
+	sockaddr_un addr = {};
+	addr.sun_family = AF_UNIX;
+	if (strlen(path) >= sizeof(addr.sun_path)) {
+		ERR_LOG("Console socket path '%s' is too long", path);
+		return false;
+	}
+	strcpy(addr.sun_path, path);
+	int fd = socket(AF_UNIX, SOCK_STREAM | SOCK_NONBLOCK | SOCK_CLOEXEC, 0);
+	if (fd < 0) {
+		perror("socket");
+		return false;
+	}
+	// Clear out a stale socket from a previous run, but never anything else that happens to live at path
+	struct stat st;
+	if (lstat(path, &st) == 0) {
+		if (!S_ISSOCK(st.st_mode)) {
+			ERR_LOG("Console socket path '%s' exists and isn't a socket", path);
+			close(fd);
+			return false;
+		}
+		unlink(path);
+	}
+	// Anyone who can connect can run console commands, so only this user gets to
+	mode_t old_mask = umask(0077);
+	int bound = bind(fd, (sockaddr*)&addr, sizeof(addr));
+	umask(old_mask);
+	if (bound < 0 || listen(fd, 4) < 0) {
+		ERR_LOG("Unable to listen on console socket '%s': %s", path, strerror(errno));
+		close(fd);
+		return false;
+	}
+	console_listen_fd = fd;
+	console_socket_path = path;
+	return true;
+}
+
+void shutdown_console_input() {
+	for (auto& input : console_inputs) {
+		if (input.is_socket) close(input.fd);
+	}
+	console_inputs.clear();
+	if (console_listen_fd >= 0) {
+		close(console_listen_fd);
+		unlink(console_socket_path.c_str());
+		console_listen_fd = -1;
+	}
+}
+
+static void read_console_input(ConsoleInput& input) {
+	char buffer[4096];
+	pollfd pfd = { input.fd, POLLIN, 0 };
+	while (input.pending.size() < MAX_INPUT_LINE && poll(&pfd, 1, 0) > 0) {
+		auto len = read(input.fd, buffer, sizeof(buffer));
+		if (len <= 0) {
+			input.closed = true;
+			return;
+		}
+		input.pending.append(buffer, len);
+	}
+}
+
+static void reply(const ConsoleInput& input, CommandStatus status, const std::string& response) {
+	std::string msg = (status == CMD_OK ? "ok " : "error ") + response + "\n";
+	if (input.is_socket) {
+		// Clients that stop reading just miss their replies; never stall the frame on them
+		send(input.fd, msg.c_str(), msg.size(), MSG_DONTWAIT | MSG_NOSIGNAL);
+	}
+	else {
+		fputs(msg.c_str(), stdout);
+		fflush(stdout);
+	}
+}
+
+int poll_console_input(int max_commands) {
+	if (console_listen_fd >= 0) {
+		int fd;
+		while ((fd = accept4(console_listen_fd, nullptr, nullptr, SOCK_CLOEXEC)) >= 0) {
+			console_inputs.push_back({ fd, true });
+		}
+	}
+	int executed = 0;
+	std::string line;
+	std::string response;
+	for (auto& input : console_inputs) {
+		read_console_input(input);
+		size_t start = 0;
+		while (executed < max_commands) {
+			size_t end = input.pending.find('\n', start);
+			if (end == std::string::npos) {
+				if (!input.closed || start == input.pending.size()) break;
+				end = input.pending.size(); // unterminated last line
+			}
+			line.assign(input.pending, start, end - start);
+			start = min(end + 1, input.pending.size());
+			if (!line.empty() && line.back() == '\r') line.pop_back();
+			if (is_script_comment(line)) continue;
+			reply(input, console_exec_line(line, response, 0), response);
+			executed++;
+		}
+		input.pending.erase(0, start);
+		if (input.pending.size() >= MAX_INPUT_LINE && input.pending.find('\n') == std::string::npos) {
+			ERR_LOG("Dropping console input line longer than %d bytes", (int)MAX_INPUT_LINE);
+			input.pending.clear();
+		}
+	}
+	for (auto it = console_inputs.begin(); it != console_inputs.end(); ) {
+		if (it->closed && it->pending.empty()) {
+			if (it->is_socket) close(it->fd);
+			it = console_inputs.erase(it);
+		}
+		else it++;
+	}
+	return executed;
+}
+
+#else
+
+bool console_listen_stdin() {
+	ERR_LOG("Console input from stdin is not supported on this platform");
+	return false;
+}
+
+bool console_listen_socket(const char* path) {
+	ERR_LOG("Console sockets are not supported on this platform");
+	return false;
+}
+
+void shutdown_console_input() {}
+
+int poll_console_input(int max_commands) {
+	return 0;
+}
+
+#endif
+
+// Logging: messages queued from any thread are moved into the scrollback (and echoed to the terminal) once per frame
+
+// @console
+int log_level = LOG_DEBUG; // messages below this are discarded when logged
+// @console
+int log_lines_per_frame = 32; // anything past this waits for the next frame
+// @console
+float log_repeat_interval = 1.f; // seconds a message can keep repeating before its count is printed
+
+static std::string last_log;
+static LogLevel last_log_level;
+static int log_repeats = 0;
+static double log_repeats_since = 0; // when the first uncounted repeat arrived
+
+static void add_log_line(LogLevel level, const char* text, u32 length) {
+	fprintf(level >= LOG_WARNING ? stderr : stdout, "%.*s\n", (int)length, text);
+	console_scrollback.push_back(text, length, { ConsoleScrollback::LOG, CMD_OK, level });
+}
+
+static void flush_log_repeats() {
+	if (log_repeats == 0) return;
+	char msg[64];
+	int len = snprintf(msg, sizeof(msg), "(repeated %d more time%s)", log_repeats, log_repeats == 1 ? "" : "s");
+	add_log_line(last_log_level, msg, len);
+	log_repeats = 0;
+}
+
+static void log_to_console(void*, LogLevel level, const char* text, u32 length) {
+	// Collapse spam from the same call site into one line and a count
+	if (level == last_log_level && last_log.size() == length && memcmp(last_log.c_str(), text, length) == 0) {
+		if (log_repeats++ == 0) log_repeats_since = get_time();
+		return;
+	}
+	flush_log_repeats();
+	add_log_line(level, text, length);
+	last_log.assign(text, length);
+	last_log_level = level;
+}
+
+int poll_console_log() {
+	set_log_level((LogLevel) clamp(log_level, (int)LOG_DEBUG, (int)LOG_ERROR));
+	int budget = max(log_lines_per_frame, 1);
+	int drained = drain_log(log_to_console, nullptr, budget);
+	// A message repeating every frame keeps being counted until something else is logged, with the count
+	// printed now and then so it doesn't look like the spam stopped
+	if (log_repeats && get_time() - log_repeats_since >= log_repeat_interval) flush_log_repeats();
+	u64 dropped = take_dropped_log_count();
+	if (dropped) {
+		char msg[64];
+		int len = snprintf(msg, sizeof(msg), "(%llu log messages dropped)", (unsigned long long) dropped);
+		add_log_line(LOG_WARNING, msg, len);
+	}
+	return drained;
+}
+
+static HexColor log_color(LogLevel level) {
+	switch (level) {
+	case LOG_DEBUG: return 0x888888;
+	case LOG_WARNING: return 0xddaa00;
+	case LOG_ERROR: return 0xee4444;
+	default: return 0xcccccc;
+	}
+}
+
+static size_t escape_hash(char* const dest, const char* src, size_t len, size_t buf_size) {
 	int i = 0;
-	auto end = src.cend();
-	for (auto it = src.cbegin(); it != end; it++) {
+	auto end = src + len;
+	for (auto it = src; it != end; it++) {
 		if (i + 1 >= buf_size) break;
 		dest[i++] = *it;
 		if (*it == '#') {
@@ -587,12 +1097,17 @@ const char* get_console_line(bool show_cursor = true) {
 	char* buf = temp_alloc(char, capacity);
 	int i = 0;
 	if (show_cursor) {
-		i = snprintf(buf, capacity, "\x1%d\x2" PROMPT_PREFIX, console_state.cursor + 2);
+		// The cursor is a byte offset into the line as it's drawn: after the prompt, with each # doubled
+		int cursor = console_state.cursor + (int) strlen(PROMPT_PREFIX);
+		for (int j = 0; j < console_state.cursor; j++) {
+			if (console_line[j] == '#') cursor++;
+		}
+		i = snprintf(buf, capacity, "\x1%d\x2" PROMPT_PREFIX, cursor);
 	}
 	else {
 		i = snprintf(buf, capacity, PROMPT_PREFIX);
 	}
-	escape_hash(buf + i, console_line, capacity - i);
+	escape_hash(buf + i, console_line.c_str(), console_line.size(), capacity - i);
 	return buf;
 }
 
@@ -601,20 +1116,64 @@ const char* get_console_scrollback_line(int line_offset) {
 	int sb_index = console_scrollback.size() - line_offset;
 	if (sb_index < 0) return nullptr;
 	const auto& sb_line = console_scrollback[sb_index];
-	size_t capacity = sb_line.contents.size() * 2 + 32;
+	const char* contents = console_scrollback.text_of(sb_line);
+	size_t capacity = sb_line.length * 2 + 32;
 	char* buf = temp_alloc(char, capacity);
-	switch (sb_line.type) {
+	switch (sb_line.meta.type) {
 	case ConsoleScrollback::COMMAND: {
 		int i = snprintf(buf, capacity, "#c[888]" PROMPT_PREFIX);
-		escape_hash(buf + i, sb_line.contents, capacity - i);
+		escape_hash(buf + i, contents, sb_line.length, capacity - i);
 		return buf;
 	}
 	case ConsoleScrollback::RESPONSE: {
-		int i = snprintf(buf, capacity, "#c[888]" RESPONSE_PREFIX "#c[%06x]", status_color(sb_line.resp_status));
-		escape_hash(buf + i, sb_line.contents, capacity - i);
+		int i = snprintf(buf, capacity, "#c[888]" RESPONSE_PREFIX "#c[%06x]", status_color(sb_line.meta.resp_status));
+		escape_hash(buf + i, contents, sb_line.length, capacity - i);
+		return buf;
+	}
+	case ConsoleScrollback::LOG: {
+		int i = snprintf(buf, capacity, "#c[%06x]", log_color(sb_line.meta.log_level));
+		escape_hash(buf + i, contents, sb_line.length, capacity - i);
 		return buf;
 	}
 	case ConsoleScrollback::BLANK_LINE: return "";
 	default: return "#c[a70]<<< NOT IMPLEMENTED >>>";
 	}
-}
\ No newline at end of file
+}
+
+static bool has_glyph_run(u64 id) {
+	return id != NO_GLYPH_RUN && id >= console_glyph_runs.first_id() && id < console_glyph_runs.first_id() + console_glyph_runs.size();
+}
+
+int print_console_scrollback(const Font* font, GlyphRenderData* const buffer, int buf_size, float x, float y, float line_height, int max_lines) {
+	if (font != console_glyph_font) { // every cached run belongs to the old font
+		console_glyph_runs.clear();
+		console_glyph_font = font;
+	}
+	int n_glyphs = 0;
+	for (int i = 1; i < max_lines && n_glyphs < buf_size; i++) {
+		int sb_index = (int)console_scrollback.size() - i;
+		if (sb_index < 0) break;
+		auto& sb_line = console_scrollback[sb_index];
+		if (!has_glyph_run(sb_line.meta.glyph_run)) {
+			const char* text = get_console_scrollback_line(i);
+			size_t capacity = strlen(text) + 1; // every glyph takes at least one byte
+			GlyphRenderData* glyphs = temp_alloc(GlyphRenderData, capacity);
+			if (!glyphs) continue; // try again next frame rather than caching nothing
+			int n = print_glyphs(font, glyphs, capacity, text, 0, 0);
+			if (n < 0) continue; // the text didn't lay out; leave the line blank
+			console_glyph_runs.push_back((const char*) glyphs, sizeof(GlyphRenderData) * n, 0);
+			sb_line.meta.glyph_run = console_glyph_runs.first_id() + console_glyph_runs.size() - 1;
+		}
+		const auto& run = console_glyph_runs[(u32)(sb_line.meta.glyph_run - console_glyph_runs.first_id())];
+		auto glyphs = (const GlyphRenderData*) console_glyph_runs.text_of(run);
+		int n = min((int)(run.length / sizeof(GlyphRenderData)), buf_size - n_glyphs);
+		float line_y = y - i * line_height;
+		for (int g = 0; g < n; g++) {
+			buffer[n_glyphs + g] = glyphs[g];
+			buffer[n_glyphs + g].x += x;
+			buffer[n_glyphs + g].y += line_y;
+		}
+		n_glyphs += n;
+	}
+	return n_glyphs;
+}
@@ -5,6 +5,30 @@
 void init_console();
 int console_type_key(int keycode);
 
+/// Runs a command as if it had been typed at the prompt. Returns true if it succeeded.
+bool console_exec(const char* line);
+/// Runs each line of a console script. Blank lines and lines starting with # or // are skipped.
+/// Returns how many commands failed, or -1 if the script couldn't be read.
+int console_exec_file(const char* filename);
+
+/// Accept newline-separated commands from stdin or a UNIX socket. Each command gets a one-line reply
+/// ("ok <response>" or "error <response>") on stdout or the socket it came from.
+/// The socket is only accessible to the current user, and path is only replaced if it is a stale socket.
+bool console_listen_stdin();
+bool console_listen_socket(const char* path);
+void shutdown_console_input();
+/// Runs up to max_commands commands that have arrived since the last call. Call once per frame.
+int poll_console_input(int max_commands = 64);
+
+/// Moves queued log messages (see log.h) into the scrollback, at most log_lines_per_frame of them. Call once per frame.
+int poll_console_log();
+
+struct Font;
+struct GlyphRenderData;
+/// Lays out up to max_lines - 1 of the newest scrollback lines upward from y, one line_height apart, and returns the glyph count.
+/// Each line is only laid out the first time it's shown, so a full console costs little more than a copy per frame.
+int print_console_scrollback(const Font* font, GlyphRenderData* const buffer, int buf_size, float x, float y, float line_height, int max_lines);
+
 /// Gets a string that can be rendered by the renderer
 const char* get_console_line(bool show_cursor);
 const char* get_console_scrollback_line(int line_offset);
\ No newline at end of file
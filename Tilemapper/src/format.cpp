@@ -0,0 +1,114 @@
+#include <cstdio>
+#include <cstring>
+
+#include "format.h"
+
+static const u64 POWERS_OF_10[] = {
+	1ull, 10ull, 100ull, 1000ull, 10000ull, 100000ull, 1000000ull, 10000000ull, 100000000ull, 1000000000ull,
+};
+
+static inline void put(FormatBuffer& out, const char* str, size_t len) {
+	size_t room = out.next < out.end ? out.end - out.next : 0;
+	if (len > room) {
+		len = room;
+		out.overflow = true;
+	}
+	memcpy(out.next, str, len);
+	out.next += len;
+}
+
+const char* format_literal(FormatBuffer& out, const char* fmt, FormatSpec* spec) {
+	for (;;) {
+		const char* brace = strpbrk(fmt, "{}");
+		if (brace == nullptr) {
+			put(out, fmt, strlen(fmt));
+			return nullptr;
+		}
+		put(out, fmt, brace - fmt);
+		if (brace[1] == brace[0]) { // {{ or }}
+			put(out, brace, 1);
+			fmt = brace + 2;
+			continue;
+		}
+		// TEXT_FMT already made sure this is well-formed
+		const char* c = brace + 1;
+		spec->type = 0;
+		spec->precision = -1;
+		if (*c == '.') {
+			spec->precision = c[1] - '0';
+			c += 2;
+		}
+		else if (*c == 'x') {
+			spec->type = 'x';
+			c++;
+		}
+		return c + 1;
+	}
+}
+
+void format_string(FormatBuffer& out, const char* str) {
+	put(out, str, strlen(str));
+}
+
+void format_char(FormatBuffer& out, char c) {
+	put(out, &c, 1);
+}
+
+void format_uint(FormatBuffer& out, u64 value, int base) {
+	char digits[20];
+	char* start = digits + sizeof(digits);
+	do {
+		int digit = (int) (value % base);
+		*--start = digit < 10 ? '0' + digit : 'a' + digit - 10;
+		value /= base;
+	} while (value);
+	put(out, start, digits + sizeof(digits) - start);
+}
+
+void format_int(FormatBuffer& out, i64 value) {
+	if (value < 0) {
+		put(out, "-", 1);
+		format_uint(out, 0 - (u64) value);
+	}
+	else {
+		format_uint(out, (u64) value);
+	}
+}
+
+void format_float(FormatBuffer& out, double value, int precision) {
+	precision = clamp(precision, 0, 9);
+	if (value != value) {
+		put(out, "nan", 3);
+		return;
+	}
+	if (std::signbit(value)) {
+		put(out, "-", 1);
+		value = -value;
+	}
+	if (std::isinf(value)) {
+		put(out, "inf", 3);
+		return;
+	}
+	u64 scale = POWERS_OF_10[precision];
+	double scaled = value * scale;
+	if (scaled >= 1e19) { // too big to go through a u64; rare enough to hand off
+		char big[352];
+		int len = snprintf(big, sizeof(big), "%.*f", precision, value);
+		put(out, big, len);
+		return;
+	}
+	double whole = floor(scaled);
+	u64 fixed = (u64) whole;
+	if (scaled - whole > 0.5 || (scaled - whole == 0.5 && (fixed & 1))) fixed++; // ties to even, like printf
+	format_uint(out, fixed / scale);
+	if (precision > 0) {
+		char fraction[10];
+		fraction[0] = '.';
+		u64 frac = fixed % scale;
+		for (int i = precision; i > 0; i--) {
+			fraction[i] = '0' + frac % 10;
+			frac /= 10;
+		}
+		put(out, fraction, precision + 1);
+	}
+}
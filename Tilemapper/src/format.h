@@ -0,0 +1,105 @@
+#pragma once
+
+#include <type_traits>
+
+#include "common.h"
+
+// fmt-style formatting without varargs, for text that gets printed every frame.
+// Wrap the format string in TEXT_FMT so a malformed string or the wrong number of arguments fails to compile.
+//   {}    the argument as-is: integers, chars, floats (FORMAT_FLOAT_PRECISION decimals) and strings
+//   {.N}  float with N (0-9) decimals
+//   {x}   integer or char in lowercase hex, negative numbers as two's complement at their own width
+//   {{ }} literal braces
+// Precision is ignored on anything but floats, and hex on anything but integers.
+
+constexpr int FORMAT_FLOAT_PRECISION = 3;
+
+/// Number of arguments the format takes, or -1 if it's malformed
+constexpr int count_format_args(const char* fmt) {
+	int n_args = 0;
+	for (const char* c = fmt; *c; c++) {
+		if (*c == '{') {
+			if (c[1] == '{') {
+				c++;
+				continue;
+			}
+			c++;
+			if (*c == '.') {
+				c++;
+				if (*c < '0' || *c > '9') return -1;
+				c++;
+			}
+			else if (*c == 'x') {
+				c++;
+			}
+			if (*c != '}') return -1;
+			n_args++;
+		}
+		else if (*c == '}') {
+			if (c[1] != '}') return -1;
+			c++;
+		}
+	}
+	return n_args;
+}
+
+template <int N_ARGS>
+struct TextFormat {
+	const char* str;
+};
+#define TEXT_FMT(FMT) TextFormat<count_format_args(FMT)>{ FMT }
+
+/// Formatted text goes straight in here; nothing past end is written, and the text is always terminated.
+struct FormatBuffer {
+	char* next;
+	char* const end; // room for the terminator is reserved past this
+	bool overflow;
+};
+
+struct FormatSpec {
+	char type; // 0 or 'x'
+	i8 precision; // -1 if not given
+};
+
+/// Copy text up to the next {} spec and parse it. Returns the rest of the format, or nullptr once it's all copied.
+const char* format_literal(FormatBuffer& out, const char* fmt, FormatSpec* spec);
+void format_string(FormatBuffer& out, const char* str);
+void format_char(FormatBuffer& out, char c);
+void format_int(FormatBuffer& out, i64 value);
+void format_uint(FormatBuffer& out, u64 value, int base = 10);
+/// Fixed-point. The last digit can round differently from printf when value * 10^precision isn't exact in a double.
+void format_float(FormatBuffer& out, double value, int precision);
+
+template <typename T>
+inline typename std::enable_if<std::is_integral<T>::value>::type format_arg(FormatBuffer& out, FormatSpec spec, T value) {
+	if (spec.type == 'x') format_uint(out, (typename std::make_unsigned<T>::type) value, 16); // so -1 is ffffffff for an int
+	else if (std::is_signed<T>::value) format_int(out, (i64) value);
+	else format_uint(out, (u64) value);
+}
+inline void format_arg(FormatBuffer& out, FormatSpec spec, char value) {
+	if (spec.type == 'x') format_uint(out, (u8) value, 16);
+	else format_char(out, value);
+}
+inline void format_arg(FormatBuffer& out, FormatSpec, bool value) {
+	format_string(out, value ? "true" : "false");
+}
+inline void format_arg(FormatBuffer& out, FormatSpec spec, double value) {
+	format_float(out, value, spec.precision >= 0 ? spec.precision : FORMAT_FLOAT_PRECISION);
+}
+inline void format_arg(FormatBuffer& out, FormatSpec, const char* value) {
+	format_string(out, value);
+}
+
+inline void format_text(FormatBuffer& out, const char* fmt) {
+	FormatSpec spec;
+	format_literal(out, fmt, &spec);
+	*out.next = 0;
+}
+
+template <typename T, typename... Rest>
+inline void format_text(FormatBuffer& out, const char* fmt, const T& first, const Rest&... rest) {
+	FormatSpec spec;
+	fmt = format_literal(out, fmt, &spec);
+	format_arg(out, spec, first);
+	format_text(out, fmt, rest...);
+}
@@ -0,0 +1,207 @@
+#include <glad/glad.h>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <algorithm>
+
+#ifdef HEADLESS_EGL
+#include <EGL/egl.h>
+#include <EGL/eglext.h>
+#endif
+
+#include "headless.h"
+
+#ifdef HEADLESS_EGL
+
+#ifndef EGL_PLATFORM_SURFACELESS_MESA
+#define EGL_PLATFORM_SURFACELESS_MESA 0x31DD
+#endif
+
+static EGLDisplay egl_display = EGL_NO_DISPLAY;
+static EGLContext egl_context = EGL_NO_CONTEXT;
+static EGLSurface egl_surface = EGL_NO_SURFACE;
+
+static bool has_extension(const char* extensions, const char* name) {
+	if (!extensions) return false;
+	size_t len = strlen(name);
+	for (const char* c = strstr(extensions, name); c; c = strstr(c + len, name)) {
+		if ((c == extensions || c[-1] == ' ') && (c[len] == ' ' || c[len] == 0)) return true;
+	}
+	return false;
+}
+
+static EGLDisplay open_display() {
+	// The surfaceless platform needs neither a display server nor a GPU device node
+	auto get_platform_display = (PFNEGLGETPLATFORMDISPLAYEXTPROC) eglGetProcAddress("eglGetPlatformDisplayEXT");
+	if (get_platform_display && has_extension(eglQueryString(EGL_NO_DISPLAY, EGL_EXTENSIONS), "EGL_MESA_platform_surfaceless")) {
+		EGLDisplay display = get_platform_display(EGL_PLATFORM_SURFACELESS_MESA, EGL_DEFAULT_DISPLAY, nullptr);
+		if (display != EGL_NO_DISPLAY) return display;
+	}
+	return eglGetDisplay(EGL_DEFAULT_DISPLAY);
+}
+
+bool init_headless() {
+	egl_display = open_display();
+	EGLint major, minor;
+	if (egl_display == EGL_NO_DISPLAY || !eglInitialize(egl_display, &major, &minor)) {
+		fprintf(stderr, "Unable to open an EGL display (error 0x%x).\n", eglGetError());
+		return false;
+	}
+	if (!eglBindAPI(EGL_OPENGL_API)) {
+		fprintf(stderr, "EGL %d.%d can't do desktop OpenGL.\n", major, minor);
+		shutdown_headless();
+		return false;
+	}
+
+	// Everything is drawn into the renderer's own framebuffer, so a surface is only made if EGL insists
+	bool surfaceless = has_extension(eglQueryString(egl_display, EGL_EXTENSIONS), "EGL_KHR_surfaceless_context");
+	const EGLint config_attribs[] = {
+		EGL_SURFACE_TYPE, surfaceless ? 0 : EGL_PBUFFER_BIT,
+		EGL_RENDERABLE_TYPE, EGL_OPENGL_BIT,
+		EGL_RED_SIZE, 8,
+		EGL_GREEN_SIZE, 8,
+		EGL_BLUE_SIZE, 8,
+		EGL_NONE
+	};
+	EGLConfig config;
+	EGLint n_configs;
+	if (!eglChooseConfig(egl_display, config_attribs, &config, 1, &n_configs) || n_configs < 1) {
+		fprintf(stderr, "No EGL config for OpenGL rendering.\n");
+		shutdown_headless();
+		return false;
+	}
+
+	const EGLint context_attribs[] = {
+		EGL_CONTEXT_MAJOR_VERSION, 3,
+		EGL_CONTEXT_MINOR_VERSION, 3,
+		EGL_CONTEXT_OPENGL_PROFILE_MASK, EGL_CONTEXT_OPENGL_CORE_PROFILE_BIT,
+		EGL_NONE
+	};
+	egl_context = eglCreateContext(egl_display, config, EGL_NO_CONTEXT, context_attribs);
+	if (egl_context == EGL_NO_CONTEXT) {
+		fprintf(stderr, "Unable to create an OpenGL 3.3 core context (error 0x%x).\n", eglGetError());
+		shutdown_headless();
+		return false;
+	}
+	if (!surfaceless) {
+		const EGLint pbuffer_attribs[] = { EGL_WIDTH, 1, EGL_HEIGHT, 1, EGL_NONE };
+		egl_surface = eglCreatePbufferSurface(egl_display, config, pbuffer_attribs);
+	}
+	if (!eglMakeCurrent(egl_display, egl_surface, egl_surface, egl_context)) {
+		fprintf(stderr, "Unable to make the headless context current (error 0x%x).\n", eglGetError());
+		shutdown_headless();
+		return false;
+	}
+
+	if (!gladLoadGLLoader((GLADloadproc) eglGetProcAddress)) {
+		fprintf(stderr, "Failed to initialize GLAD\n");
+		shutdown_headless();
+		return false;
+	}
+	printf("Headless: %s on %s\n", (const char*) glGetString(GL_VERSION), (const char*) glGetString(GL_RENDERER));
+	return true;
+}
+
+void shutdown_headless() {
+	if (egl_display == EGL_NO_DISPLAY) return;
+	eglMakeCurrent(egl_display, EGL_NO_SURFACE, EGL_NO_SURFACE, EGL_NO_CONTEXT);
+	if (egl_surface != EGL_NO_SURFACE) eglDestroySurface(egl_display, egl_surface);
+	if (egl_context != EGL_NO_CONTEXT) eglDestroyContext(egl_display, egl_context);
+	eglTerminate(egl_display);
+	egl_display = EGL_NO_DISPLAY;
+	egl_context = EGL_NO_CONTEXT;
+	egl_surface = EGL_NO_SURFACE;
+}
+
+#else
+
+bool init_headless() {
+	fprintf(stderr, "This build can't render headless; it was built without EGL.\n");
+	return false;
+}
+
+void shutdown_headless() {}
+
+#endif
+
+// Golden images
+
+bool write_ppm(const char* filename, const u8* rgb, int width, int height) {
+	FILE* file = fopen(filename, "wb");
+	if (!file) return false;
+	fprintf(file, "P6\n%d %d\n255\n", width, height);
+	size_t size = (size_t) width * height * 3;
+	bool ok = fwrite(rgb, 1, size, file) == size;
+	return fclose(file) == 0 && ok;
+}
+
+// Skips whitespace and # comments between header fields
+static bool read_ppm_int(FILE* file, int* out) {
+	int c;
+	while ((c = fgetc(file)) != EOF) {
+		if (c == '#') {
+			while ((c = fgetc(file)) != EOF && c != '\n');
+		}
+		else if (c != ' ' && c != '\t' && c != '\n' && c != '\r') {
+			ungetc(c, file);
+			break;
+		}
+	}
+	return fscanf(file, "%d", out) == 1;
+}
+
+u8* read_ppm(const char* filename, int* width, int* height) {
+	FILE* file = fopen(filename, "rb");
+	if (!file) return nullptr;
+	char magic[3] = {};
+	int max_value;
+	if (fread(magic, 1, 2, file) != 2 || strcmp(magic, "P6") != 0
+		|| !read_ppm_int(file, width) || !read_ppm_int(file, height) || !read_ppm_int(file, &max_value)
+		|| *width <= 0 || *height <= 0 || max_value != 255) {
+		fclose(file);
+		return nullptr;
+	}
+	fgetc(file); // the single whitespace character before the pixels
+	size_t size = (size_t) *width * *height * 3;
+	u8* rgb = alloc(u8, size);
+	if (fread(rgb, 1, size, file) != size) {
+		free(rgb);
+		rgb = nullptr;
+	}
+	fclose(file);
+	return rgb;
+}
+
+FrameDiff compare_frames(const u8* a, const u8* b, int width, int height, int tolerance) {
+	FrameDiff diff = {};
+	for (int i = 0; i < width * height; i++) {
+		int worst = 0;
+		for (int ch = 0; ch < 3; ch++) {
+			worst = max(worst, abs(a[i * 3 + ch] - b[i * 3 + ch]));
+		}
+		if (worst > tolerance) diff.n_pixels++;
+		diff.max_error = max(diff.max_error, worst);
+	}
+	return diff;
+}
+
+// Timing
+
+static double percentile(const double* sorted, int n, double p) {
+	return sorted[min((int) (p * n), n - 1)];
+}
+
+FrameTimeSummary summarize_frame_times(double* times, int n_frames) {
+	FrameTimeSummary summary = {};
+	summary.n_frames = n_frames;
+	if (n_frames <= 0) return summary;
+	std::sort(times, times + n_frames);
+	for (int i = 0; i < n_frames; i++) summary.total += times[i];
+	summary.mean = summary.total / n_frames;
+	summary.median = percentile(times, n_frames, 0.5);
+	summary.p95 = percentile(times, n_frames, 0.95);
+	summary.p99 = percentile(times, n_frames, 0.99);
+	summary.min = times[0];
+	summary.max = times[n_frames - 1];
+	return summary;
+}
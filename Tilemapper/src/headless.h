@@ -0,0 +1,29 @@
+#pragma once
+
+#include "common.h"
+
+// Rendering without a window, for machines with no display or GPU (build servers, CI).
+// The context comes from EGL, preferring Mesa's surfaceless platform so it runs on llvmpipe.
+// Builds without EGL (HEADLESS_EGL undefined) still have the rest, but init_headless always fails.
+
+/// Makes an offscreen OpenGL 3.3 core context current and loads OpenGL with it
+bool init_headless();
+void shutdown_headless();
+
+/// Binary PPM (P6) images, top row first, like Renderer::read_frame
+bool write_ppm(const char* filename, const u8* rgb, int width, int height);
+/// Returns a malloc'd image, or null if the file couldn't be read or isn't an 8-bit P6
+u8* read_ppm(const char* filename, int* width, int* height);
+
+struct FrameDiff {
+	int n_pixels; // pixels with any channel off by more than the tolerance
+	int max_error; // largest difference in any channel
+};
+FrameDiff compare_frames(const u8* a, const u8* b, int width, int height, int tolerance);
+
+struct FrameTimeSummary {
+	int n_frames;
+	double total, mean, median, p95, p99, min, max; // seconds
+};
+/// Sorts times in place
+FrameTimeSummary summarize_frame_times(double* times, int n_frames);
@@ -0,0 +1,250 @@
+#include <cstdio>
+#include <cstring>
+#include <string>
+#include <vector>
+#include <deque>
+#include <mutex>
+#include <condition_variable>
+#include <thread>
+#include <atomic>
+#include <chrono>
+#include <algorithm>
+
+#ifdef __linux__
+#include <sys/inotify.h>
+#include <poll.h>
+#include <unistd.h>
+#endif
+
+#include "common.h"
+#include "hotreload.h"
+
+typedef std::chrono::steady_clock Clock;
+
+// Editors tend to save in several steps, so wait for a file to go quiet before touching it
+constexpr auto SETTLE_TIME = std::chrono::milliseconds(100);
+constexpr int POLL_TIMEOUT_MS = 50;
+
+struct WatchEntry {
+	std::string path;
+	std::string name; // path relative to its directory
+	int wd;
+	ReloadPrepareFunc prepare;
+	ReloadApplyFunc apply;
+	ReloadDiscardFunc discard;
+	void* user;
+
+	bool dirty = false;
+	bool queued = false; // at most one reload per file is in flight
+	bool preparing = false; // prepare is reading the asset right now
+	bool removed = false;
+	Clock::time_point changed_at = {};
+};
+
+struct PendingReload {
+	WatchEntry* entry;
+	void* prepared;
+};
+
+static void discard_reload(const PendingReload& reload) {
+	auto w = reload.entry;
+	if (w->discard && reload.prepared) w->discard(w->path.c_str(), w->user, reload.prepared);
+}
+
+static std::mutex watch_mutex;
+static std::condition_variable prepare_done; // signalled whenever an entry stops preparing
+static std::vector<WatchEntry*> watches;
+static std::deque<PendingReload> ready;
+static std::thread watcher;
+static std::atomic<bool> watcher_running(false);
+static int inotify_fd = -1;
+
+#ifdef __linux__
+
+static void read_events() {
+	alignas(inotify_event) char buffer[4096];
+	for (;;) {
+		auto len = read(inotify_fd, buffer, sizeof(buffer));
+		if (len <= 0) return;
+		auto now = Clock::now();
+		std::lock_guard<std::mutex> lock(watch_mutex);
+		for (char* ptr = buffer; ptr < buffer + len; ptr += sizeof(inotify_event) + ((inotify_event*) ptr)->len) {
+			auto event = (inotify_event*) ptr;
+			if (event->len == 0) continue;
+			for (auto w : watches) {
+				if (w->wd == event->wd && w->name == event->name) {
+					w->dirty = true;
+					w->changed_at = now;
+				}
+			}
+		}
+	}
+}
+
+static void prepare_settled() {
+	auto now = Clock::now();
+	std::vector<WatchEntry*> settled;
+	{
+		std::lock_guard<std::mutex> lock(watch_mutex);
+		for (auto w : watches) {
+			if (w->dirty && !w->queued && !w->removed && now - w->changed_at >= SETTLE_TIME) {
+				w->dirty = false;
+				w->queued = true;
+				w->preparing = true;
+				settled.push_back(w);
+			}
+		}
+	}
+	// Prepare outside of the lock; this is the slow part.
+	for (auto w : settled) {
+		void* prepared = w->prepare ? w->prepare(w->path.c_str(), w->user) : nullptr;
+		std::lock_guard<std::mutex> lock(watch_mutex);
+		w->preparing = false;
+		prepare_done.notify_all();
+		if (w->prepare && prepared == nullptr) {
+			w->queued = false;
+			if (w->removed) {
+				watches.erase(std::find(watches.begin(), watches.end(), w));
+				delete w;
+			}
+			continue;
+		}
+		ready.push_back({ w, prepared });
+	}
+}
+
+static void watcher_main() {
+	pollfd pfd = { inotify_fd, POLLIN, 0 };
+	while (watcher_running) {
+		if (poll(&pfd, 1, POLL_TIMEOUT_MS) > 0 && (pfd.revents & POLLIN)) {
+			read_events();
+		}
+		prepare_settled();
+	}
+}
+
+bool init_hot_reload() {
+	if (inotify_fd >= 0) return true;
+	inotify_fd = inotify_init1(IN_NONBLOCK | IN_CLOEXEC);
+	if (inotify_fd < 0) {
+		perror("inotify_init1");
+		return false;
+	}
+	watcher_running = true;
+	watcher = std::thread(watcher_main);
+	return true;
+}
+
+void shutdown_hot_reload() {
+	if (inotify_fd < 0) return;
+	watcher_running = false;
+	watcher.join();
+	close(inotify_fd);
+	inotify_fd = -1;
+	// Anything still prepared is dropped; the owning asset is going away with us.
+	for (auto& reload : ready) discard_reload(reload);
+	ready.clear();
+	for (auto w : watches) delete w;
+	watches.clear();
+}
+
+bool watch_file(const char* path, ReloadApplyFunc apply, void* user, ReloadPrepareFunc prepare, ReloadDiscardFunc discard) {
+	if (inotify_fd < 0) return false;
+	std::string dir = path;
+	std::string name;
+	auto sep = dir.find_last_of('/');
+	if (sep == std::string::npos) {
+		name = dir;
+		dir = ".";
+	}
+	else {
+		name = dir.substr(sep + 1);
+		dir.resize(sep);
+	}
+	// Watch the directory rather than the file so that save-by-rename is caught too
+	int wd = inotify_add_watch(inotify_fd, dir.c_str(), IN_CLOSE_WRITE | IN_MOVED_TO | IN_CREATE);
+	if (wd < 0) {
+		ERR_LOG("Unable to watch '%s' for changes", path);
+		return false;
+	}
+	auto entry = new WatchEntry{ path, name, wd, prepare, apply, discard, user };
+	std::lock_guard<std::mutex> lock(watch_mutex);
+	watches.push_back(entry);
+	return true;
+}
+
+#else
+
+bool init_hot_reload() {
+	ERR_LOG("Hot reloading is not supported on this platform");
+	return false;
+}
+
+void shutdown_hot_reload() {}
+
+bool watch_file(const char* path, ReloadApplyFunc apply, void* user, ReloadPrepareFunc prepare, ReloadDiscardFunc discard) {
+	return false;
+}
+
+#endif
+
+void unwatch_file(const char* path, void* user) {
+	std::unique_lock<std::mutex> lock(watch_mutex);
+	// The caller is about to free user, which a prepare running on the watcher thread may still be reading
+	prepare_done.wait(lock, [&] {
+		for (auto w : watches) {
+			if (w->preparing && w->path == path && w->user == user) return false;
+		}
+		return true;
+	});
+	for (auto it = watches.begin(); it != watches.end(); ) {
+		auto w = *it;
+		if (w->path == path && w->user == user) {
+			if (w->queued) {
+				// Still referenced by the ready queue (or being prepared); poll_hot_reload cleans it up.
+				w->removed = true;
+				it++;
+			}
+			else {
+				delete w;
+				it = watches.erase(it);
+			}
+		}
+		else it++;
+	}
+}
+
+int poll_hot_reload(int max_reloads) {
+	int applied = 0;
+	while (applied < max_reloads) {
+		PendingReload reload;
+		{
+			std::lock_guard<std::mutex> lock(watch_mutex);
+			if (ready.empty()) break;
+			reload = ready.front();
+			ready.pop_front();
+		}
+		auto w = reload.entry;
+		bool removed;
+		{
+			std::lock_guard<std::mutex> lock(watch_mutex);
+			removed = w->removed;
+		}
+		// Once queued, nothing but this function frees the entry, so it's safe to use outside the lock
+		if (removed) {
+			discard_reload(reload);
+		}
+		else {
+			w->apply(w->path.c_str(), w->user, reload.prepared);
+			printf("Reloaded '%s'\n", w->path.c_str());
+			applied++;
+		}
+		std::lock_guard<std::mutex> lock(watch_mutex);
+		w->queued = false;
+		if (w->removed) {
+			watches.erase(std::find(watches.begin(), watches.end(), w));
+			delete w;
+		}
+	}
+	return applied;
+}
@@ -0,0 +1,23 @@
+#pragma once
+
+// Watches asset files for changes so they can be reloaded without restarting.
+// Changes are picked up on a background thread; reloads are applied on the render thread in poll_hot_reload.
+
+/// Optional; runs on the watcher thread to do the slow part of a reload (file I/O, decoding).
+/// Return nullptr to skip this change (e.g. the file is only partially written).
+typedef void* (*ReloadPrepareFunc)(const char* path, void* user);
+/// Runs on the render thread with whatever prepare returned (nullptr if there is no prepare step).
+typedef void (*ReloadApplyFunc)(const char* path, void* user, void* prepared);
+/// Frees what prepare returned when a reload is dropped instead of applied (unwatched, or shutting down).
+/// user may already have been freed by then.
+typedef void (*ReloadDiscardFunc)(const char* path, void* user, void* prepared);
+
+bool init_hot_reload();
+void shutdown_hot_reload();
+
+bool watch_file(const char* path, ReloadApplyFunc apply, void* user, ReloadPrepareFunc prepare = nullptr, ReloadDiscardFunc discard = nullptr);
+/// Waits for a prepare that is already running for this file to finish, so user can be freed as soon as this returns.
+void unwatch_file(const char* path, void* user);
+
+/// Apply at most max_reloads pending reloads so a burst of saves can't stall a frame. Returns how many were applied.
+int poll_hot_reload(int max_reloads = 1);
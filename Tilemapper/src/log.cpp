@@ -0,0 +1,117 @@
+#include <cstdio>
+#include <cstdarg>
+#include <atomic>
+
+#include "common.h"
+#include "log.h"
+
+#ifndef LOG_QUEUE_SIZE
+#define LOG_QUEUE_SIZE 1024 // messages; must be a power of two
+#endif
+#ifndef LOG_MESSAGE_SIZE
+#define LOG_MESSAGE_SIZE 256 // bytes, including the null terminator; longer messages are truncated
+#endif
+
+static_assert((LOG_QUEUE_SIZE & (LOG_QUEUE_SIZE - 1)) == 0, "LOG_QUEUE_SIZE must be a power of two");
+
+// Bounded MPSC queue in the style of Vyukov's bounded queue. Each slot's sequence says whose turn it is:
+// == position: free for the producer that claims that position
+// == position + 1: written and ready for the consumer
+// Producers claim positions with a CAS on tail and never wait on each other; a full queue drops the message.
+struct LogSlot {
+	std::atomic<u32> sequence;
+	LogLevel level;
+	u32 length;
+	char text[LOG_MESSAGE_SIZE];
+};
+
+struct LogQueue {
+	LogSlot slots[LOG_QUEUE_SIZE];
+	alignas(64) std::atomic<u32> tail{ 0 }; // next position to claim
+	alignas(64) u32 head = 0; // next position to drain; consumer only
+	std::atomic<u64> dropped{ 0 };
+	std::atomic<int> min_level{ LOG_DEBUG };
+
+	LogQueue() {
+		for (u32 i = 0; i < LOG_QUEUE_SIZE; i++) {
+			slots[i].sequence.store(i, std::memory_order_relaxed);
+		}
+	}
+};
+
+static LogQueue log_queue;
+
+void set_log_level(LogLevel level) {
+	log_queue.min_level.store(level, std::memory_order_relaxed);
+}
+
+LogLevel get_log_level() {
+	return (LogLevel) log_queue.min_level.load(std::memory_order_relaxed);
+}
+
+static LogSlot* claim_slot(u32* position) {
+	u32 pos = log_queue.tail.load(std::memory_order_relaxed);
+	for (;;) {
+		LogSlot* slot = &log_queue.slots[pos & (LOG_QUEUE_SIZE - 1)];
+		u32 seq = slot->sequence.load(std::memory_order_acquire);
+		i32 diff = (i32)(seq - pos);
+		if (diff == 0) {
+			if (log_queue.tail.compare_exchange_weak(pos, pos + 1, std::memory_order_relaxed)) {
+				*position = pos;
+				return slot;
+			}
+		}
+		else if (diff < 0) {
+			return nullptr; // still holds a message from the previous lap: full
+		}
+		else {
+			pos = log_queue.tail.load(std::memory_order_relaxed);
+		}
+	}
+}
+
+void log_message(LogLevel level, const char* fmt, ...) {
+	if (level < log_queue.min_level.load(std::memory_order_relaxed)) return;
+	u32 pos;
+	LogSlot* slot = claim_slot(&pos);
+	if (!slot) {
+		log_queue.dropped.fetch_add(1, std::memory_order_relaxed);
+		return;
+	}
+	va_list args;
+	va_start(args, fmt);
+	int len = vsnprintf(slot->text, LOG_MESSAGE_SIZE, fmt, args);
+	va_end(args);
+	slot->level = level;
+	slot->length = len < 0 ? 0 : min(len, LOG_MESSAGE_SIZE - 1);
+	slot->sequence.store(pos + 1, std::memory_order_release);
+}
+
+int drain_log(LogSink sink, void* user, int max_messages) {
+	int drained = 0;
+	while (drained < max_messages) {
+		u32 pos = log_queue.head;
+		LogSlot* slot = &log_queue.slots[pos & (LOG_QUEUE_SIZE - 1)];
+		// Stops at the first slot that is still being written, even if later ones are done, to keep order
+		if (slot->sequence.load(std::memory_order_acquire) != pos + 1) break;
+		sink(user, slot->level, slot->text, slot->length);
+		slot->sequence.store(pos + LOG_QUEUE_SIZE, std::memory_order_release);
+		log_queue.head = pos + 1;
+		drained++;
+	}
+	return drained;
+}
+
+u64 take_dropped_log_count() {
+	return log_queue.dropped.exchange(0, std::memory_order_relaxed);
+}
+
+static void print_to_terminal(void*, LogLevel level, const char* text, u32 length) {
+	fprintf(level >= LOG_WARNING ? stderr : stdout, "%.*s\n", (int)length, text);
+}
+
+void flush_log() {
+	while (drain_log(print_to_terminal, nullptr, LOG_QUEUE_SIZE) > 0);
+	u64 dropped = take_dropped_log_count();
+	if (dropped) fprintf(stderr, "(%llu log messages dropped)\n", (unsigned long long) dropped);
+}
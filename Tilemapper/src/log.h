@@ -0,0 +1,22 @@
+#pragma once
+
+#include "common.h"
+
+// Log messages from any thread go into a bounded lock-free queue (see log_message in common.h).
+// The render thread drains it once per frame, so a burst of messages can't stall anyone.
+
+/// Called once for each message drained; text is only valid during the call.
+typedef void (*LogSink)(void* user, LogLevel level, const char* text, u32 length);
+
+/// Messages below this level are discarded by log_message before being formatted.
+void set_log_level(LogLevel level);
+LogLevel get_log_level();
+
+/// Hands at most max_messages queued messages to sink, oldest first, and returns how many were drained.
+/// Only one thread may drain at a time.
+int drain_log(LogSink sink, void* user, int max_messages);
+/// Messages thrown away because the queue was full, since the last call
+u64 take_dropped_log_count();
+
+/// Drains everything still queued to stdout/stderr. Use at shutdown, once nothing else is draining.
+void flush_log();
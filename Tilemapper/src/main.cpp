@@ -3,10 +3,15 @@
 #include <glfw3.h>
 
 #include <cstdio>
+#include <cstdlib>
+#include <cstring>
 
 #include "renderer.h"
 #include "text.h"
 #include "console.h"
+#include "hotreload.h"
+#include "log.h"
+#include "headless.h"
 
 constexpr int virtual_width = 512;
 constexpr int virtual_height = 288;
@@ -42,6 +47,8 @@ void framebuffer_size_callback(GLFWwindow* window, int width, int height) {
 
 static bool console_active = false;
 static bool is_fullscreen = false;
+static bool headless = false;
+static bool headless_quit = false;
 
 void toggle_fullscreen(GLFWwindow* window) {
 	static int windowed_width = virtual_width;
@@ -64,11 +71,16 @@ void toggle_fullscreen(GLFWwindow* window) {
 
 // @console name=toggle_fullscreen
 void console_toggle_fullscreen() {
+	if (headless) return;
 	toggle_fullscreen(glfwGetCurrentContext());
 }
 
 // @console name=quit
 void __quit() {
+	if (headless) {
+		headless_quit = true;
+		return;
+	}
 	glfwSetWindowShouldClose(glfwGetCurrentContext(), true);
 }
 
@@ -114,7 +126,229 @@ void key_callback(GLFWwindow* window, int key, int scancode, int action, int mod
 	}
 }
 
+// The demo scene, shared by the windowed and headless loops
+struct Scene {
+	TileChunk* test_chunk;
+	ChunkID blah;
+	float blah_base_x, blah_base_y;
+	SpriteID meh;
+	float meh_base_x, meh_base_y;
+	int r = 0xf, g = 0, b = 0;
+};
+
+static Scene make_scene(Renderer* renderer, bool watch) {
+	Scene scene;
+	auto tileset = load_tileset("assets/tileset24bit.png", 16);
+	if (watch) watch_tileset(tileset);
+	scene.test_chunk = new TileChunk(tileset, simple_tilemap, 4, 4);
+	renderer->add_chunk(scene.test_chunk, 8, 8, 0);
+	renderer->add_chunk(scene.test_chunk, 64, 24, -2);
+	renderer->add_chunk(scene.test_chunk, 60, 20, -2);
+	renderer->add_chunk(scene.test_chunk, 96, 16, -3);
+	renderer->add_chunk(scene.test_chunk, 125, 35, 0);
+	scene.blah = renderer->add_chunk(scene.test_chunk, 150, 80, 2);
+	scene.blah_base_x = scene.blah->x;
+	scene.blah_base_y = scene.blah->y;
+
+	auto spritesheet = load_spritesheet("assets/tileset24bit.png");
+	if (watch) watch_spritesheet(spritesheet);
+	renderer->add_sprite(spritesheet, 120.f, 74.f, 1, 0, 0, 16, 16, 0);
+	renderer->add_sprite(spritesheet, 10.f, 11.f, 0, 17, 2, 8, 8, 0);
+	scene.meh = renderer->add_sprite(spritesheet, 127.f, 90.f, 2, 47, 93, 15, 21, 0);
+	scene.meh_base_x = scene.meh->attrs.x;
+	scene.meh_base_y = scene.meh->attrs.y;
+	return scene;
+}
+
+static void update_scene(Scene* scene, Renderer* renderer, float time) {
+	int& r = scene->r;
+	int& g = scene->g;
+	int& b = scene->b;
+	if (r == 0xf) {
+		if (b > 0) b--;
+		else if (g == 0xf) r--;
+		else g++;
+	}
+	else if (g == 0xf) {
+		if (r > 0) r--;
+		else if (b == 0xf) g--;
+		else b++;
+	}
+	else if (b == 0xf) {
+		if (g > 0) g--;
+		else if (r == 0xf) b--;
+		else r++;
+	}
+
+	scene->blah->x = 96 * sinf(time * TAU * 0.8) + scene->blah_base_x;
+	scene->blah->y = 52 * cosf(time * TAU * 1.2) + scene->blah_base_y;
+
+	scene->meh->attrs.x = 120 * sinf(time * TAU * 0.3) + scene->meh_base_x;
+	scene->meh->attrs.y = 12 * cosf(time * TAU * 0.5) + scene->meh_base_y;
+
+	renderer->print_fmt(200, 1, TEXT_FMT("#c[7f1]Scaling sharpness: {.3}\n"), scaling_sharpness);
+	renderer->print_fmt(88, 74, TEXT_FMT("The quick brown fox\n#c[{x}{x}{x}]jumps#0 over the lazy dog."), r, g, b);
+	renderer->print_string(88, 100, "HOW\tVEXINGLY\tQUICK\nDAFT\tZEBRAS\tJUMP!\nLycanthrope: Werewolf.\nLVA\niji\nf_J,T.V,P.");
+	renderer->print_string(300, 20, "01234,56789_ABC;DEF.##$");
+}
+
+// Scripts run once the scene exists so they can poke at it
+static void run_scripts(int argc, char* argv[]) {
+	for (int i = 1; i < argc; i++) {
+		if (strcmp(argv[i], "--exec") == 0 && i + 1 < argc) {
+			console_exec_file(argv[++i]);
+		}
+		else if (strcmp(argv[i], "--stdin") == 0) {
+			console_listen_stdin();
+		}
+		else if (strcmp(argv[i], "--socket") == 0 && i + 1 < argc) {
+			console_listen_socket(argv[++i]);
+		}
+	}
+}
+
+struct HeadlessOptions {
+	int n_frames = 0;
+	const char* save_frame = nullptr; // PPM of the last frame
+	const char* golden = nullptr; // PPM the last frame has to match
+	int tolerance = 1; // per channel, for golden comparisons
+	const char* timings = nullptr; // CSV of every frame's time
+};
+
+/// Renders a fixed number of frames offscreen at a simulated 60 fps, so the frames themselves are deterministic,
+/// and reports how long they really took. Returns the exit code.
+static int run_headless(const HeadlessOptions& options, int argc, char* argv[]) {
+	constexpr float HEADLESS_FPS = 60.f;
+
+	init_simple_font();
+	Renderer renderer(nullptr, virtual_width, virtual_height);
+	Scene scene = make_scene(&renderer, false);
+	logOpenGLErrors();
+	run_scripts(argc, argv);
+
+	double* frame_times = alloc(double, options.n_frames);
+	int n_frames = 0;
+	double run_start = get_time();
+	while (n_frames < options.n_frames && !headless_quit) {
+		double frame_start = get_time();
+		poll_console_input();
+		poll_console_log();
+
+		float time = n_frames / HEADLESS_FPS;
+		update_scene(&scene, &renderer, time);
+		renderer.draw_frame(HEADLESS_FPS, show_fps, console_active, fmod(time, CURSOR_BLINK_PERIOD) < CURSOR_BLINK_DUTY_CYCLE);
+		// Without a swap nothing waits for the GPU, so make each frame pay for its own rendering
+		glFinish();
+		frame_times[n_frames++] = get_time() - frame_start;
+
+		logOpenGLErrors();
+		temp_storage_clear();
+	}
+	double run_time = get_time() - run_start;
+
+	int status = 0;
+	if (options.timings) {
+		FILE* file = fopen(options.timings, "w");
+		if (file) {
+			fprintf(file, "frame,ms\n");
+			for (int i = 0; i < n_frames; i++) {
+				fprintf(file, "%d,%.4f\n", i, frame_times[i] * 1000.0);
+			}
+			fclose(file);
+		}
+		else {
+			fprintf(stderr, "Unable to write timings to %s\n", options.timings);
+			status = 1;
+		}
+	}
+
+	auto summary = summarize_frame_times(frame_times, n_frames);
+	printf("%d frames in %.3fs (%.1f fps): mean %.3fms, median %.3fms, p95 %.3fms, p99 %.3fms, min %.3fms, max %.3fms\n",
+		summary.n_frames, run_time, n_frames / run_time,
+		summary.mean * 1000.0, summary.median * 1000.0, summary.p95 * 1000.0, summary.p99 * 1000.0,
+		summary.min * 1000.0, summary.max * 1000.0);
+	free(frame_times);
+
+	if (options.save_frame || options.golden) {
+		u8* frame = alloc(u8, virtual_width * virtual_height * 3);
+		renderer.read_frame(frame, virtual_width, virtual_height);
+		if (options.save_frame && !write_ppm(options.save_frame, frame, virtual_width, virtual_height)) {
+			fprintf(stderr, "Unable to write the frame to %s\n", options.save_frame);
+			status = 1;
+		}
+		if (options.golden) {
+			int width, height;
+			u8* golden = read_ppm(options.golden, &width, &height);
+			if (!golden) {
+				fprintf(stderr, "Unable to read %s\n", options.golden);
+				status = 1;
+			}
+			else if (width != virtual_width || height != virtual_height) {
+				fprintf(stderr, "%s is %dx%d, but frames are %dx%d\n", options.golden, width, height, virtual_width, virtual_height);
+				status = 1;
+			}
+			else {
+				auto diff = compare_frames(frame, golden, width, height, options.tolerance);
+				if (diff.n_pixels) {
+					printf("Frame doesn't match %s: %d pixels differ by more than %d (at most %d)\n",
+						options.golden, diff.n_pixels, options.tolerance, diff.max_error);
+					status = 1;
+				}
+				else {
+					printf("Frame matches %s\n", options.golden);
+				}
+			}
+			free(golden);
+		}
+		free(frame);
+	}
+
+	delete scene.test_chunk;
+	return status;
+}
+
 int main(int argc, char* argv[]) {
+	HeadlessOptions headless_options;
+	for (int i = 1; i < argc; i++) {
+		if (strcmp(argv[i], "--headless") == 0) {
+			headless = true;
+			if (i + 1 < argc) headless_options.n_frames = atoi(argv[++i]);
+		}
+		else if (i + 1 >= argc) {
+			break;
+		}
+		else if (strcmp(argv[i], "--save-frame") == 0) {
+			headless_options.save_frame = argv[++i];
+		}
+		else if (strcmp(argv[i], "--golden") == 0) {
+			headless_options.golden = argv[++i];
+		}
+		else if (strcmp(argv[i], "--tolerance") == 0) {
+			headless_options.tolerance = atoi(argv[++i]);
+		}
+		else if (strcmp(argv[i], "--timings") == 0) {
+			headless_options.timings = argv[++i];
+		}
+	}
+
+	if (headless) {
+		if (headless_options.n_frames <= 0) {
+			fprintf(stderr, "--headless needs a number of frames\n");
+			flush_log();
+			return -1;
+		}
+		if (!init_headless()) {
+			flush_log();
+			return -1;
+		}
+		init_console();
+		int status = run_headless(headless_options, argc, argv);
+		shutdown_console_input();
+		shutdown_headless();
+		flush_log();
+		return status;
+	}
+
 	glfwInit();
 	glfwWindowHint(GLFW_CONTEXT_VERSION_MAJOR, 3);
 	glfwWindowHint(GLFW_CONTEXT_VERSION_MINOR, 3);
@@ -127,6 +361,7 @@ int main(int argc, char* argv[]) {
 	if (window == nullptr) {
 		printf("Failed to create GLFW window.\n");
 		glfwTerminate();
+		flush_log();
 		getchar();
 		return -1;
 	}
@@ -135,6 +370,7 @@ int main(int argc, char* argv[]) {
 	if (!gladLoadGLLoader((GLADloadproc)glfwGetProcAddress)) {
 		printf("Failed to initialize GLAD\n");
 		glfwTerminate();
+		flush_log();
 		getchar();
 		return -1;
 	}
@@ -144,42 +380,28 @@ int main(int argc, char* argv[]) {
 
 	init_console();
 	glfwSetKeyCallback(window, key_callback);
+	init_hot_reload();
 
 	{
 		init_simple_font();
 		Renderer renderer(window, virtual_width, virtual_height);
-
-		auto tileset = load_tileset("assets/tileset24bit.png", 16);
-		TileChunk test_chunk(tileset, simple_tilemap, 4, 4);
-		renderer.add_chunk(&test_chunk, 8, 8, 0);
-		renderer.add_chunk(&test_chunk, 64, 24, -2);
-		renderer.add_chunk(&test_chunk, 60, 20, -2);
-		renderer.add_chunk(&test_chunk, 96, 16, -3);
-		renderer.add_chunk(&test_chunk, 125, 35, 0);
-		auto blah = renderer.add_chunk(&test_chunk, 150, 80, 2);
-		auto blah_base_x = blah->x;
-		auto blah_base_y = blah->y;
-
-		auto spritesheet = load_spritesheet("assets/tileset24bit.png");
-		renderer.add_sprite(spritesheet, 120.f, 74.f, 1, 0, 0, 16, 16, 0);
-		renderer.add_sprite(spritesheet, 10.f, 11.f, 0, 17, 2, 8, 8, 0);
-		auto meh = renderer.add_sprite(spritesheet, 127.f, 90.f, 2, 47, 93, 15, 21, 0);
-		auto meh_base_x = meh->attrs.x;
-		auto meh_base_y = meh->attrs.y;
+		Scene scene = make_scene(&renderer, true);
 
 		logOpenGLErrors();
 
-		bool pressed = false;
-		float last_frame_time = glfwGetTime();
-		float frame_period = 0.016667f;
+		run_scripts(argc, argv);
 
-		int r = 0xf, g = 0, b = 0;
+		float last_frame_time = get_time();
+		float frame_period = 0.016667f;
 
 		while(!glfwWindowShouldClose(window))
 		{
 			glfwPollEvents();
+			poll_hot_reload();
+			poll_console_input();
+			poll_console_log();
 
-			float time = glfwGetTime();
+			float time = get_time();
 			float diff = time - last_frame_time;
 			if (diff < frame_period * 5.f) { // ignore outliers
 				frame_period = (frame_period * FPS_SMOOTHING) + (diff * (1.f - FPS_SMOOTHING));
@@ -187,32 +409,7 @@ int main(int argc, char* argv[]) {
 			last_frame_time = time;
 			float fps = 1.f / frame_period;
 
-			if (r == 0xf) {
-				if (b > 0) b--;
-				else if (g == 0xf) r--;
-				else g++;
-			}
-			else if (g == 0xf) {
-				if (r > 0) r--;
-				else if (b == 0xf) g--;
-				else b++;
-			}
-			else if (b == 0xf) {
-				if (g > 0) g--;
-				else if (r == 0xf) b--;
-				else r++;
-			}
-
-			blah->x = 96 * sinf(time * TAU * 0.8) + blah_base_x;
-			blah->y = 52 * cosf(time * TAU * 1.2) + blah_base_y;
-
-			meh->attrs.x = 120 * sinf(time * TAU * 0.3) + meh_base_x;
-			meh->attrs.y = 12 * cosf(time * TAU * 0.5) + meh_base_y;
-
-			renderer.print_text(200, 1, "#c[7f1]Scaling sharpness: %.3f\n", scaling_sharpness);
-			renderer.print_text(88, 74, "The quick brown fox\n#c[%x%x%x]jumps#0 over the lazy dog.", r, g, b);
-			renderer.print_text(88, 100, "HOW\tVEXINGLY\tQUICK\nDAFT\tZEBRAS\tJUMP!\nLycanthrope: Werewolf.\nLVA\niji\nf_J,T.V,P.");
-			renderer.print_text(300, 20, "01234,56789_ABC;DEF.##$");
+			update_scene(&scene, &renderer, time);
 
 			renderer.draw_frame(fps, show_fps, console_active, fmod(time, CURSOR_BLINK_PERIOD) < CURSOR_BLINK_DUTY_CYCLE);
 
@@ -220,9 +417,13 @@ int main(int argc, char* argv[]) {
 
 			temp_storage_clear();
 		}
+		delete scene.test_chunk;
 	}
 
+	shutdown_console_input();
+	shutdown_hot_reload();
 	glfwTerminate();
+	flush_log();
 
 	return 0;
 }
@@ -1,5 +1,7 @@
 
 #include <algorithm>
+#include <cstdio>
+#include <cstring>
 
 #include <glad/glad.h>
 #include <glfw3.h>
@@ -8,13 +10,19 @@
 #include "renderer.h"
 #include "text.h"
 #include "console.h"
+#include "hotreload.h"
+#include "workers.h"
+#include "stats.h"
 
 constexpr int CHUNK_MAX = 64;
 constexpr int SPRITE_MAX = 512;
-constexpr int GLYPH_MAX = 256;
-constexpr int STRING_STORAGE_SIZE = 1024 * 16;
-constexpr int PRINT_CMD_WS_MAX = 32;
-constexpr int PRINT_CMD_SS_MAX = 96;
+constexpr int GLYPH_MIN = 8192; // text_vbo starts with room for this many and grows as needed
+constexpr int CONSOLE_GLYPH_MAX = 8192; // the console's share of a frame's glyphs
+constexpr int TEXT_LAYOUT_CACHE_SIZE = 512;
+constexpr size_t FRAME_ARENA_SIZE = 64 * 1024;
+constexpr int PRINT_QUEUE_MIN = 32;
+constexpr int CSET_MAX = 256;
+constexpr int CSET_FX_TEXELS = 3;
 
 constexpr int CONSOLE_LINE_OFFSET_LEFT = 8;
 constexpr int CONSOLE_LINE_OFFSET_BOTTOM = 15;
@@ -27,6 +35,15 @@ struct GlyphPrintData {
 	const char* text;
 	float x;
 	float y;
+	float scale;
+};
+
+struct TextBatch {
+	Font* font;
+	CoordinateSystem coords;
+	int first;
+	int count;
+	float scale;
 };
 
 const float tile_vertices[] = {
@@ -37,29 +54,41 @@ const float tile_vertices[] = {
 };
 
 extern int screen_width, screen_height;
-extern Font simple_font;
 
 // Global Renderer State
 
 // @console name=sharpness
 float scaling_sharpness = 2.f;
 
+// @console
+bool parallel_text_layout = true;
+
 #ifdef NO_EMBED_SHADERS
 
 #define COMPILE_SHADER(V, F) compileShaderFromFiles((V), (F))
-#define TILECHUNK_VERT_SHADER = "shaders/tilechunk.vert"
-#define TILECHUNK_VERT_SHADER = "shaders/tilechunk.frag"
-#define SPRITE_VERT_SHADER = "shaders/sprite.vert"
-#define SPRITE_VERT_SHADER = "shaders/sprite.frag"
-#define SCALE_VERT_SHADER = "shaders/scale.vert"
-#define SCALE_VERT_SHADER = "shaders/scale.frag"
-
-#define TILECHUNK_VERT_SHADER__SRC = "tilechunk.vert"
-#define TILECHUNK_VERT_SHADER__SRC = "tilechunk.frag"
-#define SPRITE_VERT_SHADER__SRC = "sprite.vert"
-#define SPRITE_VERT_SHADER__SRC = "spirte.frag"
-#define SCALE_VERT_SHADER__SRC = "scale.vert"
-#define SCALE_VERT_SHADER__SRC = "scale.frag"
+#define TILECHUNK_VERT_SHADER "shaders/tilechunk.vert"
+#define TILECHUNK_FRAG_SHADER "shaders/tilechunk.frag"
+#define SPRITE_VERT_SHADER "shaders/sprite.vert"
+#define SPRITE_FRAG_SHADER "shaders/sprite.frag"
+#define SCALE_VERT_SHADER "shaders/scale.vert"
+#define SCALE_FRAG_SHADER "shaders/scale.frag"
+#define TEXT_VERT_SHADER "shaders/text.vert"
+#define TEXT_FRAG_SHADER "shaders/text.frag"
+#define TEXT_SDF_FRAG_SHADER "shaders/text_sdf.frag"
+#define OVERLAY_VERT_SHADER "shaders/overlay.vert"
+#define OVERLAY_FRAG_SHADER "shaders/overlay.frag"
+
+#define TILECHUNK_VERT_SHADER__SRC TILECHUNK_VERT_SHADER
+#define TILECHUNK_FRAG_SHADER__SRC TILECHUNK_FRAG_SHADER
+#define SPRITE_VERT_SHADER__SRC SPRITE_VERT_SHADER
+#define SPRITE_FRAG_SHADER__SRC SPRITE_FRAG_SHADER
+#define SCALE_VERT_SHADER__SRC SCALE_VERT_SHADER
+#define SCALE_FRAG_SHADER__SRC SCALE_FRAG_SHADER
+#define TEXT_VERT_SHADER__SRC TEXT_VERT_SHADER
+#define TEXT_FRAG_SHADER__SRC TEXT_FRAG_SHADER
+#define TEXT_SDF_FRAG_SHADER__SRC TEXT_SDF_FRAG_SHADER
+#define OVERLAY_VERT_SHADER__SRC OVERLAY_VERT_SHADER
+#define OVERLAY_FRAG_SHADER__SRC OVERLAY_FRAG_SHADER
 
 #else
 
@@ -71,35 +100,23 @@ float scaling_sharpness = 2.f;
 #define __SHADER(S) COMPILE_SHADER(S ## _VERT_SHADER, S ## _FRAG_SHADER), S ## _VERT_SHADER__SRC, S ## _FRAG_SHADER__SRC
 #define __SHADER2(V, F) COMPILE_SHADER(V ## _VERT_SHADER, F ## _FRAG_SHADER), V ## _VERT_SHADER__SRC, F ## _FRAG_SHADER__SRC
 
-#define EXPAND(V) V
-#define __S_SL EXPAND(__S) ## _slots
-#define __S_SH EXPAND(__S) ## _shader
+#define __CAT2(A, B) A ## B
+#define __CAT(A, B) __CAT2(A, B) // expands __S before pasting
+#define __S_SL __CAT(__S, _slots)
+#define __S_SH __CAT(__S, _shader)
 #define __SLOT(VAR) (__S_SL.VAR) = (__S_SH).getSlot(#VAR)
 Renderer::Renderer(GLFWwindow* window, int width, int height):
 	window(window),
 	tile_shader(__SHADER(TILECHUNK)),
-	sprite_shader(__SHADER(SPRITE)),
 	scale_shader(__SHADER(SCALE)),
+	sprite_shader(__SHADER(SPRITE)),
 	text_shader(__SHADER(TEXT)),
+	text_sdf_shader(__SHADER2(TEXT, TEXT_SDF)),
 	overlay_shader(__SHADER(OVERLAY)),
 	chunks(CHUNK_MAX),
 	sprites(SPRITE_MAX)
 {
-#define __S tile
-#include "generated/tilechunk_uniforms.h"
-#undef __S
-
-#define __S scale
-#include "generated/scale_uniforms.h"
-#undef __S
-
-#define __S sprite
-#include "generated/sprite_uniforms.h"
-#undef __S
-
-#define __S text
-#include "generated/text_uniforms.h"
-#undef __S
+	_load_uniform_slots();
 
 	glGenVertexArrays(1, &vao);
 	glBindVertexArray(vao);
@@ -117,6 +134,26 @@ Renderer::Renderer(GLFWwindow* window, int width, int height):
 		}
 	});
 
+	cset_fx = alloc(glm::vec4, CSET_MAX * CSET_FX_TEXELS);
+	for (int i = 0; i < CSET_MAX; i++) {
+		cset_fx[i * CSET_FX_TEXELS + 0] = { 1.f, 1.f, 1.f, 0.f };
+		cset_fx[i * CSET_FX_TEXELS + 1] = { 0.f, 0.f, 0.f, 0.f };
+		cset_fx[i * CSET_FX_TEXELS + 2] = { 0.f, 0.f, 0.f, 0.f };
+	}
+	cset_fx_dirty_lo = CSET_MAX;
+	cset_fx_dirty_hi = 0;
+	use_cset_fx = false;
+
+	glGenBuffers(1, &cset_fx_buffer);
+	glBindBuffer(GL_TEXTURE_BUFFER, cset_fx_buffer);
+	glBufferData(GL_TEXTURE_BUFFER, sizeof(glm::vec4) * CSET_MAX * CSET_FX_TEXELS, cset_fx, GL_DYNAMIC_DRAW);
+
+	GLuint cset_fx_tex;
+	glGenTextures(1, &cset_fx_tex);
+	glBindTexture(GL_TEXTURE_BUFFER, cset_fx_tex);
+	glTexBuffer(GL_TEXTURE_BUFFER, GL_RGBA32F, cset_fx_buffer);
+	cset_fx_texture = make_texture(cset_fx_tex, GL_TEXTURE_BUFFER);
+
 	v_width = width;
 	v_height = height;
 
@@ -144,40 +181,139 @@ Renderer::Renderer(GLFWwindow* window, int width, int height):
 
 	//glGenBuffers(1, &text_vbo); // done earlier
 	glBindBuffer(GL_ARRAY_BUFFER, text_vbo);
-	glBufferData(GL_ARRAY_BUFFER, sizeof(GlyphRenderData) * GLYPH_MAX, sprite_attrs, GL_STREAM_DRAW); // reserve GPU memory
+	glBufferData(GL_ARRAY_BUFFER, sizeof(GlyphRenderData) * GLYPH_MIN, nullptr, GL_STREAM_DRAW); // reserve GPU memory
+	text_vbo_glyphs = GLYPH_MIN;
+
+	text_cache = make_text_layout_cache(TEXT_LAYOUT_CACHE_SIZE);
+	workers = make_worker_pool();
+	parallel_text = make_parallel_text_layout(workers, GLYPH_MIN, TEXT_LAYOUT_CACHE_SIZE);
 
-	temp_string_storage = alloc(char, STRING_STORAGE_SIZE);
-	string_storage_next = temp_string_storage;
-	print_later_ws_start = alloc(GlyphPrintData, PRINT_CMD_WS_MAX);
-	print_later_ws = print_later_ws_start;
-	print_later_ss_start = alloc(GlyphPrintData, PRINT_CMD_SS_MAX);
-	print_later_ss = print_later_ss_start;
+	frame_arenas[0] = make_arena(FRAME_ARENA_SIZE, STAT_FRAME_STORAGE_PEAK);
+	frame_arenas[1] = make_arena(FRAME_ARENA_SIZE, STAT_FRAME_STORAGE_PEAK);
+	frame_arena = frame_arenas[0];
+	print_later[WORLD_SPACE] = {};
+	print_later[SCREEN_SPACE] = {};
+	text_glyphs = nullptr;
+	text_glyphs_max = 0;
 
 	ui_camera = glm::ortho(0.f, (float) width, 0.f, (float) height, 1024.f, -1024.f);
 	world_camera = glm::ortho(0.f, (float) width, 0.f, (float) height, 128.f, -128.f);
+	text_scale = 1.f;
 
 	glEnable(GL_BLEND);
 	glBlendFunc(GL_SRC_ALPHA, GL_ONE_MINUS_SRC_ALPHA);
 	glDisable(GL_DEPTH_TEST);
 	glDisable(GL_CULL_FACE);
+
+#ifdef NO_EMBED_SHADERS
+	shader_sources[0] = { this, &tile_shader, TILECHUNK_VERT_SHADER, TILECHUNK_FRAG_SHADER };
+	shader_sources[1] = { this, &sprite_shader, SPRITE_VERT_SHADER, SPRITE_FRAG_SHADER };
+	shader_sources[2] = { this, &scale_shader, SCALE_VERT_SHADER, SCALE_FRAG_SHADER };
+	shader_sources[3] = { this, &text_shader, TEXT_VERT_SHADER, TEXT_FRAG_SHADER };
+	shader_sources[4] = { this, &overlay_shader, OVERLAY_VERT_SHADER, OVERLAY_FRAG_SHADER };
+	shader_sources[5] = { this, &text_sdf_shader, TEXT_VERT_SHADER, TEXT_SDF_FRAG_SHADER };
+	// Headless runs never poll for reloads (or init them), and their frames should come from the shaders they started with
+	if (window) {
+		for (auto& src : shader_sources) {
+			watch_file(src.vert, _reload_shader, &src);
+			watch_file(src.frag, _reload_shader, &src);
+		}
+	}
+#endif
 }
 
-void Renderer::draw_frame(float fps, bool show_fps, bool show_console, bool show_cursor) {
-#ifndef NDEBUG
-	float start_time = glfwGetTime();
+Renderer::~Renderer() {
+#ifdef NO_EMBED_SHADERS
+	for (auto& src : shader_sources) {
+		unwatch_file(src.vert, &src);
+		unwatch_file(src.frag, &src);
+	}
 #endif
+	// The layout chunks run on the pool, so they go first
+	free_parallel_text_layout(parallel_text);
+	free_worker_pool(workers);
+	free_text_layout_cache(text_cache);
+	free_arena(frame_arenas[0]);
+	free_arena(frame_arenas[1]);
+
+	free(sprite_attrs);
+	free(cset_fx);
+	free_texture(cset_fx_texture);
+	glDeleteBuffers(1, &cset_fx_buffer);
+	free_palette(palette);
+
+	free_texture(framebuffer);
+	glDeleteFramebuffers(1, &fbo);
+	glDeleteBuffers(3, &rect_vbo);
+	glDeleteVertexArrays(1, &vao);
+}
 
-	u32 chunk_order[CHUNK_MAX];
+void Renderer::_load_uniform_slots() {
+#define __S tile
+#include "generated/tilechunk_uniforms.h"
+#undef __S
+
+#define __S scale
+#include "generated/scale_uniforms.h"
+#undef __S
+
+#define __S sprite
+#include "generated/sprite_uniforms.h"
+#undef __S
+
+#define __S text
+#include "generated/text_uniforms.h"
+#undef __S
+
+#define __S text_sdf
+#include "generated/text_uniforms.h"
+#undef __S
+
+#define __S overlay
+#include "generated/overlay_uniforms.h"
+#undef __S
+}
+
+#ifdef NO_EMBED_SHADERS
+void Renderer::_reload_shader(const char*, void* user, void*) {
+	auto src = (ShaderSource*) user;
+	GLuint program = compileShaderFromFiles(src->vert, src->frag);
+	if (program == INVALID_PROGRAM) {
+		printf("Keeping the previous version of %s + %s\n", src->vert, src->frag);
+		return;
+	}
+	*src->shader = Shader(program, src->vert, src->frag);
+	src->renderer->_load_uniform_slots();
+}
+#endif
+
+void Renderer::draw_frame(float fps, bool show_fps, bool show_console, bool show_cursor) {
+	double start_time = get_time();
+
+	u32* chunk_order = _frame_alloc<u32>(CHUNK_MAX);
 	u32 clen = _sort_chunks(chunk_order);
 
-	u32 sprite_order[SPRITE_MAX];
+	u32* sprite_order = _frame_alloc<u32>(SPRITE_MAX);
 	u32 slen = _sort_sprites(sprite_order);
+	count_stat(STAT_SORT_MICROS, (u64)((get_time() - start_time) * 1e6));
 	// prepare all the sprite attributes for sending to the GPU
 	for (u32 i = 0; i < slen; i++) {
 		auto it = sprite_order[i];
 		sprite_attrs[i] = sprites[it].attrs;
 	}
 
+	if (cset_fx_dirty_lo < cset_fx_dirty_hi) {
+		glBindBuffer(GL_TEXTURE_BUFFER, cset_fx_buffer);
+		glBufferSubData(GL_TEXTURE_BUFFER,
+			sizeof(glm::vec4) * CSET_FX_TEXELS * cset_fx_dirty_lo,
+			sizeof(glm::vec4) * CSET_FX_TEXELS * (cset_fx_dirty_hi - cset_fx_dirty_lo),
+			&cset_fx[CSET_FX_TEXELS * cset_fx_dirty_lo]
+		);
+		count_stat(STAT_BUFFER_UPLOAD_BYTES, sizeof(glm::vec4) * CSET_FX_TEXELS * (cset_fx_dirty_hi - cset_fx_dirty_lo));
+		cset_fx_dirty_lo = CSET_MAX;
+		cset_fx_dirty_hi = 0;
+	}
+
 	// Prepare for drawing
 	glBindFramebuffer(GL_FRAMEBUFFER, fbo);
 	glViewport(0, 0, v_width, v_height);
@@ -191,10 +327,16 @@ void Renderer::draw_frame(float fps, bool show_fps, bool show_console, bool show
 
 	while (ci < clen || si < slen) {
 		if (si >= slen // no more sprites to draw
-			|| ci < clen && chunks[chunk_order[ci]].layer <= sprite_attrs[si].layer) { // or this chunk is on the same layer or below as the next sprite
+			|| (ci < clen && chunks[chunk_order[ci]].layer <= sprite_attrs[si].layer)) { // or this chunk is on the same layer or below as the next sprite
 			if (current_shader != TILECHUNK) {
 				tile_shader.use();
 				tile_shader.set(tile_slots.palette, bind(palette, 1));
+				tile_shader.set(tile_slots.palette_mul, palette_fx.mul);
+				tile_shader.set(tile_slots.palette_add, palette_fx.add);
+				tile_shader.set(tile_slots.palette_lerp, palette_fx.lerp);
+				tile_shader.set(tile_slots.use_cset_fx, use_cset_fx);
+				// Unused, cset_fx still has to be on its own unit: samplers of different types can't share one
+				tile_shader.set(tile_slots.cset_fx, use_cset_fx ? bind(cset_fx_texture, 2) : 2);
 				tile_shader.setCamera(world_camera);
 
 				glBindBuffer(GL_ARRAY_BUFFER, rect_vbo);
@@ -202,6 +344,7 @@ void Renderer::draw_frame(float fps, bool show_fps, bool show_console, bool show
 				glEnableVertexAttribArray(0);
 				glDisableVertexAttribArray(3);
 				glDisableVertexAttribArray(4);
+				glDisableVertexAttribArray(5);
 
 				current_shader = TILECHUNK;
 			}
@@ -222,6 +365,8 @@ void Renderer::draw_frame(float fps, bool show_fps, bool show_console, bool show
 			glVertexAttribDivisor(2, 1);
 
 			glDrawArraysInstanced(GL_TRIANGLE_FAN, 0, 4, chunk.chunk->width * chunk.chunk->height);
+			count_stat(STAT_DRAW_CALLS);
+			count_stat(STAT_INSTANCES, chunk.chunk->width * chunk.chunk->height);
 
 			ci++;
 		}
@@ -229,6 +374,12 @@ void Renderer::draw_frame(float fps, bool show_fps, bool show_console, bool show
 			if (current_shader != SPRITE) {
 				sprite_shader.use();
 				sprite_shader.set(sprite_slots.palette, bind(palette, 1));
+				sprite_shader.set(sprite_slots.palette_mul, palette_fx.mul);
+				sprite_shader.set(sprite_slots.palette_add, palette_fx.add);
+				sprite_shader.set(sprite_slots.palette_lerp, palette_fx.lerp);
+				sprite_shader.set(sprite_slots.use_cset_fx, use_cset_fx);
+				// Unused, cset_fx still has to be on its own unit: samplers of different types can't share one
+				sprite_shader.set(sprite_slots.cset_fx, use_cset_fx ? bind(cset_fx_texture, 2) : 2);
 				sprite_shader.setCamera(world_camera);
 
 				glBindBuffer(GL_ARRAY_BUFFER, rect_vbo);
@@ -248,19 +399,24 @@ void Renderer::draw_frame(float fps, bool show_fps, bool show_console, bool show
 				glVertexAttribIPointer(4, 1, GL_INT, sizeof(SpriteAttributes), (void*)offsetof(SpriteAttributes, flags));
 				glEnableVertexAttribArray(4);
 				glVertexAttribDivisor(4, 1);
+				glVertexAttribIPointer(5, 1, GL_INT, sizeof(SpriteAttributes), (void*)offsetof(SpriteAttributes, sheet));
+				glEnableVertexAttribArray(5);
+				glVertexAttribDivisor(5, 1);
 
 				current_shader = SPRITE;
 			}
 			// Figure out how many sprites in a row can be drawn
+			// Pooled spritesheets share a texture, so they can go out in the same batch.
 			auto ss = sprites[sprite_order[si]].spritesheet;
+			auto ss_tex = get_texture(ss);
 			u32 lookahead;
 			for (lookahead = si + 1; lookahead < slen; lookahead++) {
-				// scan until we find a sprite with either a different spritesheet or one that would go over the next chunk
-				if (ci < clen && chunks[chunk_order[ci]].layer <= sprite_attrs[lookahead].layer
-					|| sprites[sprite_order[lookahead]].spritesheet != ss) break;
+				// scan until we find a sprite with either a different texture or one that would go over the next chunk
+				if ((ci < clen && chunks[chunk_order[ci]].layer <= sprite_attrs[lookahead].layer)
+					|| get_texture(sprites[sprite_order[lookahead]].spritesheet) != ss_tex) break;
 			}
 
-			sprite_shader.set(sprite_slots.spritesheet, bind(const_cast<Spritesheet*>(ss), 0));
+			sprite_shader.set(sprite_slots.spritesheet, bind(ss_tex, 0));
 
 			// sprite_vbo should already be bound at this point.
 #ifndef NDEBUG
@@ -275,6 +431,9 @@ void Renderer::draw_frame(float fps, bool show_fps, bool show_console, bool show
 
 			glBindVertexArray(vao);
 			glDrawArraysInstanced(GL_TRIANGLE_FAN, 0, 4, lookahead - si);
+			count_stat(STAT_BUFFER_UPLOAD_BYTES, sizeof(SpriteAttributes) * (lookahead - si));
+			count_stat(STAT_DRAW_CALLS);
+			count_stat(STAT_INSTANCES, lookahead - si);
 
 			si = lookahead;
 		}
@@ -282,76 +441,71 @@ void Renderer::draw_frame(float fps, bool show_fps, bool show_console, bool show
 
 
 	// Print ALL the text!
-	GlyphRenderData glyph_buffer[GLYPH_MAX];
-
-	if ( // If there is text to print, get the text shader warmed up.
-		show_fps
-		|| print_later_ws > print_later_ws_start
-		|| print_later_ss > print_later_ss_start
-	) {
-		text_shader.use();
-		//text_shader.set(text_slots.layer, 500.f);
-
-		glBindBuffer(GL_ARRAY_BUFFER, rect_vbo);
-		glVertexAttribPointer(0, 2, GL_FLOAT, GL_FALSE, sizeof(float) * 2, 0);
-		glEnableVertexAttribArray(0);
-
-		glBindBuffer(GL_ARRAY_BUFFER, text_vbo);
+	// Every run is laid out into one glyph stream up front, and consecutive runs with the same font and camera
+	// share a batch, so the whole frame's text costs a single upload and one instanced draw per batch.
+	int n_batches = 0;
+	int n_glyphs = 0;
+	begin_text_frame();
 
-		glVertexAttribIPointer(1, 1, GL_INT, sizeof(GlyphRenderData), (void*)offsetof(GlyphRenderData, glyph_id));
-		glEnableVertexAttribArray(1);
-		glVertexAttribDivisor(1, 1);
-		glVertexAttribPointer(2, 2, GL_FLOAT, GL_FALSE, sizeof(GlyphRenderData), (void*)offsetof(GlyphRenderData, x));
-		glEnableVertexAttribArray(2);
-		glVertexAttribDivisor(2, 1);
-		glVertexAttribIPointer(3, 1, GL_INT, sizeof(GlyphRenderData), (void*)offsetof(GlyphRenderData, rgba));
-		glEnableVertexAttribArray(3);
-		glVertexAttribDivisor(3, 1);
+	if (show_fps) {
+		u32 fps_color = fps > 55.f ? 0x00FF00 : fps > 25.f ? 0xFFFF00 : 0xFF0000;
+		char* fps_msg = _frame_alloc<char>(32);
+		snprintf(fps_msg, 32, "#c[%06x]%d FPS", fps_color, (int)fps);
+		_queue_text(&simple_font, SCREEN_SPACE, 1, 1, fps_msg, 1.f);
 	}
+	if (get_shown_stats()) {
+		_print_stats(fps, show_fps ? 1 + get_font_dimensions(simple_font).line_height : 1);
+	}
+	int n_runs = print_later[WORLD_SPACE].count + print_later[SCREEN_SPACE].count;
+	count_stat(STAT_TEXT_RUNS, n_runs);
+	double layout_start = get_time();
+
+	// Every glyph comes from at least one byte of text, so this is always enough room
+	size_t text_bytes = 0;
+	for (const auto& queue : print_later) {
+		for (int i = 0; i < queue.count; i++) text_bytes += strlen(queue.items[i].text);
+	}
+	text_glyphs_max = (int) text_bytes + (show_console ? CONSOLE_GLYPH_MAX : 0);
+	text_glyphs = _frame_alloc<GlyphRenderData>(max(text_glyphs_max, 1));
+	TextBatch* text_batches = _frame_alloc<TextBatch>(n_runs + 1); // at worst one per run, plus the console's
 
-	if (print_later_ws > print_later_ws_start) {
-		text_shader.setCamera(world_camera);
-		for (auto it = print_later_ws_start; it < print_later_ws; it++) {
-			int n_glyphs = print_glyphs(it->font, glyph_buffer, GLYPH_MAX, it->text, it->x, it->y);
-			text_shader.set(text_slots.glyph_atlas, bind_font_glyph_atlas(*it->font, 0));
-			text_shader.set(text_slots.glyph_bounds, bind_font_glyph_table(*it->font, 1));
-
-			glBufferSubData(GL_ARRAY_BUFFER, 0, sizeof(GlyphRenderData) * n_glyphs, glyph_buffer);
-			glDrawArraysInstanced(GL_TRIANGLE_FAN, 0, 4, n_glyphs);
-		}
+	if (parallel_text_layout) {
+		n_batches += _batch_text_parallel(text_batches + n_batches, &n_glyphs);
+	}
+	else {
+		n_batches += _batch_text(text_batches + n_batches, &n_glyphs, WORLD_SPACE, print_later[WORLD_SPACE]);
+		n_batches += _batch_text(text_batches + n_batches, &n_glyphs, SCREEN_SPACE, print_later[SCREEN_SPACE]);
 	}
+	int n_text_batches = n_batches;
 
-	if (print_later_ss > print_later_ss_start) {
-		text_shader.setCamera(ui_camera);
-		for (auto it = print_later_ss_start; it < print_later_ss; it++) {
-			int n_glyphs = print_glyphs(it->font, glyph_buffer, GLYPH_MAX, it->text, it->x, it->y);
-			text_shader.set(text_slots.glyph_atlas, bind_font_glyph_atlas(*it->font, 0));
-			text_shader.set(text_slots.glyph_bounds, bind_font_glyph_table(*it->font, 1));
+	if (show_console) {
+		TextBatch& batch = text_batches[n_batches++];
+		batch = { &simple_font, SCREEN_SPACE, n_glyphs, 0, 1.f };
 
-			glBufferSubData(GL_ARRAY_BUFFER, 0, sizeof(GlyphRenderData) * n_glyphs, glyph_buffer);
-			glDrawArraysInstanced(GL_TRIANGLE_FAN, 0, 4, n_glyphs);
-		}
-	}
+		n_glyphs += print_glyphs_cached(text_cache, &simple_font, text_glyphs + n_glyphs, text_glyphs_max - n_glyphs, get_console_line(show_cursor), CONSOLE_LINE_OFFSET_LEFT, v_height - CONSOLE_LINE_OFFSET_BOTTOM);
 
-	// Print FPS
-	if (show_fps) {
-		char fps_msg[32];
-		u32 fps_color = fps > 55.f ? 0x00FF00 : fps > 25.f ? 0xFFFF00 : 0xFF0000;
-		snprintf(fps_msg, sizeof(fps_msg), "#c[%06x]%d FPS", fps_color, (int)fps);
-		int n_glyphs = print_glyphs(&simple_font, glyph_buffer, 16, fps_msg, 1, 1);
-		assert(n_glyphs >= 0);
+		auto line_height = get_font_dimensions(simple_font).line_height;
+		int scrollback_base = v_height - CONSOLE_LINE_OFFSET_BOTTOM - CONSOLE_LINE_SCROLLBACK_SPACING;
+		int scrollback_max = (scrollback_base - SCROLLBACK_PADDING_TOP) / line_height;
+		n_glyphs += print_console_scrollback(&simple_font, text_glyphs + n_glyphs, text_glyphs_max - n_glyphs, CONSOLE_LINE_OFFSET_LEFT, scrollback_base, line_height, scrollback_max);
+		batch.count = n_glyphs - batch.first;
+	}
+	count_stat(STAT_TEXT_LAYOUT_MICROS, (u64)((get_time() - layout_start) * 1e6));
+	count_stat(STAT_TEXT_BATCHES, n_batches);
+	count_stat(STAT_GLYPHS, n_glyphs);
 
-		if (!(print_later_ss > print_later_ss_start)) {
-			text_shader.setCamera(ui_camera);
+	if (n_glyphs > 0) {
+		glBindBuffer(GL_ARRAY_BUFFER, text_vbo);
+		if (n_glyphs > text_vbo_glyphs) {
+			while (text_vbo_glyphs < n_glyphs) text_vbo_glyphs *= 2;
+			glBufferData(GL_ARRAY_BUFFER, sizeof(GlyphRenderData) * text_vbo_glyphs, nullptr, GL_STREAM_DRAW);
 		}
-		text_shader.set(text_slots.glyph_atlas, bind_font_glyph_atlas(simple_font, 0));
-		text_shader.set(text_slots.glyph_bounds, bind_font_glyph_table(simple_font, 1));
-		//text_shader.set(text_slots.layer, 500.f);
-
-		glBufferSubData(GL_ARRAY_BUFFER, 0, sizeof(GlyphRenderData) * n_glyphs, glyph_buffer);
-		glDrawArraysInstanced(GL_TRIANGLE_FAN, 0, 4, n_glyphs);
+		glBufferSubData(GL_ARRAY_BUFFER, 0, sizeof(GlyphRenderData) * n_glyphs, text_glyphs);
+		count_stat(STAT_BUFFER_UPLOAD_BYTES, sizeof(GlyphRenderData) * n_glyphs);
 	}
 
+	_draw_text_batches(text_batches, n_text_batches);
+
 	if (show_console) {
 		overlay_shader.use();
 
@@ -360,48 +514,35 @@ void Renderer::draw_frame(float fps, bool show_fps, bool show_console, bool show
 		glEnableVertexAttribArray(0);
 
 		glDrawArrays(GL_TRIANGLE_FAN, 0, 4);
+		count_stat(STAT_DRAW_CALLS);
+		count_stat(STAT_INSTANCES);
 
-		text_shader.use();
-		//text_shader.set(text_slots.layer, 500.f);
-		text_shader.setCamera(ui_camera);
-		text_shader.set(text_slots.glyph_atlas, bind_font_glyph_atlas(simple_font, 0));
-		text_shader.set(text_slots.glyph_bounds, bind_font_glyph_table(simple_font, 1));
-
-		glBindBuffer(GL_ARRAY_BUFFER, rect_vbo);
-		glVertexAttribPointer(0, 2, GL_FLOAT, GL_FALSE, sizeof(float) * 2, 0);
-		glEnableVertexAttribArray(0);
-
-		glBindBuffer(GL_ARRAY_BUFFER, text_vbo);
-		glVertexAttribIPointer(1, 1, GL_INT, sizeof(GlyphRenderData), (void*)offsetof(GlyphRenderData, glyph_id));
-		glEnableVertexAttribArray(1);
-		glVertexAttribDivisor(1, 1);
-		glVertexAttribPointer(2, 2, GL_FLOAT, GL_FALSE, sizeof(GlyphRenderData), (void*)offsetof(GlyphRenderData, x));
-		glEnableVertexAttribArray(2);
-		glVertexAttribDivisor(2, 1);
-		glVertexAttribIPointer(3, 1, GL_INT, sizeof(GlyphRenderData), (void*)offsetof(GlyphRenderData, rgba));
-		glEnableVertexAttribArray(3);
-		glVertexAttribDivisor(3, 1);
+		_draw_text_batches(text_batches + n_text_batches, n_batches - n_text_batches);
+	}
 
-		int n_glyphs = print_glyphs(&simple_font, glyph_buffer, GLYPH_MAX, get_console_line(show_cursor), CONSOLE_LINE_OFFSET_LEFT, v_height - CONSOLE_LINE_OFFSET_BOTTOM);
+	if (window) {
+		_scale_to_screen();
+	}
 
-		glBufferSubData(GL_ARRAY_BUFFER, 0, sizeof(GlyphRenderData) * n_glyphs, glyph_buffer);
-		glDrawArraysInstanced(GL_TRIANGLE_FAN, 0, 4, n_glyphs);
+	double render_time = get_time() - start_time;
+	count_stat(STAT_RENDER_MICROS, (u64)(render_time * 1e6));
+#ifndef NDEBUG
+	if (render_time > 0.01)
+	{
+		printf("ALERT: Render took %.2fms this frame\n", render_time * 1000.f);
+	}
+#endif
 
-		auto line_height = get_font_dimensions(simple_font).line_height;
-		int scrollback_base = v_height - CONSOLE_LINE_OFFSET_BOTTOM - CONSOLE_LINE_SCROLLBACK_SPACING;
-		int scrollback_max = (scrollback_base - SCROLLBACK_PADDING_TOP) / line_height;
-		for (int i = 1; i < scrollback_max; i++) {
-			const auto* sb_line = get_console_scrollback_line(i);
-			if (sb_line == nullptr) break;
-			n_glyphs = print_glyphs(&simple_font, glyph_buffer, GLYPH_MAX, sb_line, CONSOLE_LINE_OFFSET_LEFT, scrollback_base - (i * line_height));
+	_flip_frame_arena();
 
-			glBufferSubData(GL_ARRAY_BUFFER, 0, sizeof(GlyphRenderData) * n_glyphs, glyph_buffer);
-			glDrawArraysInstanced(GL_TRIANGLE_FAN, 0, 4, n_glyphs);
-		}
+	if (window) {
+		glfwSwapBuffers(window);
 	}
+	end_stats_frame();
+}
 
-	// virtual resolution scaling
-
+// Letterboxes the virtual screen onto the window
+void Renderer::_scale_to_screen() {
 	glBindFramebuffer(GL_FRAMEBUFFER, 0);
 	glViewport(0, 0, screen_width, screen_height);
 	glClearColor(0.f, 0.f, 0.f, 1.f);
@@ -426,47 +567,80 @@ void Renderer::draw_frame(float fps, bool show_fps, bool show_console, bool show
 
 	glBindVertexArray(vao);
 	glDrawArrays(GL_TRIANGLE_FAN, 0, 4);
+	count_stat(STAT_DRAW_CALLS);
+	count_stat(STAT_INSTANCES);
+}
 
-#ifndef NDEBUG
-	float render_time = glfwGetTime() - start_time;
-	if (render_time > 0.01)
-	{
-		printf("ALERT: Render took %.2fms this frame\n", render_time * 1000.f);
-	}
-#endif
+bool Renderer::read_frame(u8* rgb, int width, int height) {
+	if (width != v_width || height != v_height) return false;
+	// Everything is drawn upside down in the framebuffer (the scale pass flips it back),
+	// so OpenGL's bottom-up rows come out top row first
+	glBindFramebuffer(GL_READ_FRAMEBUFFER, fbo);
+	glPixelStorei(GL_PACK_ALIGNMENT, 1);
+	glReadPixels(0, 0, v_width, v_height, GL_RGB, GL_UNSIGNED_BYTE, rgb);
+	glBindFramebuffer(GL_READ_FRAMEBUFFER, 0);
+	return true;
+}
 
-	string_storage_next = temp_string_storage;
-	print_later_ws = print_later_ws_start;
-	print_later_ss = print_later_ss_start;
+void Renderer::_flip_frame_arena() {
+	frame_arena = frame_arena == frame_arenas[0] ? frame_arenas[1] : frame_arenas[0];
+	arena_clear(frame_arena);
+	print_later[WORLD_SPACE] = {};
+	print_later[SCREEN_SPACE] = {};
+	text_glyphs = nullptr;
+	text_glyphs_max = 0;
+}
+
+bool Renderer::_queue_text(Font* font, CoordinateSystem coords, float x, float y, const char* text, float scale) {
+	PrintQueue& queue = print_later[coords];
+	if (queue.count == queue.capacity) {
+		// The old items stay behind in the arena until it's cleared
+		int capacity = max(queue.capacity * 2, PRINT_QUEUE_MIN);
+		auto items = _frame_alloc<GlyphPrintData>(capacity);
+		if (!items) return false;
+		if (queue.count) memcpy(items, queue.items, sizeof(GlyphPrintData) * queue.count);
+		queue.items = items;
+		queue.capacity = capacity;
+	}
+	queue.items[queue.count++] = { font, text, x, y, scale };
+	return true;
+}
 
-	glfwSwapBuffers(window);
+void Renderer::set_text_scale(float scale) {
+	text_scale = scale;
 }
 
 bool Renderer::_print_text(Font* font, CoordinateSystem coords, float x, float y, const char* const format, va_list args) {
-	if (coords == WORLD_SPACE && print_later_ws - print_later_ws_start >= PRINT_CMD_WS_MAX) {
-		fprintf(stderr, "Out of world space text slots.\n");
-		return false;
+	va_list retry;
+	va_copy(retry, args);
+	size_t available;
+	char* text = arena_reserve(frame_arena, PRINT_RESERVE, &available);
+	int len = text ? vsnprintf(text, available, format, args) : -1;
+	if (len >= 0 && (size_t) len >= available) {
+		text = arena_reserve(frame_arena, len + 1, &available);
+		if (text) vsnprintf(text, available, format, retry);
 	}
-	else if (coords == SCREEN_SPACE && print_later_ss - print_later_ss_start >= PRINT_CMD_SS_MAX) {
-		fprintf(stderr, "Out of screen space text slots.\n");
+	va_end(retry);
+	if (len < 0 || !text) {
+		ERR_LOG("Unable to print \"%s\"", format);
 		return false;
 	}
-	int text_memory_remaining = STRING_STORAGE_SIZE - (string_storage_next - temp_string_storage);
-	// Check how much space is required
-	auto text = string_storage_next;
-	int len = vsnprintf(string_storage_next, text_memory_remaining, format, args);
-	if (len < 0 || len + 1 > text_memory_remaining) {
-		fprintf(stderr, "Not enough string storage memory.\n");
-		return false;
-	}
-	string_storage_next += len + 2; // +1 to get to the '\0', +1 to get to the character after.
-	if (coords == WORLD_SPACE) {
-		*print_later_ws++ = { font, text, x, y };
-	}
-	else if (coords == SCREEN_SPACE) {
-		*print_later_ss++ = { font, text, x, y };
-	}
-	return true;
+	arena_alloc(frame_arena, len + 1, 1); // claims what was just written
+	return _queue_text(font, coords, x, y, text, text_scale);
+}
+
+FormatBuffer Renderer::_begin_format(size_t min_bytes) {
+	size_t available;
+	char* start = arena_reserve(frame_arena, min_bytes, &available);
+	if (!start || available < 1) return { nullptr, nullptr, true }; // needs at least the terminator
+	return { start, start + available - 1, false };
+}
+
+bool Renderer::_end_format(FormatBuffer& out, Font* font, CoordinateSystem coords, float x, float y) {
+	size_t available;
+	char* text = arena_reserve(frame_arena, 1, &available);
+	arena_alloc(frame_arena, out.next + 1 - text, 1); // claims what was just written
+	return _queue_text(font, coords, x, y, text, text_scale);
 }
 
 #define _HANDOFF(FONT, COORDS) do{\
@@ -495,6 +669,168 @@ bool Renderer::print_text(float x, float y, const char* format, ...) {
 
 #undef _HANDOFF
 
+bool Renderer::print_string(Font* font, CoordinateSystem coords, float x, float y, const char* text) {
+	return _queue_text(font, coords, x, y, text, text_scale);
+}
+
+bool Renderer::print_string(CoordinateSystem coords, float x, float y, const char* text) {
+	return print_string(&simple_font, coords, x, y, text);
+}
+
+bool Renderer::print_string(Font* font, float x, float y, const char* text) {
+	return print_string(font, SCREEN_SPACE, x, y, text);
+}
+
+bool Renderer::print_string(float x, float y, const char* text) {
+	return print_string(&simple_font, SCREEN_SPACE, x, y, text);
+}
+
+int Renderer::_batch_text(TextBatch* batches, int* n_glyphs, CoordinateSystem coords, const PrintQueue& queue) {
+	const GlyphPrintData* start = queue.items;
+	const GlyphPrintData* end = queue.items + queue.count;
+	int n_batches = 0;
+	// Only neighbouring runs are merged, so overlapping text still draws in the order it was printed
+	for (auto it = start; it < end && *n_glyphs < text_glyphs_max; it++) {
+		if (n_batches == 0 || batches[n_batches - 1].font != it->font || batches[n_batches - 1].scale != it->scale) {
+			batches[n_batches++] = { it->font, coords, *n_glyphs, 0, it->scale };
+		}
+		TextBatch& batch = batches[n_batches - 1];
+		*n_glyphs += print_glyphs_cached(text_cache, it->font, text_glyphs + *n_glyphs, text_glyphs_max - *n_glyphs, it->text, it->x, it->y, it->scale);
+		batch.count = *n_glyphs - batch.first;
+	}
+	return n_batches;
+}
+
+// Makes the same batches as _batch_text does for both cameras, but the layout itself is fanned out across the worker pool.
+int Renderer::_batch_text_parallel(TextBatch* batches, int* n_glyphs) {
+	const struct {
+		CoordinateSystem coords;
+		const GlyphPrintData* start;
+		const GlyphPrintData* end;
+	} cameras[] = {
+		{ WORLD_SPACE, print_later[WORLD_SPACE].items, print_later[WORLD_SPACE].items + print_later[WORLD_SPACE].count },
+		{ SCREEN_SPACE, print_later[SCREEN_SPACE].items, print_later[SCREEN_SPACE].items + print_later[SCREEN_SPACE].count },
+	};
+	int total_runs = print_later[WORLD_SPACE].count + print_later[SCREEN_SPACE].count;
+	auto text_runs = _frame_alloc<TextRun>(max(total_runs, 1)); // the frame's print commands in drawing order
+	auto text_run_counts = _frame_alloc<int>(max(total_runs, 1));
+	int n_batches = 0;
+	int n_runs = 0;
+	for (const auto& camera : cameras) {
+		int first_batch = n_batches;
+		for (auto it = camera.start; it < camera.end; it++) {
+			if (n_batches == first_batch || batches[n_batches - 1].font != it->font || batches[n_batches - 1].scale != it->scale) {
+				batches[n_batches++] = { it->font, camera.coords, n_runs, 0, it->scale }; // counted in runs until the layout is done
+			}
+			text_runs[n_runs++] = { it->font, it->text, it->x, it->y, it->scale };
+			batches[n_batches - 1].count = n_runs - batches[n_batches - 1].first;
+		}
+	}
+
+	print_glyphs_parallel(parallel_text, text_cache, text_runs, n_runs, text_glyphs + *n_glyphs, text_glyphs_max - *n_glyphs, text_run_counts);
+
+	for (int b = 0; b < n_batches; b++) {
+		auto& batch = batches[b];
+		int first_run = batch.first;
+		int end_run = batch.first + batch.count;
+		batch.first = *n_glyphs;
+		for (int r = first_run; r < end_run; r++) *n_glyphs += text_run_counts[r];
+		batch.count = *n_glyphs - batch.first;
+	}
+	return n_batches;
+}
+
+void Renderer::_draw_text_batches(const TextBatch* batches, int n_batches) {
+	if (n_batches <= 0) return;
+
+	//text_shader.set(text_slots.layer, 500.f);
+
+	glBindBuffer(GL_ARRAY_BUFFER, rect_vbo);
+	glVertexAttribPointer(0, 2, GL_FLOAT, GL_FALSE, sizeof(float) * 2, 0);
+	glEnableVertexAttribArray(0);
+
+	glBindBuffer(GL_ARRAY_BUFFER, text_vbo);
+	glEnableVertexAttribArray(1);
+	glVertexAttribDivisor(1, 1);
+	glEnableVertexAttribArray(2);
+	glVertexAttribDivisor(2, 1);
+	glEnableVertexAttribArray(3);
+	glVertexAttribDivisor(3, 1);
+
+	const Shader* shader = nullptr;
+	const glm::mat4* camera = nullptr;
+	for (int b = 0; b < n_batches; b++) {
+		const auto& batch = batches[b];
+		if (batch.count <= 0) continue;
+
+		auto sdf = get_font_sdf(*batch.font);
+		const Shader* batch_shader = sdf.scale > 0 ? &text_sdf_shader : &text_shader;
+		const auto& slots = sdf.scale > 0 ? text_sdf_slots : text_slots;
+		if (batch_shader != shader) {
+			batch_shader->use();
+			shader = batch_shader;
+			camera = nullptr; // each program keeps its own camera
+		}
+		const glm::mat4* batch_camera = batch.coords == WORLD_SPACE ? &world_camera : &ui_camera;
+		if (batch_camera != camera) {
+			shader->setCamera(*batch_camera);
+			camera = batch_camera;
+		}
+		shader->set(slots.glyph_atlas, bind_font_glyph_atlas(*batch.font, 0));
+		shader->set(slots.glyph_bounds, bind_font_glyph_table(*batch.font, 1));
+		shader->set(slots.scale, batch.scale);
+		if (sdf.scale > 0) {
+			shader->set(slots.texel_size, 1.f / sdf.scale);
+			shader->set(slots.padding, (float) sdf.padding);
+		}
+
+		// GL 3.3 has no base instance, so point the per-glyph attributes at the start of the batch instead.
+		size_t base = sizeof(GlyphRenderData) * batch.first;
+		glVertexAttribIPointer(1, 1, GL_INT, sizeof(GlyphRenderData), (void*)(base + offsetof(GlyphRenderData, glyph_id)));
+		glVertexAttribPointer(2, 2, GL_FLOAT, GL_FALSE, sizeof(GlyphRenderData), (void*)(base + offsetof(GlyphRenderData, x)));
+		glVertexAttribIPointer(3, 1, GL_INT, sizeof(GlyphRenderData), (void*)(base + offsetof(GlyphRenderData, rgba)));
+
+		glDrawArraysInstanced(GL_TRIANGLE_FAN, 0, 4, batch.count);
+		count_stat(STAT_DRAW_CALLS);
+		count_stat(STAT_INSTANCES, batch.count);
+	}
+}
+
+// Counters are from the last finished frame, since this one is still being counted.
+void Renderer::_print_stats(float fps, float y) {
+	u32 shown = get_shown_stats();
+	float line_height = get_font_dimensions(simple_font).line_height;
+	auto frame_stat = get_frame_stat;
+	if (shown & STATS_FPS) {
+		print_fmt(1, y, TEXT_FMT("#c[7f1]{.1} fps  {.2} ms/frame  render {.2} ms"),
+			fps, 1000.f / fps, frame_stat(STAT_RENDER_MICROS) / 1000.f);
+		y += line_height;
+	}
+	if (shown & STATS_RENDER) {
+		print_fmt(1, y, TEXT_FMT("#c[fc4]draws {}  instances {}  texture binds {}  sort {} us"),
+			frame_stat(STAT_DRAW_CALLS), frame_stat(STAT_INSTANCES), frame_stat(STAT_TEXTURE_BINDS), frame_stat(STAT_SORT_MICROS));
+		y += line_height;
+		print_fmt(1, y, TEXT_FMT("#c[fc4]uploaded {.1} KB buffers  {.1} KB textures"),
+			frame_stat(STAT_BUFFER_UPLOAD_BYTES) / 1024.f, frame_stat(STAT_TEXTURE_UPLOAD_BYTES) / 1024.f);
+		y += line_height;
+	}
+	if (shown & STATS_MEMORY) {
+		auto temp = get_temp_storage_stats(); // this thread's arena; the peak covers every thread
+		auto frame = get_arena_stats(frame_arena);
+		print_fmt(1, y, TEXT_FMT("#c[8cf]temp peak {.1} KB of {.1} KB in {} blocks  frame peak {.1} KB of {.1} KB"),
+			frame_stat(STAT_TEMP_STORAGE_PEAK) / 1024.f, temp.capacity / 1024.f, temp.n_blocks,
+			frame_stat(STAT_FRAME_STORAGE_PEAK) / 1024.f, frame.capacity / 1024.f);
+		y += line_height;
+		print_fmt(1, y, TEXT_FMT("#c[8cf]tables {} entries in {.1} KB  (+{} -{})"),
+			frame_stat(STAT_TABLE_ENTRIES), frame_stat(STAT_TABLE_BYTES) / 1024.f, frame_stat(STAT_TABLE_ADDS), frame_stat(STAT_TABLE_REMOVES));
+		y += line_height;
+	}
+	if (shown & STATS_TEXT) {
+		print_fmt(1, y, TEXT_FMT("#c[f8c]runs {}  batches {}  glyphs {}  layout {} us"),
+			frame_stat(STAT_TEXT_RUNS), frame_stat(STAT_TEXT_BATCHES), frame_stat(STAT_GLYPHS), frame_stat(STAT_TEXT_LAYOUT_MICROS));
+	}
+}
+
 u32 Renderer::_sort_chunks(u32* buffer) {
 	auto len = chunks.fill_index(buffer, CHUNK_MAX);
 	std::sort(buffer, buffer + len, [&](int left, int right) {
@@ -512,8 +848,8 @@ u32 Renderer::_sort_sprites(u32* buffer) {
 		auto l = sprites[left].attrs.layer;
 		auto r = sprites[right].attrs.layer;
 		if (l == r) {
-			auto lt = (intptr_t) sprites[left].spritesheet;
-			auto rt = (intptr_t) sprites[right].spritesheet;
+			auto lt = (intptr_t) get_texture(sprites[left].spritesheet);
+			auto rt = (intptr_t) get_texture(sprites[right].spritesheet);
 			if (lt == rt) return left < right; // whee, cheap sort stability!
 			else return lt < rt;
 		}
@@ -551,7 +887,8 @@ SpriteID  Renderer::add_sprite(
 			src_x, src_y, src_w, src_h,
 			x, y,
 			layer,
-			cset | flip | (show_color0 ? SHOW_COLOR0 : 0) | red | green | blue | alpha
+			cset | flip | (show_color0 ? SHOW_COLOR0 : 0) | red | green | blue | alpha,
+			sheet_index(spritesheet)
 		}
 	});
 }
@@ -560,6 +897,30 @@ bool Renderer::remove_sprite(const SpriteID id) {
 	return sprites.remove(id);
 }
 
+void Renderer::set_palette_transform(const PaletteTransform& fx) {
+	palette_fx = fx;
+}
+
+void Renderer::set_cset_transform(int cset, const PaletteTransform& fx) {
+	assert(cset >= 0 && cset < CSET_MAX);
+	auto texels = &cset_fx[cset * CSET_FX_TEXELS];
+	texels[0] = glm::vec4(fx.mul.x, fx.mul.y, fx.mul.z, 0.f);
+	texels[1] = glm::vec4(fx.add.x, fx.add.y, fx.add.z, 0.f);
+	texels[2] = fx.lerp;
+	cset_fx_dirty_lo = min(cset_fx_dirty_lo, cset);
+	cset_fx_dirty_hi = max(cset_fx_dirty_hi, cset + 1);
+	use_cset_fx = true;
+}
+
+void Renderer::clear_cset_transforms() {
+	if (!use_cset_fx) return;
+	PaletteTransform identity;
+	for (int i = 0; i < CSET_MAX; i++) {
+		set_cset_transform(i, identity);
+	}
+	use_cset_fx = false;
+}
+
 
 TileChunk::TileChunk(Tileset* const tileset, Tile* const tilemap, u32 width, u32 height):
 	tileset(tileset),
@@ -581,6 +942,7 @@ TileChunk::~TileChunk() {
 void TileChunk::sync() {
 	glBindBuffer(GL_ARRAY_BUFFER, vbo);
 	glBufferSubData(GL_ARRAY_BUFFER, 0, sizeof(tilemap) * width * height, tilemap);
+	count_stat(STAT_BUFFER_UPLOAD_BYTES, sizeof(tilemap) * width * height);
 }
 
 u32 rotateCCW(u32 tile) {
@@ -1,11 +1,16 @@
 #pragma once
 
+#include <cstdarg>
+
 #include "shader.h"
 #include "table.h"
 #include "text.h"
+#include "format.h"
 
 class Renderer;
 struct GlyphPrintData;
+struct TextBatch;
+struct WorkerPool;
 
 enum CoordinateSystem {
 	WORLD_SPACE,
@@ -50,6 +55,7 @@ struct SpriteAttributes {
 	float x, y;
 	i32 layer;
 	u32 flags;
+	i32 sheet; // layer within the spritesheet's texture array
 };
 
 struct Sprite {
@@ -57,6 +63,20 @@ struct Sprite {
 	SpriteAttributes attrs;
 };
 
+/// Color transform applied on the GPU after the palette lookup: color * mul + add, then blended toward lerp.rgb by lerp.a
+struct PaletteTransform {
+	glm::vec3 mul = { 1.f, 1.f, 1.f };
+	glm::vec3 add = { 0.f, 0.f, 0.f };
+	glm::vec4 lerp = { 0.f, 0.f, 0.f, 0.f };
+};
+
+/// Print commands for one camera, growing in the frame arena
+struct PrintQueue {
+	GlyphPrintData* items;
+	int count;
+	int capacity;
+};
+
 typedef Table<ChunkEntry>::Handle ChunkID;
 typedef Table<Sprite>::Handle SpriteID;
 
@@ -66,7 +86,7 @@ private:
 	int v_width, v_height; // virtual resolution
 
 	GLuint vao, fbo, rect_vbo, sprite_vbo, text_vbo;
-	Shader tile_shader, scale_shader, sprite_shader, text_shader, overlay_shader;
+	Shader tile_shader, scale_shader, sprite_shader, text_shader, text_sdf_shader, overlay_shader;
 
 #define __SLOT(VAR) int VAR;
 	struct {
@@ -80,10 +100,19 @@ private:
 	} sprite_slots;
 	struct {
 #include "generated/text_uniforms.h"
-	} text_slots;
+	} text_slots, text_sdf_slots; // the distance field variant shares text.vert, and with it every uniform
+	struct {
+#include "generated/overlay_uniforms.h"
+	} overlay_slots;
 #undef __SLOT
 
 	Palette* palette;
+	PaletteTransform palette_fx;
+	glm::vec4* cset_fx; // 3 texels per cset, laid out the way the shaders read them
+	Texture* cset_fx_texture;
+	GLuint cset_fx_buffer;
+	int cset_fx_dirty_lo, cset_fx_dirty_hi;
+	bool use_cset_fx;
 
 	Texture* framebuffer;
 
@@ -91,24 +120,62 @@ private:
 	Table<Sprite> sprites;
 
 	SpriteAttributes* sprite_attrs;
-	//GlyphRenderData* text_render_buffer;
-	GlyphPrintData* print_later_ws_start;
-	GlyphPrintData* print_later_ws;
-	GlyphPrintData* print_later_ss_start;
-	GlyphPrintData* print_later_ss;
+	TextLayoutCache* text_cache;
+	WorkerPool* workers;
+	ParallelTextLayout* parallel_text;
+	int text_vbo_glyphs; // how many glyphs text_vbo has room for
+
+	// All per-frame scratch (print commands, their strings, sort and glyph buffers) comes from the frame arena.
+	// There are two, swapped at the end of draw_frame, so whatever a frame used stays intact through the next one.
+	Arena* frame_arenas[2];
+	Arena* frame_arena;
+	PrintQueue print_later[2]; // indexed by CoordinateSystem
+	GlyphRenderData* text_glyphs; // every glyph drawn this frame, grouped by batch
+	int text_glyphs_max;
 
 	glm::mat4 world_camera, ui_camera;
-
-	char* temp_string_storage;
-	char* string_storage_next;
+	float text_scale;
+
+	static constexpr size_t PRINT_RESERVE = 256; // room asked of the frame arena before formatting into it
+
+	void _load_uniform_slots();
+#ifdef NO_EMBED_SHADERS
+	struct ShaderSource {
+		Renderer* renderer;
+		Shader* shader;
+		const char* vert;
+		const char* frag;
+	} shader_sources[6];
+	static void _reload_shader(const char* path, void* user, void* prepared);
+#endif
+
+	template <typename T>
+	T* _frame_alloc(size_t n) {
+		return (T*) arena_alloc(frame_arena, sizeof(T) * n, alignof(T));
+	}
+	void _flip_frame_arena();
+	void _scale_to_screen();
 
 	u32 _sort_chunks(u32 * buffer);
 	u32 _sort_sprites(u32 * buffer);
 
+	bool _queue_text(Font* font, CoordinateSystem coords, float x, float y, const char* text, float scale);
 	bool _print_text(Font* font, CoordinateSystem coords, float x, float y, const char* format, va_list args);
+	FormatBuffer _begin_format(size_t min_bytes);
+	bool _end_format(FormatBuffer& out, Font* font, CoordinateSystem coords, float x, float y);
+	int _batch_text(TextBatch* batches, int* n_glyphs, CoordinateSystem coords, const PrintQueue& queue);
+	int _batch_text_parallel(TextBatch* batches, int* n_glyphs);
+	void _draw_text_batches(const TextBatch* batches, int n_batches);
+	void _print_stats(float fps, float y);
 public:
+	/// window is null when rendering headless (see headless.h). Frames then stay in the offscreen framebuffer.
 	Renderer(GLFWwindow* window, int width, int height);
+	/// Joins the text layout workers and releases everything the renderer created. The GL context must still be current.
+	~Renderer();
 	void draw_frame(float fps, bool show_fps, bool show_console, bool show_cursor);
+	/// Copies the last frame drawn, at the virtual resolution, into rgb: width * height * 3 bytes, top row first.
+	/// Fails if the size isn't the virtual resolution.
+	bool read_frame(u8* rgb, int width, int height);
 
 	ChunkID add_chunk(const TileChunk* const chunk, float x, float y, i32 layer);
 	bool remove_chunk(const ChunkID id);
@@ -125,10 +192,49 @@ public:
 	);
 	bool remove_sprite(const SpriteID id);
 
+	void set_palette_transform(const PaletteTransform& fx);
+	void set_cset_transform(int cset, const PaletteTransform& fx);
+	void clear_cset_transforms();
+
+	/// Scale for everything printed after this. Distance field fonts stay sharp; bitmap fonts just get blocky.
+	void set_text_scale(float scale = 1.f);
 	bool print_text(Font* font, CoordinateSystem coords, float x, float y, const char* format, ...);
 	bool print_text(CoordinateSystem coords, float x, float y, const char* format, ...);
 	bool print_text(Font* font, float x, float y, const char* format, ...);
 	bool print_text(float x, float y, const char* format, ...);
+
+	/// Print text as-is, without copying or formatting it. It has to stay alive until the frame is drawn.
+	bool print_string(Font* font, CoordinateSystem coords, float x, float y, const char* text);
+	bool print_string(CoordinateSystem coords, float x, float y, const char* text);
+	bool print_string(Font* font, float x, float y, const char* text);
+	bool print_string(float x, float y, const char* text);
+
+	/// Like print_text, but formats straight into the frame's text storage. See format.h.
+	/// e.g. renderer.print_fmt(4, 4, TEXT_FMT("HP {}/{} ({.1}%)"), hp, max_hp, hp * 100.f / max_hp);
+	template <int N_ARGS, typename... Args>
+	bool print_fmt(Font* font, CoordinateSystem coords, float x, float y, TextFormat<N_ARGS> format, const Args&... args) {
+		static_assert(N_ARGS >= 0, "Malformed format string");
+		static_assert(N_ARGS == sizeof...(Args), "Wrong number of arguments for the format string");
+		// Formats straight into the frame arena, and again into twice the room if that wasn't enough
+		for (size_t reserve = PRINT_RESERVE; ; reserve *= 2) {
+			FormatBuffer out = _begin_format(reserve);
+			if (!out.next) return false;
+			format_text(out, format.str, args...);
+			if (!out.overflow) return _end_format(out, font, coords, x, y);
+		}
+	}
+	template <int N_ARGS, typename... Args>
+	bool print_fmt(CoordinateSystem coords, float x, float y, TextFormat<N_ARGS> format, const Args&... args) {
+		return print_fmt(&simple_font, coords, x, y, format, args...);
+	}
+	template <int N_ARGS, typename... Args>
+	bool print_fmt(Font* font, float x, float y, TextFormat<N_ARGS> format, const Args&... args) {
+		return print_fmt(font, SCREEN_SPACE, x, y, format, args...);
+	}
+	template <int N_ARGS, typename... Args>
+	bool print_fmt(float x, float y, TextFormat<N_ARGS> format, const Args&... args) {
+		return print_fmt(&simple_font, SCREEN_SPACE, x, y, format, args...);
+	}
 };
 
 // tile modifiers
@@ -23,21 +23,21 @@ GLuint compileShader(const char* vertexShaderSource, const char* fragmentShaderS
 		glGetShaderInfoLog(vertexShader, INFO_LOG_SIZE, NULL, infoLog);
 		printf("Vertex Shader Compilation Failed!\n%s\n", infoLog);
 		glDeleteShader(vertexShader);
-		return -1;
+		return INVALID_PROGRAM;
 	}
 
 	GLuint fragmentShader = glCreateShader(GL_FRAGMENT_SHADER);
 	glShaderSource(fragmentShader, 1, &fragmentShaderSource, NULL);
 	glCompileShader(fragmentShader);
 
-	glGetShaderiv(vertexShader, GL_COMPILE_STATUS, &success);
+	glGetShaderiv(fragmentShader, GL_COMPILE_STATUS, &success);
 	if (!success)
 	{
-		glGetShaderInfoLog(vertexShader, INFO_LOG_SIZE, NULL, infoLog);
+		glGetShaderInfoLog(fragmentShader, INFO_LOG_SIZE, NULL, infoLog);
 		printf("Fragment Shader Compilation Failed!\n%s\n", infoLog);
 		glDeleteShader(vertexShader);
 		glDeleteShader(fragmentShader);
-		return -1;
+		return INVALID_PROGRAM;
 	}
 
 	unsigned int shaderProgram;
@@ -53,7 +53,7 @@ GLuint compileShader(const char* vertexShaderSource, const char* fragmentShaderS
 		printf("Shader Linking Failed!\n%s\n", infoLog);
 		glDeleteShader(vertexShader);
 		glDeleteShader(fragmentShader);
-		return -1;
+		return INVALID_PROGRAM;
 	}
 
 	glDeleteShader(vertexShader);
@@ -66,19 +66,20 @@ GLuint compileShaderFromFiles(const char* vertexShaderFile, const char* fragment
 	const char* vShader = readFile(vertexShaderFile);
 	if (!vShader) {
 		printf("Could not read vertex shader '%s'\n", vertexShaderFile);
-		return -1;
+		return INVALID_PROGRAM;
 	}
 
 	const char* fShader = readFile(fragmentShaderFile);
-	if (!vShader) {
+	if (!fShader) {
 		printf("Could not read fragment shader '%s'\n", fragmentShaderFile);
-		delete[] vShader;
-		return -1;
+		free((void*) vShader);
+		return INVALID_PROGRAM;
 	}
 
 	GLuint shaderProgram = compileShader(vShader, fShader);
 
-	delete[] vShader, fShader;
+	free((void*) vShader);
+	free((void*) fShader);
 
 	return shaderProgram;
 }
@@ -206,6 +207,8 @@ Shader::~Shader() {
 Shader& Shader::operator = (Shader&& otherShader) {
 	if (shaderProgram != -1) {
 		glDeleteProgram(shaderProgram);
+		// The name may be handed out again, so don't let use() think it is still current
+		if (activeProgram == shaderProgram) activeProgram = -1;
 	}
 	shaderProgram = otherShader.shaderProgram;
 	transformSlot = otherShader.transformSlot;
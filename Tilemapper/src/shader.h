@@ -7,6 +7,9 @@
 #include "common.h"
 #include "texture.h"
 
+/// What compileShader and compileShaderFromFiles return when compiling or linking fails
+constexpr GLuint INVALID_PROGRAM = (GLuint) -1;
+
 GLuint compileShader(const char* vertexShaderSource, const char* fragmentShaderSource);
 GLuint compileShaderFromFiles(const char* vertexShaderFile, const char* fragmentShaderFile);
 
@@ -0,0 +1,52 @@
+#include <cstring>
+
+#include "common.h"
+#include "stats.h"
+
+std::atomic<u64> stat_counters[N_STAT_COUNTERS];
+
+static u64 last_frame[N_STAT_COUNTERS];
+static u32 shown_stats = 0;
+
+u32 get_shown_stats() {
+	return shown_stats;
+}
+
+u64 get_frame_stat(StatCounter stat) {
+	return last_frame[stat];
+}
+
+void end_stats_frame() {
+	for (int i = 0; i < FIRST_TOTAL_STAT; i++) {
+		last_frame[i] = stat_counters[i].exchange(0, std::memory_order_relaxed);
+	}
+	for (int i = FIRST_TOTAL_STAT; i < N_STAT_COUNTERS; i++) {
+		last_frame[i] = stat_counters[i].load(std::memory_order_relaxed);
+	}
+}
+
+// @console name=stat
+void stat_cmd(char* group) {
+	static const struct {
+		const char* name;
+		u32 flag;
+	} groups[] = {
+		{ "fps", STATS_FPS },
+		{ "render", STATS_RENDER },
+		{ "memory", STATS_MEMORY },
+		{ "text", STATS_TEXT },
+		{ "all", STATS_FPS | STATS_RENDER | STATS_MEMORY | STATS_TEXT },
+	};
+	if (strcmp(group, "none") == 0) {
+		shown_stats = 0;
+		return;
+	}
+	for (const auto& g : groups) {
+		if (strcmp(group, g.name) == 0) {
+			// toggles, like the FPS counter; `stat all` turns everything on if anything was off
+			shown_stats = (shown_stats & g.flag) == g.flag ? shown_stats & ~g.flag : shown_stats | g.flag;
+			return;
+		}
+	}
+	ERR_LOG("Unknown stat group '%s' (try fps, render, memory, text, all or none)", group);
+}
@@ -0,0 +1,69 @@
+#pragma once
+
+#include <atomic>
+
+#include "common.h"
+
+// Live performance counters, shown on screen with the `stat` console command.
+// Anything can bump them from any thread with relaxed atomics; the render thread snapshots
+// and resets them once per frame in end_stats_frame.
+
+enum StatCounter {
+	// Summed over a frame
+	STAT_DRAW_CALLS,
+	STAT_INSTANCES,
+	STAT_BUFFER_UPLOAD_BYTES,
+	STAT_TEXTURE_UPLOAD_BYTES,
+	STAT_TEXTURE_BINDS,
+	STAT_SORT_MICROS,
+	STAT_RENDER_MICROS,
+	STAT_TEXT_LAYOUT_MICROS,
+	STAT_TEXT_RUNS,
+	STAT_TEXT_BATCHES,
+	STAT_GLYPHS,
+	STAT_TABLE_ADDS,
+	STAT_TABLE_REMOVES,
+
+	// Highest value reported during a frame
+	STAT_TEMP_STORAGE_PEAK,
+	STAT_FRAME_STORAGE_PEAK,
+
+	// Running totals that are never reset
+	STAT_TABLE_ENTRIES,
+	STAT_TABLE_BYTES,
+
+	N_STAT_COUNTERS
+};
+
+constexpr int FIRST_PEAK_STAT = STAT_TEMP_STORAGE_PEAK;
+constexpr int FIRST_TOTAL_STAT = STAT_TABLE_ENTRIES;
+
+enum StatGroup {
+	STATS_FPS = 0x1,
+	STATS_RENDER = 0x2,
+	STATS_MEMORY = 0x4,
+	STATS_TEXT = 0x8,
+};
+
+extern std::atomic<u64> stat_counters[N_STAT_COUNTERS];
+
+inline void count_stat(StatCounter stat, u64 n = 1) {
+	stat_counters[stat].fetch_add(n, std::memory_order_relaxed);
+}
+
+/// For the running totals, which can go down
+inline void uncount_stat(StatCounter stat, u64 n = 1) {
+	stat_counters[stat].fetch_sub(n, std::memory_order_relaxed);
+}
+
+inline void peak_stat(StatCounter stat, u64 value) {
+	u64 peak = stat_counters[stat].load(std::memory_order_relaxed);
+	while (value > peak && !stat_counters[stat].compare_exchange_weak(peak, value, std::memory_order_relaxed));
+}
+
+/// Which StatGroups the `stat` command has turned on
+u32 get_shown_stats();
+/// Value of a counter for the last finished frame
+u64 get_frame_stat(StatCounter stat);
+/// Snapshot this frame's counters and start counting the next one. Render thread only.
+void end_stats_frame();
@@ -3,6 +3,7 @@
 #include <cassert>
 
 #include "common.h"
+#include "stats.h"
 // Implements a basic generational index table
 
 int findZeroBit(const u64 section);
@@ -23,7 +24,18 @@ public:
 		data = (T*) malloc(capacity * sizeof(T));
 		generation = (u32*) calloc(capacity, sizeof(u32));
 		occupied = (u64*) calloc(capacity / 64, sizeof(u64));
+		count_stat(STAT_TABLE_BYTES, capacity * (sizeof(T) + sizeof(u32)) + capacity / 8);
 	}
+	~Table() {
+		uncount_stat(STAT_TABLE_ENTRIES, count());
+		uncount_stat(STAT_TABLE_BYTES, capacity * (sizeof(T) + sizeof(u32)) + capacity / 8);
+		free(data);
+		free(generation);
+		free(occupied);
+	}
+	// Handles point back at the table
+	Table(const Table&) = delete;
+	Table& operator = (const Table&) = delete;
 
 	struct Handle {
 		Table* table;
@@ -57,6 +69,8 @@ public:
 				data[index] = item;
 				generation[index]++;
 				BITSET(occupied[i], bit);
+				count_stat(STAT_TABLE_ADDS);
+				count_stat(STAT_TABLE_ENTRIES);
 				return {this, (u32) index, generation[index]};
 			}
 		}
@@ -73,6 +87,8 @@ public:
 		auto candidate = data[id.index];
 		if (generation[id.index] != id.generation) return false;
 		BITCLEAR(occupied[id.index >> 6], id.index & 0x3F);
+		count_stat(STAT_TABLE_REMOVES);
+		uncount_stat(STAT_TABLE_ENTRIES);
 		return true;
 	}
 
@@ -95,8 +111,7 @@ public:
 		size_t c = 0;
 		auto occ_len = capacity >> 6;
 		for (int i = 0; i < occ_len; i++) {
-			// TODO: __popcnt64 is an intrinsic, so it needs to be compiler-switched for architectures that don't support it.
-			c += __popcnt64(occupied[i]);
+			c += popcount64(occupied[i]);
 		}
 		return c;
 	}
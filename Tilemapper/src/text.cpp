@@ -2,70 +2,42 @@
 #include <glfw3.h>
 #include <cstdio>
 #include <cassert>
+#include <cstring>
+#include <utility>
+#include <atomic>
 
 #include "texture.h"
 #include "text.h"
-
-// TODO: portability
-#include <intrin.h>
+#include "workers.h"
+#include "stats.h"
 
 constexpr int ASCII_START = 33;
 constexpr int ASCII_END = 127; // exclusive range
 constexpr int ASCII_SIZE = ASCII_END - ASCII_START;
 constexpr int TAB_LENGTH = 8; // Number of spaces that make up a tab
 constexpr int CURSOR_GLYPH_ID = 94;
+constexpr int UNICODE_GLYPH_BASE = CURSOR_GLYPH_ID + 1; // glyph ids past the cursor belong to the unicode glyph map
 
 // @console
 HexColor cursor_color = 0xccccccff;
 
-constexpr u64 LARGE_PRIME = 541894198537;
-constexpr u64 LEFT_PRIME  = 926153;
-constexpr u64 RIGHT_PRIME = 1698461;
-constexpr u64 INVERSE_PHI64 = 11400714819323198485;
-constexpr u64 ALLBITS64 = 0xFFFFffffFFFFffff;
-
-static u64 hash_kern_pair(int left, int right) {
-	u64 pair = (((u64)left * LEFT_PRIME) << 32ull) + ((u64)right * RIGHT_PRIME);
-	// Xorshift64
-	pair ^= pair << 13;
-	pair ^= pair >> 7;
-	pair ^= pair << 17;
-	// The high bits are better on xorshift, so we'll reorder those to the front
-	return _rotl64(pair, 32);
-}
-
-//constexpr int UNICODE_SIZE = 1 << 20;
-void kern_hash_func_analysis() {
-	u64 bits_set_total = 0;
-	for (int left = 0; left < 65536; left++) {
-		for (int right = 0; right < 65536; right++) {
-			auto hash = hash_kern_pair(left, right);
-			bits_set_total += __popcnt64(hash);
-		}
-		if (left % 2048 == 0) {
-			printf("Completed %d codepoints (left side).\n", left);
-		}
-	}
-	double avg = ((double)bits_set_total) / (65536.0 * 65536.0);
-	printf("Average number of bits set for hashes in Unicode BMP: %f\n", avg);
-}
-
 struct KernPair {
 	char32_t left, right;
 	i32 kern_offset;
 };
 
-struct KernTableEntry {
-	char32_t left, right;
-	u32 probe_count;
-	i32 kern_offset;
-};
+// Class-based kerning, generated by fontsrc.py: glyphs that kern the same way share a class,
+// so a lookup is two class reads and one read from a small dense matrix.
+constexpr int KERN_CLASS_RANGE = 256; // codepoints at or past this never kern
+
+static const u8 NO_KERN_CLASSES[KERN_CLASS_RANGE] = {};
+static const i8 NO_KERN_MATRIX[1] = {};
 
 struct KerningData {
-	KernTableEntry* table;
-	u32 capacity;
-	u32 shift;
-	u32 max_probe_count;
+	const u8* left_class = NO_KERN_CLASSES; // [KERN_CLASS_RANGE]
+	const u8* right_class = NO_KERN_CLASSES; // [KERN_CLASS_RANGE]
+	const i8* matrix = NO_KERN_MATRIX; // [n_left_classes * n_right_classes]; class 0 is "doesn't kern"
+	u32 n_right_classes = 1;
 };
 
 struct GlyphData {
@@ -74,6 +46,33 @@ struct GlyphData {
 	i32 offset_x = 0, offset_y = 0;
 };
 
+struct UnicodeGlyph {
+	char32_t codepoint;
+	GlyphData glyph;
+};
+
+struct GlyphMapEntry {
+	char32_t codepoint; // 0 marks an empty slot
+	u32 glyph_id;
+};
+
+// Codepoint -> glyph lookup for everything outside of the ASCII range
+struct GlyphMap {
+	GlyphMapEntry* slots;
+	GlyphData* glyphs; // indexed by glyph_id - UNICODE_GLYPH_BASE
+	u32 shift;
+	u32 max_probe_count;
+	u32 n_glyphs;
+};
+
+struct GlyphAtlas;
+
+struct GlyphBounds { // one row of a font's glyph table, as the text shader sees it
+	i32 x, y, w, h;
+};
+
+static std::atomic<u32> last_font_id(0);
+
 struct Font {
 	Texture* glyph_atlas;
 	Texture* glyph_table;
@@ -86,122 +85,144 @@ struct Font {
 	i32 space_width;
 	i32 line_height;
 	KerningData kerning;
-	// std::unordered_map<u32, GlyphData> other_glyphs;
+	i32 sdf_scale = 0; // atlas texels per font pixel, for distance field fonts; 0 for bitmap fonts
+	i32 sdf_padding = 0; // texels of distance field around each glyph in the atlas
+	GlyphMap unicode = {};
+	GlyphAtlas* atlas = nullptr; // only for dynamic fonts; glyphs outside of ASCII come from here instead of unicode
+	MappedFile file = {}; // only for fonts loaded from a file; unicode points into it
+	u32 id = ++last_font_id; // unlike the address, never reused by a later font
 };
 
-constexpr int PROBE_MULT = 3;
-constexpr int PROBE_SKIP = 7;
-
-static void kern_table_insert(KerningData& kerning, KernPair pair) {
-	auto hash = hash_kern_pair(pair.left, pair.right);
-	auto index = (hash * INVERSE_PHI64) >> kerning.shift;
-	auto mask = ALLBITS64 >> kerning.shift;
-	DBG_LOG("Kerning Hash %lc %lc ==> %016llx (index %lld)", pair.left, pair.right, hash, index);
-	u16 probe_count = 1;
-	bool stole;
-	do {
-		stole = false;
-		u16 richest = UINT16_MAX;
-		u64 richest_index = index;
-		u16 richest_my_probe_count = probe_count;
-		while (kerning.table[index].probe_count > 0) {
-			auto& cur = kerning.table[index];
-			if (cur.left == pair.left && cur.right == pair.right) {
-				cur.kern_offset = pair.kern_offset;
-				return;
-			}
-			DBG_LOG(
-				"Hash collision: %lc %lc vs %lc %lc on probe #%hd (@%d, vs. #%hd)",
-				pair.left, pair.right,
-				cur.left, cur.right,
-				probe_count,
-				index,
-				cur.probe_count
-			);
+static const GlyphData* atlas_glyph(GlyphAtlas* atlas, const Font* font, char32_t codepoint, u32* glyph_id);
 
-			if (cur.probe_count < richest) { // remember the richest guy to (maybe) steal from
-				richest = cur.probe_count;
-				richest_index = index;
-				richest_my_probe_count = probe_count;
-			}
+static inline int get_kerning_offset(const KerningData& kerning, char32_t left, char32_t right) {
+	if ((left | right) >= KERN_CLASS_RANGE) return 0;
+	return kerning.matrix[kerning.left_class[left] * kerning.n_right_classes + kerning.right_class[right]];
+}
 
-			if (probe_count > richest) {
-				DBG_LOG(
-					"Stealing index %d from %lc %lc for %lc %lc",
-					richest_index,
-					kerning.table[richest_index].left, kerning.table[richest_index].right,
-					pair.left, pair.right
-				);
-				// steal from the rich
-				KernTableEntry entry = {
-					(u32) pair.left, (u32) pair.right,
-					richest_my_probe_count,
-					pair.kern_offset,
-				};
-				std::swap(entry, kerning.table[richest_index]);
-				// continue on with the victim
-				pair = {
-					entry.left, entry.right,
-					entry.kern_offset
-				};
-				probe_count = entry.probe_count;
-				index = richest_index;
-				stole = true;
-			}
+// UTF-8
 
-			index += PROBE_MULT * probe_count + PROBE_SKIP;
-			index &= mask;
-			probe_count += 1;
+// Sequence length by the top 5 bits of the lead byte; 0 for continuation bytes and invalid leads
+static const u8 UTF8_SEQUENCE_LENGTH[32] = {
+	1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1,
+	0, 0, 0, 0, 0, 0, 0, 0,
+	2, 2, 2, 2,
+	3, 3,
+	4,
+	0,
+};
+static const u8 UTF8_LEAD_MASK[5] = { 0x00, 0x7F, 0x1F, 0x0F, 0x07 };
+static const char32_t UTF8_MIN_CODEPOINT[5] = { 0, 0, 0x80, 0x800, 0x10000 }; // anything lower is overlong
 
-			if (probe_count > kerning.max_probe_count) {
-				kerning.max_probe_count = probe_count;
-			}
-			if (stole) break;
+char32_t decode_utf8(const char** text) {
+	auto s = (const u8*) *text;
+	int len = UTF8_SEQUENCE_LENGTH[s[0] >> 3];
+	if (len == 0) {
+		*text += 1;
+		return REPLACEMENT_CHARACTER;
+	}
+	char32_t codepoint = s[0] & UTF8_LEAD_MASK[len];
+	for (int i = 1; i < len; i++) {
+		if ((s[i] & 0xC0) != 0x80) { // truncated (this also stops at the terminator)
+			*text += i;
+			return REPLACEMENT_CHARACTER;
 		}
-	} while (stole);
-	kerning.table[index] = {
-		(u32) pair.left, (u32) pair.right,
-		probe_count,
-		pair.kern_offset,
-	};
+		codepoint = (codepoint << 6) | (s[i] & 0x3F);
+	}
+	*text += len;
+	if (codepoint < UTF8_MIN_CODEPOINT[len] || codepoint > 0x10FFFF || (codepoint >= 0xD800 && codepoint <= 0xDFFF)) {
+		return REPLACEMENT_CHARACTER;
+	}
+	return codepoint;
 }
 
-static KerningData create_kern_table(const KernPair* const kern_pairs, const unsigned int n_kern_pairs) {
-	// Get next largest power of 2 beyond a 80% load factor
-	u32 capacity = 1 << (32 - __lzcnt(n_kern_pairs * 10 / 8)); // TODO: make this more portable
-	u32 mask = capacity - 1;
-	auto table_data = alloc0(KernTableEntry, capacity);
-	KerningData out = { table_data, capacity, __lzcnt64((u64) mask), 0 };
-	for (int i = 0; i < n_kern_pairs; i++) {
-		kern_table_insert(out, kern_pairs[i]);
+size_t ascii_prefix_length(const char* text, size_t length) {
+	constexpr u64 LOW_BITS = 0x0101010101010101ull;
+	constexpr u64 HIGH_BITS = 0x8080808080808080ull;
+	// The high bit of every byte that is non-ASCII or zero. Only the lowest one is exact, which is the one we want.
+	auto stops = [](u64 word) { return (word | ((word - LOW_BITS) & ~word)) & HIGH_BITS; };
+	if (length < 8) {
+		size_t i = 0;
+		while (i < length && text[i] && !((u8) text[i] & 0x80)) i++;
+		return i;
+	}
+	size_t i = 0;
+	for (; i + 16 <= length; i += 16) {
+		u64 lo, hi;
+		memcpy(&lo, text + i, sizeof(lo));
+		memcpy(&hi, text + i + 8, sizeof(hi));
+		if (stops(lo) | stops(hi)) break;
+	}
+	for (;; i += 8) {
+		if (i + 8 > length) i = length - 8; // the last word overlaps bytes already checked rather than reading past length
+		u64 word;
+		memcpy(&word, text + i, sizeof(word));
+		u64 stop = stops(word);
+		if (stop) return i + trailing_zeros64(stop) / 8; // bytes are in memory order on little-endian targets
+		if (i + 8 == length) return length;
+	}
+}
+
+// The next codepoint without consuming it. Everything before ascii_end is known to be ASCII.
+static inline char32_t peek_codepoint(const char* c, const char* ascii_end) {
+	if (c < ascii_end) return *c;
+	return decode_utf8(&c);
+}
+
+// Unicode glyph map
+
+constexpr u32 INVERSE_PHI32 = 2654435769u;
+
+static GlyphMap create_glyph_map(const UnicodeGlyph* const glyphs, const u32 n_glyphs) {
+	GlyphMap map = {};
+	if (n_glyphs == 0) return map;
+
+	// Power of 2 at or under a 50% load factor
+	u32 capacity = 16;
+	u32 shift = 28;
+	while (capacity < n_glyphs * 2) {
+		capacity <<= 1;
+		shift--;
 	}
-	DBG_LOG("Kerning table max probe = %d", out.max_probe_count);
-#ifndef NDEBUG
-	printf("Kerning table probe count distribution:\n");
-	for (int base = 0; base < capacity; base += 16) {
-		printf("   ");
-		for (int i = base; i < base + 16; i++) {
-			printf(" %d", out.table[i].probe_count);
+	u32 mask = capacity - 1;
+	map.slots = alloc0(GlyphMapEntry, capacity);
+	map.glyphs = alloc(GlyphData, n_glyphs);
+	map.shift = shift;
+	map.n_glyphs = n_glyphs;
+	for (u32 i = 0; i < n_glyphs; i++) {
+		map.glyphs[i] = glyphs[i].glyph;
+		u32 index = (glyphs[i].codepoint * INVERSE_PHI32) >> shift;
+		u32 probe_count = 0;
+		while (map.slots[index].codepoint != 0 && map.slots[index].codepoint != glyphs[i].codepoint) {
+			index = (index + 1) & mask;
+			probe_count++;
 		}
-		printf("\n");
+		map.slots[index] = { glyphs[i].codepoint, UNICODE_GLYPH_BASE + i };
+		if (probe_count > map.max_probe_count) map.max_probe_count = probe_count;
 	}
-	printf("\n");
-#endif
-	return out;
+	DBG_LOG("Glyph map: %u glyphs in %u slots, max probe = %u", n_glyphs, capacity, map.max_probe_count);
+	return map;
 }
 
-static int get_kerning_offset(const KerningData& const kerning, char32_t left, char32_t right) {
-	if (left <= ' ' || right <= ' ') return 0;
-	auto index = (hash_kern_pair(left, right) * INVERSE_PHI64) >> kerning.shift;
-	auto mask = ALLBITS64 >> kerning.shift;
-	for (int probe_count = 1; probe_count <= kerning.max_probe_count; probe_count++) {
-		auto& entry = kerning.table[index];
-		if (entry.probe_count == 0) return 0;
-		if (entry.left == left && entry.right == right) return entry.kern_offset;
-		index += PROBE_MULT * probe_count + PROBE_SKIP;
-		index &= mask;
+static const GlyphData* lookup_glyph(const GlyphMap& map, char32_t codepoint, u32* glyph_id) {
+	if (map.slots == nullptr) return nullptr;
+	u32 mask = (1u << (32 - map.shift)) - 1;
+	u32 index = (codepoint * INVERSE_PHI32) >> map.shift;
+	for (u32 probe_count = 0; probe_count <= map.max_probe_count; probe_count++) {
+		auto& entry = map.slots[index];
+		if (entry.codepoint == codepoint) {
+			*glyph_id = entry.glyph_id;
+			return &map.glyphs[entry.glyph_id - UNICODE_GLYPH_BASE];
+		}
+		if (entry.codepoint == 0) return nullptr;
+		index = (index + 1) & mask;
 	}
-	return 0;
+	return nullptr;
+}
+
+static inline const GlyphData* find_glyph(const Font* font, char32_t codepoint, u32* glyph_id) {
+	if (font->atlas) return atlas_glyph(font->atlas, font, codepoint, glyph_id);
+	return lookup_glyph(font->unicode, codepoint, glyph_id);
 }
 
 static inline bool handle_color_code(const char* const fulltext, const char* const c, HexColor* color, const char** end) {
@@ -224,33 +245,111 @@ static inline bool handle_color_code(const char* const fulltext, const char* con
 	}
 }
 
-int print_glyphs(const Font* font, GlyphRenderData* const buffer, size_t buf_size, const char* text, float x, float y) {
-	int len = 0;
-	int x_offset = 0;
-	int y_offset = 0;
+// Text layout
+// print_glyphs, measure_text and wrap_text all go through layout_text, so advances, kerning, tabs,
+// control codes and line breaking can't drift apart between measuring text and drawing it.
+// The sink decides what becomes of each glyph:
+//   bool glyph(i32 x, i32 y, u32 glyph_id, const GlyphData& glyph, u32 rgba) -- false stops the layout
+//   int mark()                                -- bookmark before a word starts
+//   void shift(int mark, i32 dx, i32 dy)      -- move everything since the bookmark (the word wrapped)
+//   void line(const char* start, const char* end, i32 width)
+//   void cursor(i32 x, i32 y)
+
+// Returns -1 if the text has a bad control code; otherwise 0, even if the sink stopped early.
+// max_width <= 0 only breaks lines at '\n'.
+template <typename Sink>
+static int layout_text(const Font* font, const char* text, i32 max_width, Sink& sink) {
+	i32 x_offset = 0;
+	i32 y_offset = 0;
 	u32 rgba = 0xFFFFFFFF;
 	// cursor data
-	int cursor_char = -1;
+	int cursor_byte = -1; // offset into text after the cursor header, so it lines up with byte-indexed input
 	bool cursor_set = false;
-	int cursor_x = 0;
-	int cursor_y = 0;
+	i32 cursor_x = 0;
+	i32 cursor_y = 0;
 	if (text[0] == TEXT_CURSOR) {
 		char* end;
-		cursor_char = strtoul(text + 1, &end, TEXT_CURSOR_RADIX);
+		cursor_byte = strtoul(text + 1, &end, TEXT_CURSOR_RADIX);
 		end = strchr(end, TEXT_CURSOR_END);
 		if (end == nullptr) return 0;
 		text = end + 1;
 	}
-	int current_char = 0;
-	for (const char* c = text; *c; c++, current_char++) {
-		if (current_char == cursor_char) {
+	// line breaking
+	const char* line_start = text;
+	i32 line_width = 0; // right edge of the last glyph; trailing whitespace doesn't count
+	const char* break_at = nullptr; // first whitespace after the last word that could stay on this line
+	i32 break_width = 0; // line_width up to break_at
+	bool after_break = false;
+	const char* word_start = nullptr;
+	i32 word_x = 0;
+	int word_mark = 0;
+	int word_byte = 0;
+
+	auto new_line = [&](const char* end, i32 width, const char* next_start) {
+		sink.line(line_start, end, width);
+		line_start = next_start;
+		y_offset += font->line_height;
+		break_at = nullptr;
+		after_break = false;
+	};
+	// Make room for a glyph of the given advance, wrapping if it won't fit in max_width
+	auto fit = [&](const char* c, int current_byte, i32 advance) {
+		if (max_width <= 0 || x_offset + advance <= max_width || line_width == 0) return;
+		if (break_at) { // move the current word down to the next line
+			new_line(break_at, break_width, word_start);
+			sink.shift(word_mark, -word_x, font->line_height);
+			if (cursor_set && cursor_byte >= word_byte) {
+				cursor_x -= word_x;
+				cursor_y += font->line_height;
+			}
+			x_offset -= word_x;
+			line_width -= word_x;
+			if (x_offset + advance <= max_width || line_width == 0) return;
+		}
+		// the word is wider than the whole line, so break it right here
+		new_line(c, line_width, c);
+		if (cursor_set && cursor_byte == current_byte) {
+			cursor_x = 0;
+			cursor_y = y_offset;
+		}
+		x_offset = 0;
+		line_width = 0;
+	};
+	auto place = [&](const GlyphData& glyph, u32 glyph_id, i32 kerning) {
+		if (!sink.glyph(x_offset + glyph.offset_x, y_offset + glyph.offset_y, glyph_id, glyph, rgba)) return false;
+		line_width = x_offset + glyph.advance;
+		x_offset += glyph.advance + kerning;
+		return true;
+	};
+
+	const char* text_end = text + strlen(text);
+	const char* ascii_end = text + ascii_prefix_length(text, text_end - text);
+	const char* c = text;
+	for (; *c; c++) {
+		int current_byte = c - text;
+		if (current_byte == cursor_byte) {
 			cursor_x = x_offset;
 			cursor_y = y_offset;
 			cursor_set = true;
 		}
+		bool whitespace = *c == ' ' || *c == '\t';
+		if (whitespace && !after_break && line_width > 0) {
+			break_at = c;
+			break_width = line_width;
+			after_break = true;
+		}
+		else if (!whitespace && after_break) {
+			word_start = c;
+			word_x = x_offset;
+			word_mark = sink.mark();
+			word_byte = current_byte;
+			after_break = false;
+		}
+
 		if (*c == '\n') {
+			new_line(c, line_width, c + 1);
 			x_offset = 0;
-			y_offset += font->line_height;
+			line_width = 0;
 		}
 		else if (*c == '\t') {
 			auto tab = TAB_LENGTH * font->space_width;
@@ -297,87 +396,1233 @@ int print_glyphs(const Font* font, GlyphRenderData* const buffer, size_t buf_siz
 		else if (*c >= ASCII_START && *c < ASCII_END) {
 			handle_ascii:
 
-			if (len >= buf_size) {
-				ERR_LOG("WARNING: Unable to render the text \"%s\" with only %zd glyphs.", text, buf_size);
-				return len;
-			}
-
 			u32 glyph_id = *c - ASCII_START;
 			auto& glyph = font->ascii_glyphs[glyph_id];
-			buffer[len++] = {
-				x + x_offset + glyph.offset_x,
-				y + y_offset + glyph.offset_y,
-				glyph_id,
-				rgba
-			};
-			x_offset += glyph.advance + get_kerning_offset(font->kerning, c[0], c[1]);
+			fit(c, current_byte, glyph.advance);
+			if (!place(glyph, glyph_id, get_kerning_offset(font->kerning, c[0], peek_codepoint(c + 1, ascii_end)))) return 0;
 		}
-		else if (*c > 127) {
+		else if ((u8) *c >= 0x80) {
+			const char* next = c;
+			char32_t codepoint = decode_utf8(&next);
+			ascii_end = next + ascii_prefix_length(next, text_end - next);
 
+			u32 glyph_id;
+			auto glyph = find_glyph(font, codepoint, &glyph_id);
+			if (glyph == nullptr) glyph = find_glyph(font, REPLACEMENT_CHARACTER, &glyph_id);
+			if (glyph == nullptr) {
+				x_offset += font->space_width;
+			}
+			else {
+				fit(c, current_byte, glyph->advance);
+				if (!place(*glyph, glyph_id, get_kerning_offset(font->kerning, codepoint, peek_codepoint(next, ascii_end)))) return 0;
+			}
+			c = next - 1; // the loop steps onto next
 		}
-		// TODO: UTF-8
 	}
-	if (cursor_char >= 0 && len < buf_size) {
+	sink.line(line_start, c, line_width);
+	if (cursor_byte >= 0) {
 		if (!cursor_set) {
 			cursor_x = x_offset;
 			cursor_y = y_offset;
 		}
+		sink.cursor(cursor_x, cursor_y);
+	}
+	return 0;
+}
+
+struct GlyphBufferSink {
+	const Font* font;
+	GlyphRenderData* const buffer;
+	const size_t size;
+	const float x, y;
+	int len = 0;
+	bool full = false;
+
+	inline bool glyph(i32 gx, i32 gy, u32 glyph_id, const GlyphData&, u32 rgba) {
+		if ((size_t) len >= size) {
+			full = true;
+			return false;
+		}
+		buffer[len++] = { x + gx, y + gy, glyph_id, rgba };
+		return true;
+	}
+	inline int mark() { return len; }
+	inline void shift(int mark, i32 dx, i32 dy) {
+		for (int i = mark; i < len; i++) {
+			buffer[i].x += dx;
+			buffer[i].y += dy;
+		}
+	}
+	inline void line(const char*, const char*, i32) {}
+	inline void cursor(i32 cx, i32 cy) {
+		if ((size_t) len >= size) return;
 		buffer[len++] = {
-			x + cursor_x + font->cursor.offset_x,
-			y + cursor_y + font->cursor.offset_y,
+			x + cx + font->cursor.offset_x,
+			y + cy + font->cursor.offset_y,
 			CURSOR_GLYPH_ID,
 			cursor_color
 		};
 	}
-	return len;
+};
+
+// Measuring only needs the line breaks, so everything else is a no-op
+struct TextLineSink {
+	const char* const text;
+	TextLine* const lines;
+	const int max_lines;
+	int n_lines = 0;
+	i32 width = 0;
+
+	inline bool glyph(i32, i32, u32, const GlyphData&, u32) { return true; }
+	inline int mark() { return 0; }
+	inline void shift(int, i32, i32) {}
+	inline void line(const char* start, const char* end, i32 line_width) {
+		if (n_lines < max_lines) lines[n_lines] = { (int) (start - text), (int) (end - text), line_width };
+		n_lines++;
+		if (line_width > width) width = line_width;
+	}
+	inline void cursor(i32, i32) {}
+};
+
+static int print_glyphs_impl(const Font* font, GlyphRenderData* const buffer, size_t buf_size, const char* text, float x, float y, i32 max_width) {
+	GlyphBufferSink sink = { font, buffer, buf_size, x, y };
+	if (layout_text(font, text, max_width, sink) < 0) return -1;
+	if (sink.full) {
+		ERR_LOG("WARNING: Unable to render the text \"%s\" with only %zd glyphs.", text, buf_size);
+	}
+	return sink.len;
 }
 
+int print_glyphs(const Font* font, GlyphRenderData* const buffer, size_t buf_size, const char* text, float x, float y) {
+	return print_glyphs_impl(font, buffer, buf_size, text, x, y, 0);
+}
 
-FontDims get_font_dimensions(const Font& font) {
-	return { font.space_width, font.line_height };
+int print_glyphs_wrapped(const Font* font, GlyphRenderData* const buffer, size_t buf_size, const char* text, float x, float y, i32 max_width) {
+	return print_glyphs_impl(font, buffer, buf_size, text, x, y, max_width);
 }
-int bind_font_glyph_atlas(Font& font, int slot) {
-	return bind(font.glyph_atlas, slot);
+
+TextExtents measure_text(const Font* font, const char* text, i32 max_width) {
+	TextLineSink sink = { text, nullptr, 0 };
+	if (layout_text(font, text, max_width, sink) < 0) return { 0, 0, -1 };
+	return { sink.width, sink.n_lines * font->line_height, sink.n_lines };
 }
 
-int bind_font_glyph_table(Font& font, int slot) {
-	return bind(font.glyph_table, slot);
+int wrap_text(const Font* font, const char* text, i32 max_width, TextLine* lines, int max_lines) {
+	TextLineSink sink = { text, lines, max_lines };
+	if (layout_text(font, text, max_width, sink) < 0) return -1;
+	return sink.n_lines;
 }
 
-#include "generated/simple_font.h"
 
-void init_simple_font() {
-	GLuint tex_handles[2];
-	glGenTextures(2, tex_handles);
-	auto& atlas = tex_handles[0];
-	auto& table = tex_handles[1];
-	glBindTexture(GL_TEXTURE_RECTANGLE, atlas);
+// Dynamic glyph atlas
+// Glyphs are rasterized on first use and shelf-packed into pages. The pages are horizontal bands of one
+// GL_TEXTURE_RECTANGLE, so a dynamic font still draws with a single atlas binding. When the budget runs out,
+// the least recently used page is emptied wholesale; pages touched during the current frame are never evicted.
+
+constexpr int ATLAS_MAX_SHELVES = 64; // per page
+constexpr int ATLAS_PADDING = 1; // between glyphs, so neighbors never bleed into each other
+constexpr int ATLAS_GLYPHS_PER_PAGE = 1024; // sizes the glyph table; most glyphs are well over 16x16 anyways
+
+struct AtlasShelf {
+	i32 y, height;
+	i32 x; // start of free space
+};
+
+struct AtlasPage {
+	AtlasShelf shelves[ATLAS_MAX_SHELVES];
+	i32 n_shelves;
+	i32 next_y; // start of space not claimed by any shelf
+	i32 n_glyphs;
+	u32 last_used; // text frame
+	bool pinned; // holds ASCII and the cursor
+};
+
+struct AtlasGlyph {
+	char32_t codepoint; // 0 marks a free glyph id
+	i32 page;
+	GlyphData data;
+};
+
+struct GlyphAtlas {
+	GlyphRasterizer rasterize;
+	void* user;
+	GLuint table_buffer;
+	i32 page_size;
+	i32 max_pages;
+	i32 n_pages; // pages opened so far
+	AtlasPage* pages;
+	AtlasGlyph* glyphs; // indexed by glyph_id - UNICODE_GLYPH_BASE
+	i32 max_glyphs;
+	i32 n_glyph_ids; // high water mark
+	i32* free_ids;
+	i32 n_free_ids;
+	i32* slots; // open addressing (linear probing) into glyphs; -1 is empty
+	u32 slot_shift;
+	u32 generation; // bumped on eviction, so layouts that refer to evicted glyphs stop matching
+	GlyphAtlasStats stats;
+};
+
+static u32 text_frame = 1;
+
+void begin_text_frame() {
+	text_frame++;
+}
+
+static inline u32 atlas_home_slot(const GlyphAtlas* atlas, char32_t codepoint) {
+	return (codepoint * INVERSE_PHI32) >> atlas->slot_shift;
+}
+
+static inline u32 atlas_slot_mask(const GlyphAtlas* atlas) {
+	return (1u << (32 - atlas->slot_shift)) - 1;
+}
+
+static void atlas_remove_slot(GlyphAtlas* atlas, u32 slot) {
+	// Backward shift deletion, same as the layout cache
+	u32 mask = atlas_slot_mask(atlas);
+	u32 hole = slot;
+	for (u32 i = (slot + 1) & mask; atlas->slots[i] >= 0; i = (i + 1) & mask) {
+		u32 home = atlas_home_slot(atlas, atlas->glyphs[atlas->slots[i]].codepoint);
+		if (((i - home) & mask) >= ((i - hole) & mask)) {
+			atlas->slots[hole] = atlas->slots[i];
+			hole = i;
+		}
+	}
+	atlas->slots[hole] = -1;
+}
+
+static void evict_atlas_page(GlyphAtlas* atlas, int page) {
+	u32 mask = atlas_slot_mask(atlas);
+	for (i32 i = 0; i < atlas->n_glyph_ids; i++) {
+		auto& glyph = atlas->glyphs[i];
+		if (glyph.codepoint == 0 || glyph.page != page) continue;
+		u32 slot = atlas_home_slot(atlas, glyph.codepoint);
+		while (atlas->slots[slot] != i) slot = (slot + 1) & mask;
+		atlas_remove_slot(atlas, slot);
+		glyph.codepoint = 0;
+		atlas->free_ids[atlas->n_free_ids++] = i;
+	}
+	auto& p = atlas->pages[page];
+	p.n_shelves = 0;
+	p.next_y = page * atlas->page_size;
+	p.n_glyphs = 0;
+	atlas->generation++;
+	atlas->stats.evicted_pages++;
+}
+
+static bool pack_in_page(GlyphAtlas* atlas, AtlasPage& page, int w, int h, int* x, int* y) {
+	// Best fitting shelf that is no more than a third again as tall as the glyph
+	AtlasShelf* best = nullptr;
+	for (int i = 0; i < page.n_shelves; i++) {
+		auto& shelf = page.shelves[i];
+		if (shelf.height < h || shelf.height > h + h / 3 + 1) continue;
+		if (shelf.x + w > atlas->page_size) continue;
+		if (best == nullptr || shelf.height < best->height) best = &shelf;
+	}
+	if (best == nullptr) {
+		auto page_end = (&page - atlas->pages + 1) * atlas->page_size;
+		if (page.n_shelves >= ATLAS_MAX_SHELVES || page.next_y + h > page_end) return false;
+		best = &page.shelves[page.n_shelves++];
+		*best = { page.next_y, h, 0 };
+		page.next_y += h + ATLAS_PADDING;
+	}
+	*x = best->x;
+	*y = best->y;
+	best->x += w + ATLAS_PADDING;
+	return true;
+}
+
+static bool atlas_allocate(GlyphAtlas* atlas, int w, int h, int* page, int* x, int* y) {
+	if (w > atlas->page_size || h > atlas->page_size) return false;
+	for (int i = 0; i < atlas->n_pages; i++) {
+		if (pack_in_page(atlas, atlas->pages[i], w, h, x, y)) {
+			*page = i;
+			return true;
+		}
+	}
+	if (atlas->n_pages < atlas->max_pages) {
+		*page = atlas->n_pages++;
+		return pack_in_page(atlas, atlas->pages[*page], w, h, x, y);
+	}
+	// Out of budget: empty out the coldest page that isn't needed for this frame
+	int victim = -1;
+	for (int i = 0; i < atlas->n_pages; i++) {
+		auto& p = atlas->pages[i];
+		if (p.pinned || p.last_used == text_frame) continue;
+		if (victim < 0 || p.last_used < atlas->pages[victim].last_used) victim = i;
+	}
+	if (victim < 0) return false;
+	evict_atlas_page(atlas, victim);
+	*page = victim;
+	return pack_in_page(atlas, atlas->pages[victim], w, h, x, y);
+}
+
+static void upload_glyph_bounds(GlyphAtlas* atlas, u32 glyph_id, const GlyphData& glyph) {
+	GlyphBounds bounds = REPACK4(glyph, src_x, src_y, src_w, src_h);
+	glBindBuffer(GL_TEXTURE_BUFFER, atlas->table_buffer);
+	glBufferSubData(GL_TEXTURE_BUFFER, sizeof(bounds) * glyph_id, sizeof(bounds), &bounds);
+	count_stat(STAT_BUFFER_UPLOAD_BYTES, sizeof(bounds));
+}
+
+// Rasterize a glyph into the atlas. Returns the page it landed on, or -1.
+static int rasterize_into_atlas(Font* font, char32_t codepoint, GlyphData* glyph) {
+	auto atlas = font->atlas;
+	GlyphBitmap bitmap = {};
+	if (!atlas->rasterize(atlas->user, codepoint, &bitmap)) return -1;
+
+	int page, x = 0, y = 0;
+	if (bitmap.width > 0 && bitmap.height > 0) {
+		if (!atlas_allocate(atlas, bitmap.width, bitmap.height, &page, &x, &y)) {
+			ERR_LOG("Glyph atlas is full; unable to rasterize U+%04X", (u32) codepoint);
+			return -1;
+		}
+		int slot = bind(font->glyph_atlas);
+		glActiveTexture(GL_TEXTURE0 + slot);
+		glPixelStorei(GL_UNPACK_ALIGNMENT, 1);
+		glPixelStorei(GL_UNPACK_ROW_LENGTH, bitmap.pitch);
+		glTexSubImage2D(GL_TEXTURE_RECTANGLE, 0, x, y, bitmap.width, bitmap.height, GL_RED_INTEGER, GL_UNSIGNED_BYTE, bitmap.pixels);
+		count_stat(STAT_TEXTURE_UPLOAD_BYTES, bitmap.width * bitmap.height);
+		glPixelStorei(GL_UNPACK_ROW_LENGTH, 0);
+	}
+	else { // Blank glyphs take no space; charge them to the first page, opening it if need be
+		if (atlas->n_pages == 0) atlas->n_pages = 1;
+		page = 0;
+	}
+	*glyph = { x, y, bitmap.width, bitmap.height, bitmap.advance, bitmap.offset_x, bitmap.offset_y };
+	atlas->stats.rasterized++;
+	return page;
+}
+
+static const GlyphData* atlas_glyph(GlyphAtlas* atlas, const Font* font, char32_t codepoint, u32* glyph_id) {
+	u32 mask = atlas_slot_mask(atlas);
+	u32 slot = atlas_home_slot(atlas, codepoint);
+	for (i32 index; (index = atlas->slots[slot]) >= 0; slot = (slot + 1) & mask) {
+		auto& glyph = atlas->glyphs[index];
+		if (glyph.codepoint == codepoint) {
+			atlas->pages[glyph.page].last_used = text_frame;
+			*glyph_id = UNICODE_GLYPH_BASE + index;
+			return &glyph.data;
+		}
+	}
+
+	// Miss: rasterize it
+	if (atlas->n_free_ids == 0 && atlas->n_glyph_ids >= atlas->max_glyphs) {
+		// Out of glyph ids rather than pixels; free up a page's worth
+		int victim = -1;
+		for (int i = 0; i < atlas->n_pages; i++) {
+			auto& p = atlas->pages[i];
+			if (p.pinned || p.last_used == text_frame || p.n_glyphs == 0) continue;
+			if (victim < 0 || p.last_used < atlas->pages[victim].last_used) victim = i;
+		}
+		if (victim < 0) return nullptr;
+		evict_atlas_page(atlas, victim);
+	}
+	GlyphData data;
+	int page = rasterize_into_atlas((Font*) font, codepoint, &data);
+	if (page < 0) return nullptr;
+
+	i32 index = atlas->n_free_ids > 0 ? atlas->free_ids[--atlas->n_free_ids] : atlas->n_glyph_ids++;
+	auto& glyph = atlas->glyphs[index];
+	glyph = { codepoint, page, data };
+	atlas->pages[page].n_glyphs++;
+	atlas->pages[page].last_used = text_frame;
+
+	// Evictions while rasterizing may have shifted entries around, so find the slot again
+	slot = atlas_home_slot(atlas, codepoint);
+	while (atlas->slots[slot] >= 0) slot = (slot + 1) & mask;
+	atlas->slots[slot] = index;
+
+	*glyph_id = UNICODE_GLYPH_BASE + index;
+	upload_glyph_bounds(atlas, *glyph_id, data);
+	return &glyph.data;
+}
 
-	glTexImage2D(GL_TEXTURE_RECTANGLE, 0, GL_R8UI, simple_font__bitmap_width, simple_font__bitmap_height, 0, GL_RED_INTEGER, GL_UNSIGNED_BYTE, simple_font__bitmap);
+static void touch_atlas_glyphs(GlyphAtlas* atlas, const GlyphRenderData* glyphs, int n_glyphs) {
+	for (int i = 0; i < n_glyphs; i++) {
+		if (glyphs[i].glyph_id < UNICODE_GLYPH_BASE) continue;
+		atlas->pages[atlas->glyphs[glyphs[i].glyph_id - UNICODE_GLYPH_BASE].page].last_used = text_frame;
+	}
+}
+
+Font* make_dynamic_font(GlyphRasterizer rasterize, void* user, i32 space_width, i32 line_height, size_t atlas_budget, i32 page_size) {
+	if (page_size <= 0) {
+		ERR_LOG("Glyph atlas pages need a positive size, not %d", page_size);
+		return nullptr;
+	}
+	size_t max_pages = atlas_budget / ((size_t) page_size * page_size);
+	GLint max_rect_size;
+	glGetIntegerv(GL_MAX_RECTANGLE_TEXTURE_SIZE, &max_rect_size);
+	max_pages = min(max_pages, (size_t) max(max_rect_size, 0) / page_size);
+	// The glyph ids (and twice as many hash slots) have to fit in an i32
+	max_pages = min(max_pages, (size_t) INT32_MAX / (2 * ATLAS_GLYPHS_PER_PAGE));
+	if (max_pages < 1) {
+		ERR_LOG("A glyph atlas budget of %zu bytes doesn't fit a single %dx%d page (up to %d texels tall)", atlas_budget, page_size, page_size, max_rect_size);
+		return nullptr;
+	}
+
+	auto atlas = new GlyphAtlas;
+	atlas->rasterize = rasterize;
+	atlas->user = user;
+	atlas->page_size = page_size;
+	atlas->max_pages = (i32) max_pages;
+	atlas->n_pages = 0;
+	atlas->pages = alloc0(AtlasPage, max_pages);
+	for (i32 i = 0; i < atlas->max_pages; i++) {
+		atlas->pages[i].next_y = i * page_size;
+	}
+	atlas->max_glyphs = atlas->max_pages * ATLAS_GLYPHS_PER_PAGE;
+	atlas->glyphs = alloc0(AtlasGlyph, atlas->max_glyphs);
+	atlas->n_glyph_ids = 0;
+	atlas->free_ids = alloc(i32, atlas->max_glyphs);
+	atlas->n_free_ids = 0;
+	u32 n_slots = 16;
+	atlas->slot_shift = 28;
+	while (n_slots < (u32) atlas->max_glyphs * 2) { // keep the load factor at or under 50%
+		n_slots <<= 1;
+		atlas->slot_shift--;
+	}
+	atlas->slots = alloc(i32, n_slots);
+	memset(atlas->slots, 0xFF, sizeof(i32) * n_slots);
+	atlas->generation = 0;
+	atlas->stats = {};
+	atlas->stats.max_pages = atlas->max_pages;
 
+	GLuint tex_handles[2];
+	glGenTextures(2, tex_handles);
+	glBindTexture(GL_TEXTURE_RECTANGLE, tex_handles[0]);
+	glTexImage2D(GL_TEXTURE_RECTANGLE, 0, GL_R8UI, page_size, page_size * atlas->max_pages, 0, GL_RED_INTEGER, GL_UNSIGNED_BYTE, nullptr);
 	glTexParameteri(GL_TEXTURE_RECTANGLE, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_BORDER);
 	glTexParameteri(GL_TEXTURE_RECTANGLE, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_BORDER);
 	glTexParameteri(GL_TEXTURE_RECTANGLE, GL_TEXTURE_MIN_FILTER, GL_NEAREST);
 	glTexParameteri(GL_TEXTURE_RECTANGLE, GL_TEXTURE_MAG_FILTER, GL_NEAREST);
 
-	struct { int x, y, w, h; } glyph_bounds[(ASCII_SIZE + 1) * 4];
+	glGenBuffers(1, &atlas->table_buffer);
+	glBindBuffer(GL_TEXTURE_BUFFER, atlas->table_buffer);
+	glBufferData(GL_TEXTURE_BUFFER, sizeof(GlyphBounds) * (UNICODE_GLYPH_BASE + atlas->max_glyphs), nullptr, GL_DYNAMIC_DRAW);
+	glBindTexture(GL_TEXTURE_BUFFER, tex_handles[1]);
+	glTexBuffer(GL_TEXTURE_BUFFER, GL_RGBA32I, atlas->table_buffer);
+
+	auto font = new Font();
+	font->glyph_atlas = make_texture(tex_handles[0], GL_TEXTURE_RECTANGLE);
+	font->glyph_table = make_texture(tex_handles[1], GL_TEXTURE_BUFFER);
+	font->glyph_table_buffer = atlas->table_buffer;
+	font->space_width = space_width;
+	font->line_height = line_height;
+	font->kerning = {};
+	font->unicode = {};
+	font->atlas = atlas;
+
+	// ASCII and the cursor get the fixed glyph ids the fast path expects, on pages that are never evicted
 	for (int i = 0; i < ASCII_SIZE; i++) {
-		glyph_bounds[i] = REPACK4(simple_font.ascii_glyphs[i], src_x, src_y, src_w, src_h);
+		GlyphData& glyph = font->ascii_glyphs[i];
+		int page = rasterize_into_atlas(font, ASCII_START + i, &glyph);
+		if (page < 0) {
+			glyph = {};
+			continue;
+		}
+		atlas->pages[page].pinned = true;
+		upload_glyph_bounds(atlas, i, glyph);
 	}
-	glyph_bounds[CURSOR_GLYPH_ID] = REPACK4(simple_font.cursor, src_x, src_y, src_w, src_h);
+	u8 cursor_pixels[256];
+	int cursor_height = min(line_height, (i32) sizeof(cursor_pixels));
+	memset(cursor_pixels, 0xFF, cursor_height);
+	int page, x, y;
+	if (atlas_allocate(atlas, 1, cursor_height, &page, &x, &y)) {
+		atlas->pages[page].pinned = true;
+		int slot = bind(font->glyph_atlas);
+		glActiveTexture(GL_TEXTURE0 + slot);
+		glPixelStorei(GL_UNPACK_ALIGNMENT, 1);
+		glTexSubImage2D(GL_TEXTURE_RECTANGLE, 0, x, y, 1, cursor_height, GL_RED_INTEGER, GL_UNSIGNED_BYTE, cursor_pixels);
+		count_stat(STAT_TEXTURE_UPLOAD_BYTES, cursor_height);
+		font->cursor = { x, y, 1, cursor_height, -1, -1 };
+		GlyphData cursor_glyph = { x, y, 1, cursor_height, 0 };
+		upload_glyph_bounds(atlas, CURSOR_GLYPH_ID, cursor_glyph);
+	}
+	return font;
+}
 
-	GLuint table_buffer;
-	glGenBuffers(1, &table_buffer);
-	glBindBuffer(GL_TEXTURE_BUFFER, table_buffer);
-	glBufferData(GL_TEXTURE_BUFFER, sizeof(glyph_bounds), (void*)glyph_bounds, GL_STATIC_DRAW);
+void free_dynamic_font(Font* font) {
+	auto atlas = font->atlas;
+	assert(atlas != nullptr);
+	free_texture(font->glyph_atlas);
+	free_texture(font->glyph_table);
+	glDeleteBuffers(1, &atlas->table_buffer);
+	free(atlas->pages);
+	free(atlas->glyphs);
+	free(atlas->free_ids);
+	free(atlas->slots);
+	delete atlas;
+	delete font;
+}
 
-	glBindTexture(GL_TEXTURE_BUFFER, table);
-	glTexBuffer(GL_TEXTURE_BUFFER, GL_RGBA32I, table_buffer);
+GlyphAtlasStats get_glyph_atlas_stats(const Font* font) {
+	if (font->atlas == nullptr) return {};
+	auto stats = font->atlas->stats;
+	stats.resident_glyphs = font->atlas->n_glyph_ids - font->atlas->n_free_ids;
+	stats.pages_in_use = font->atlas->n_pages;
+	return stats;
+}
 
-	simple_font.glyph_atlas = make_texture(atlas, GL_TEXTURE_RECTANGLE);
-	simple_font.glyph_table = make_texture(table, GL_TEXTURE_BUFFER);
-	simple_font.glyph_table_buffer = table_buffer;
-	simple_font.kerning = create_kern_table(simple_font__kerning, simple_font__n_kern_pairs);
+FontDims get_font_dimensions(const Font& font) {
+	return { font.space_width, font.line_height };
+}
+
+FontSdf get_font_sdf(const Font& font) {
+	return { font.sdf_scale, font.sdf_padding };
+}
+int bind_font_glyph_atlas(Font& font, int slot) {
+	return bind(font.glyph_atlas, slot);
+}
+
+int bind_font_glyph_table(Font& font, int slot) {
+	return bind(font.glyph_table, slot);
+}
+
+#include "generated/simple_font.h"
+
+// Bitmap atlases are read texel by texel as integers. Distance fields are normalized and filtered,
+// since interpolating between texels is what lets them scale.
+static void upload_font_textures(Font* font, const u8* bitmap, int width, int height, const GlyphBounds* bounds, int n_bounds, bool distance_field) {
+	GLuint tex_handles[2];
+	glGenTextures(2, tex_handles);
+	auto& atlas = tex_handles[0];
+	auto& table = tex_handles[1];
+	glBindTexture(GL_TEXTURE_RECTANGLE, atlas);
+
+	glPixelStorei(GL_UNPACK_ALIGNMENT, 1);
+	if (distance_field) {
+		glTexImage2D(GL_TEXTURE_RECTANGLE, 0, GL_R8, width, height, 0, GL_RED, GL_UNSIGNED_BYTE, bitmap);
+	}
+	else {
+		glTexImage2D(GL_TEXTURE_RECTANGLE, 0, GL_R8UI, width, height, 0, GL_RED_INTEGER, GL_UNSIGNED_BYTE, bitmap);
+	}
+
+	GLint filter = distance_field ? GL_LINEAR : GL_NEAREST;
+	glTexParameteri(GL_TEXTURE_RECTANGLE, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_BORDER);
+	glTexParameteri(GL_TEXTURE_RECTANGLE, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_BORDER);
+	glTexParameteri(GL_TEXTURE_RECTANGLE, GL_TEXTURE_MIN_FILTER, filter);
+	glTexParameteri(GL_TEXTURE_RECTANGLE, GL_TEXTURE_MAG_FILTER, filter);
+
+	GLuint table_buffer;
+	glGenBuffers(1, &table_buffer);
+	glBindBuffer(GL_TEXTURE_BUFFER, table_buffer);
+	glBufferData(GL_TEXTURE_BUFFER, sizeof(GlyphBounds) * n_bounds, (void*)bounds, GL_STATIC_DRAW);
+
+	glBindTexture(GL_TEXTURE_BUFFER, table);
+	glTexBuffer(GL_TEXTURE_BUFFER, GL_RGBA32I, table_buffer);
+
+	font->glyph_atlas = make_texture(atlas, GL_TEXTURE_RECTANGLE);
+	font->glyph_table = make_texture(table, GL_TEXTURE_BUFFER);
+	font->glyph_table_buffer = table_buffer;
+}
+
+void init_simple_font() {
+	simple_font.unicode = create_glyph_map(simple_font__unicode_glyphs, simple_font__n_unicode_glyphs);
+
+	int n_glyph_ids = UNICODE_GLYPH_BASE + simple_font.unicode.n_glyphs;
+	auto glyph_bounds = alloc(GlyphBounds, n_glyph_ids);
+	for (int i = 0; i < ASCII_SIZE; i++) {
+		glyph_bounds[i] = REPACK4(simple_font.ascii_glyphs[i], src_x, src_y, src_w, src_h);
+	}
+	glyph_bounds[CURSOR_GLYPH_ID] = REPACK4(simple_font.cursor, src_x, src_y, src_w, src_h);
+	for (u32 i = 0; i < simple_font.unicode.n_glyphs; i++) {
+		glyph_bounds[UNICODE_GLYPH_BASE + i] = REPACK4(simple_font.unicode.glyphs[i], src_x, src_y, src_w, src_h);
+	}
+	upload_font_textures(&simple_font, simple_font__bitmap, simple_font__bitmap_width, simple_font__bitmap_height, glyph_bounds, n_glyph_ids, simple_font.sdf_scale > 0);
+	free(glyph_bounds);
+}
+
+// The Robin Hood hash table fonts used for kerning before the class matrix. Nothing but bench_kerning uses it.
+
+constexpr u64 LEFT_PRIME  = 926153;
+constexpr u64 RIGHT_PRIME = 1698461;
+constexpr u64 INVERSE_PHI64 = 11400714819323198485ull;
+constexpr u64 ALLBITS64 = 0xFFFFffffFFFFffff;
+constexpr int PROBE_MULT = 3;
+constexpr int PROBE_SKIP = 7;
+
+static u64 hash_kern_pair(int left, int right) {
+	u64 pair = (((u64)left * LEFT_PRIME) << 32ull) + ((u64)right * RIGHT_PRIME);
+	// Xorshift64
+	pair ^= pair << 13;
+	pair ^= pair >> 7;
+	pair ^= pair << 17;
+	// The high bits are better on xorshift, so we'll reorder those to the front
+	return rotl64(pair, 32);
+}
+
+struct KernTableEntry {
+	char32_t left, right;
+	u32 probe_count;
+	i32 kern_offset;
+};
+
+struct KernHashTable {
+	KernTableEntry* table;
+	u32 capacity;
+	u32 shift;
+	u32 max_probe_count;
+};
+
+static void kern_table_insert(KernHashTable& kerning, KernPair pair) {
+	auto hash = hash_kern_pair(pair.left, pair.right);
+	auto index = (hash * INVERSE_PHI64) >> kerning.shift;
+	auto mask = ALLBITS64 >> kerning.shift;
+	u16 probe_count = 1;
+	bool stole;
+	do {
+		stole = false;
+		u16 richest = UINT16_MAX;
+		u64 richest_index = index;
+		u16 richest_my_probe_count = probe_count;
+		while (kerning.table[index].probe_count > 0) {
+			auto& cur = kerning.table[index];
+			if (cur.left == pair.left && cur.right == pair.right) {
+				cur.kern_offset = pair.kern_offset;
+				return;
+			}
+
+			if (cur.probe_count < richest) { // remember the richest guy to (maybe) steal from
+				richest = cur.probe_count;
+				richest_index = index;
+				richest_my_probe_count = probe_count;
+			}
+
+			if (probe_count > richest) {
+				// steal from the rich
+				KernTableEntry entry = {
+					(u32) pair.left, (u32) pair.right,
+					richest_my_probe_count,
+					pair.kern_offset,
+				};
+				std::swap(entry, kerning.table[richest_index]);
+				// continue on with the victim
+				pair = {
+					entry.left, entry.right,
+					entry.kern_offset
+				};
+				probe_count = entry.probe_count;
+				index = richest_index;
+				stole = true;
+			}
+
+			index += PROBE_MULT * probe_count + PROBE_SKIP;
+			index &= mask;
+			probe_count += 1;
+
+			if (probe_count > kerning.max_probe_count) {
+				kerning.max_probe_count = probe_count;
+			}
+			if (stole) break;
+		}
+	} while (stole);
+	kerning.table[index] = {
+		(u32) pair.left, (u32) pair.right,
+		probe_count,
+		pair.kern_offset,
+	};
+}
+
+static KernHashTable create_kern_hash_table(const KernPair* const kern_pairs, const unsigned int n_kern_pairs) {
+	// Get next largest power of 2 beyond a 80% load factor
+	u32 capacity = 1 << (32 - leading_zeros32(n_kern_pairs * 10 / 8));
+	u32 mask = capacity - 1;
+	auto table_data = alloc0(KernTableEntry, capacity);
+	KernHashTable out = { table_data, capacity, (u32) leading_zeros64((u64) mask), 0 };
+	for (unsigned int i = 0; i < n_kern_pairs; i++) {
+		kern_table_insert(out, kern_pairs[i]);
+	}
+	return out;
+}
+
+static int get_kern_hash_offset(const KernHashTable& kerning, char32_t left, char32_t right) {
+	if (left <= ' ' || right <= ' ') return 0;
+	auto index = (hash_kern_pair(left, right) * INVERSE_PHI64) >> kerning.shift;
+	auto mask = ALLBITS64 >> kerning.shift;
+	for (u32 probe_count = 1; probe_count <= kerning.max_probe_count; probe_count++) {
+		auto& entry = kerning.table[index];
+		if (entry.probe_count == 0) return 0;
+		if (entry.left == left && entry.right == right) return entry.kern_offset;
+		index += PROBE_MULT * probe_count + PROBE_SKIP;
+		index &= mask;
+	}
+	return 0;
+}
+
+// @console
+float bench_kerning(int rounds = 2000) {
+	// Every printable ASCII pair, shuffled so neither table gets to walk memory in order
+	constexpr int N_PAIRS = ASCII_SIZE * ASCII_SIZE;
+	auto pairs = alloc(KernPair, N_PAIRS);
+	for (int i = 0; i < N_PAIRS; i++) {
+		pairs[i] = { (char32_t) (ASCII_START + i / ASCII_SIZE), (char32_t) (ASCII_START + i % ASCII_SIZE), 0 };
+	}
+	for (int i = 0; i < simple_font__n_kern_pairs; i++) {
+		auto& pair = simple_font__kerning[i];
+		if (pair.left < ASCII_START || pair.left >= ASCII_END || pair.right < ASCII_START || pair.right >= ASCII_END) continue;
+		pairs[(pair.left - ASCII_START) * ASCII_SIZE + pair.right - ASCII_START].kern_offset = pair.kern_offset;
+	}
+	u64 rng = 0x9E3779B97F4A7C15ull;
+	for (int i = N_PAIRS - 1; i > 0; i--) {
+		rng ^= rng << 13; rng ^= rng >> 7; rng ^= rng << 17;
+		std::swap(pairs[i], pairs[rng % (i + 1)]);
+	}
+
+	// Both tables have to agree with the pair list fontsrc.py compiled the class matrix from
+	auto hash_table = create_kern_hash_table(simple_font__kerning, simple_font__n_kern_pairs);
+	for (int i = 0; i < N_PAIRS; i++) {
+		int from_matrix = get_kerning_offset(simple_font.kerning, pairs[i].left, pairs[i].right);
+		int from_hash = get_kern_hash_offset(hash_table, pairs[i].left, pairs[i].right);
+		if (from_matrix != pairs[i].kern_offset || from_hash != pairs[i].kern_offset) {
+			log_message(LOG_ERROR, "bench_kerning: '%c%c' kerns %d in the font source, but %d in the class matrix and %d in the hash table",
+				pairs[i].left, pairs[i].right, pairs[i].kern_offset, from_matrix, from_hash);
+		}
+	}
+
+	volatile int sink = 0;
+	double start = get_time();
+	for (int r = 0; r < rounds; r++) {
+		int sum = 0;
+		for (int i = 0; i < N_PAIRS; i++) sum += get_kern_hash_offset(hash_table, pairs[i].left, pairs[i].right);
+		sink += sum;
+	}
+	double hash_time = get_time() - start;
+
+	start = get_time();
+	for (int r = 0; r < rounds; r++) {
+		int sum = 0;
+		for (int i = 0; i < N_PAIRS; i++) sum += get_kerning_offset(simple_font.kerning, pairs[i].left, pairs[i].right);
+		sink += sum;
+	}
+	double class_time = get_time() - start;
+
+	double n_lookups = (double) rounds * N_PAIRS;
+	log_message(LOG_INFO, "Kerning lookups (%d pairs x %d rounds): Robin Hood hash table %.2f ns/lookup (max probe %u), class matrix %.2f ns/lookup (%u right classes)",
+		N_PAIRS, rounds, hash_time * 1e9 / n_lookups, hash_table.max_probe_count, class_time * 1e9 / n_lookups, simple_font.kerning.n_right_classes);
+
+	free(hash_table.table);
+	free(pairs);
+	return (float) (hash_time / class_time);
+}
+
+// @console
+float bench_text_measure(int labels = 5000) {
+	// UI-ish labels: a few words each, some colored, some long enough to wrap
+	static const char* const words[] = {
+		"Health", "Mana", "#c[f44]Fire#0", "Inventory", "AVAST", "quick", "brown", "fox", "Quest:", "WAVE", "to", "the", "##1",
+	};
+	constexpr int N_WORDS = sizeof(words) / sizeof(words[0]);
+	constexpr int LABEL_SIZE = 96;
+	auto text = alloc(char, (size_t) labels * LABEL_SIZE);
+	u64 rng = 0x9E3779B97F4A7C15ull;
+	for (int i = 0; i < labels; i++) {
+		char* label = text + (size_t) i * LABEL_SIZE;
+		label[0] = 0;
+		rng ^= rng << 13; rng ^= rng >> 7; rng ^= rng << 17;
+		int n_words = 1 + rng % 8;
+		for (int w = 0; w < n_words; w++) {
+			if (w) strcat(label, " ");
+			strcat(label, words[(rng >> (8 + 4 * w)) % N_WORDS]);
+		}
+	}
+	constexpr int BOX_WIDTH = 120;
+	constexpr int MAX_LINES = 16;
+	TextLine lines[MAX_LINES];
+	GlyphRenderData glyphs[LABEL_SIZE];
+
+	volatile i32 sink = 0;
+	double start = get_time();
+	for (int i = 0; i < labels; i++) sink += measure_text(&simple_font, text + (size_t) i * LABEL_SIZE).width;
+	double measure_time = get_time() - start;
+
+	start = get_time();
+	for (int i = 0; i < labels; i++) sink += wrap_text(&simple_font, text + (size_t) i * LABEL_SIZE, BOX_WIDTH, lines, MAX_LINES);
+	double wrap_time = get_time() - start;
+
+	start = get_time();
+	for (int i = 0; i < labels; i++) sink += print_glyphs(&simple_font, glyphs, LABEL_SIZE, text + (size_t) i * LABEL_SIZE, 0, 0);
+	double print_time = get_time() - start;
+
+	log_message(LOG_INFO, "Text layout (%d labels): measure_text %.3f ms (%.0f ns/label), wrap_text (%dpx) %.3f ms (%.0f ns/label), print_glyphs %.3f ms (%.0f ns/label)",
+		labels, measure_time * 1e3, measure_time * 1e9 / labels, BOX_WIDTH, wrap_time * 1e3, wrap_time * 1e9 / labels, print_time * 1e3, print_time * 1e9 / labels);
+
+	free(text);
+	return (float) (measure_time * 1e3);
+}
+
+
+// Binary fonts (written by `fontsrc.py -f binary`)
+// Everything in the file is laid out ready to use: the bitmap and glyph bounds go straight to GL and the
+// codepoint map and kerning tables are used in place, so loading amounts to mapping the file and checking that the offsets make sense.
+
+constexpr u16 FONT_FILE_VERSION = 3;
+
+struct FontFileHeader {
+	char magic[4]; // "FONT"
+	u16 version;
+	u8 sdf_scale; // 0 for bitmap fonts
+	u8 sdf_padding;
+	i32 space_width, line_height;
+	i32 bitmap_width, bitmap_height;
+	u32 n_glyph_ids; // rows in the bounds table
+	u32 n_unicode_glyphs;
+	u32 glyph_map_shift;
+	u32 glyph_map_max_probe_count;
+	u32 n_kern_left_classes;
+	u32 n_kern_right_classes;
+	u32 bitmap_offset;
+	u32 bounds_offset; // GlyphBounds[n_glyph_ids]
+	u32 glyph_map_offset; // GlyphMapEntry[1 << (32 - glyph_map_shift)]
+	u32 unicode_glyphs_offset; // GlyphData[n_unicode_glyphs]
+	u32 kern_classes_offset; // u8[KERN_CLASS_RANGE] left classes, then u8[KERN_CLASS_RANGE] right classes
+	u32 kern_matrix_offset; // i8[n_kern_left_classes * n_kern_right_classes]
+	GlyphData ascii_glyphs[ASCII_SIZE];
+	i32 cursor[6];
+};
+static_assert(sizeof(FontFileHeader) == 72 + sizeof(GlyphData) * ASCII_SIZE + sizeof(i32) * 6, "FontFileHeader must not be padded");
+static_assert(sizeof(GlyphData) == 7 * sizeof(i32) && sizeof(GlyphMapEntry) == 8, "font file records must match the on-disk layout");
+
+static bool font_section_ok(const MappedFile& file, u32 offset, u64 size) {
+	return offset % 4 == 0 && offset >= sizeof(FontFileHeader) && offset + size <= file.size;
+}
+
+Font* prepare_font(const char* filename) {
+	MappedFile file;
+	if (!map_file(filename, &file)) {
+		ERR_LOG("Unable to open font file %s", filename);
+		return nullptr;
+	}
+	auto header = (const FontFileHeader*) file.data;
+	if (file.size < sizeof(FontFileHeader) || memcmp(header->magic, "FONT", 4) != 0) {
+		ERR_LOG("%s is not a font file", filename);
+		unmap_file(&file);
+		return nullptr;
+	}
+	if (header->version != FONT_FILE_VERSION) {
+		ERR_LOG("%s is font format version %d; expected %d", filename, header->version, FONT_FILE_VERSION);
+		unmap_file(&file);
+		return nullptr;
+	}
+	u64 n_map_slots = header->glyph_map_shift >= 1 && header->glyph_map_shift <= 31 ? 1ull << (32 - header->glyph_map_shift) : 0;
+	if (
+		header->bitmap_width <= 0 || header->bitmap_height <= 0
+		|| header->n_glyph_ids != UNICODE_GLYPH_BASE + header->n_unicode_glyphs
+		|| (header->n_unicode_glyphs > 0 && n_map_slots < header->n_unicode_glyphs)
+		|| !font_section_ok(file, header->bitmap_offset, (u64) header->bitmap_width * header->bitmap_height)
+		|| !font_section_ok(file, header->bounds_offset, sizeof(GlyphBounds) * (u64) header->n_glyph_ids)
+		|| !font_section_ok(file, header->glyph_map_offset, sizeof(GlyphMapEntry) * n_map_slots)
+		|| !font_section_ok(file, header->unicode_glyphs_offset, sizeof(GlyphData) * (u64) header->n_unicode_glyphs)
+		|| header->n_kern_left_classes == 0 || header->n_kern_left_classes > 256
+		|| header->n_kern_right_classes == 0 || header->n_kern_right_classes > 256
+		|| !font_section_ok(file, header->kern_classes_offset, 2 * KERN_CLASS_RANGE)
+		|| !font_section_ok(file, header->kern_matrix_offset, (u64) header->n_kern_left_classes * header->n_kern_right_classes)
+	) {
+		ERR_LOG("Font file %s is truncated or corrupt", filename);
+		unmap_file(&file);
+		return nullptr;
+	}
+
+	// Glyph ids index the unicode glyphs directly, so every one has to be in range
+	if (header->n_unicode_glyphs > 0) {
+		auto map_slots = (const GlyphMapEntry*) (file.data + header->glyph_map_offset);
+		for (u64 i = 0; i < n_map_slots; i++) {
+			if (map_slots[i].codepoint == 0) continue;
+			if (map_slots[i].glyph_id < UNICODE_GLYPH_BASE || map_slots[i].glyph_id - UNICODE_GLYPH_BASE >= header->n_unicode_glyphs) {
+				ERR_LOG("Font file %s maps U+%04X to glyph %u, which it doesn't have", filename, (u32) map_slots[i].codepoint, map_slots[i].glyph_id);
+				unmap_file(&file);
+				return nullptr;
+			}
+		}
+	}
+
+	auto classes = file.data + header->kern_classes_offset;
+	for (int i = 0; i < KERN_CLASS_RANGE; i++) {
+		if (classes[i] >= header->n_kern_left_classes || classes[KERN_CLASS_RANGE + i] >= header->n_kern_right_classes) {
+			ERR_LOG("Font file %s has an out of range kerning class", filename);
+			unmap_file(&file);
+			return nullptr;
+		}
+	}
+
+	auto font = new Font();
+	font->glyph_table_buffer = 0;
+	memcpy(font->ascii_glyphs, header->ascii_glyphs, sizeof(font->ascii_glyphs));
+	font->cursor = { header->cursor[0], header->cursor[1], header->cursor[2], header->cursor[3], header->cursor[4], header->cursor[5] };
+	font->space_width = header->space_width;
+	font->line_height = header->line_height;
+	font->sdf_scale = header->sdf_scale;
+	font->sdf_padding = header->sdf_padding;
+	if (header->n_unicode_glyphs > 0) {
+		font->unicode = {
+			(GlyphMapEntry*) (file.data + header->glyph_map_offset),
+			(GlyphData*) (file.data + header->unicode_glyphs_offset),
+			header->glyph_map_shift,
+			header->glyph_map_max_probe_count,
+			header->n_unicode_glyphs,
+		};
+	}
+	font->kerning = {
+		file.data + header->kern_classes_offset,
+		file.data + header->kern_classes_offset + KERN_CLASS_RANGE,
+		(const i8*) (file.data + header->kern_matrix_offset),
+		header->n_kern_right_classes,
+	};
+	font->file = file;
+	return font;
+}
+
+bool upload_font(Font* font) {
+	auto header = (const FontFileHeader*) font->file.data;
+	if (header == nullptr || font->glyph_atlas != nullptr) return false;
+	upload_font_textures(
+		font,
+		font->file.data + header->bitmap_offset, header->bitmap_width, header->bitmap_height,
+		(const GlyphBounds*) (font->file.data + header->bounds_offset), header->n_glyph_ids,
+		font->sdf_scale > 0
+	);
+	return true;
+}
+
+Font* load_font(const char* filename) {
+	auto font = prepare_font(filename);
+	if (font) upload_font(font);
+	return font;
+}
+
+void free_font(Font* font) {
+	assert(font->file.data != nullptr && "only fonts from load_font/prepare_font can be freed");
+	if (font->glyph_atlas) free_texture(font->glyph_atlas);
+	if (font->glyph_table) free_texture(font->glyph_table);
+	if (font->glyph_table_buffer) glDeleteBuffers(1, &font->glyph_table_buffer);
+	unmap_file(&font->file);
+	delete font;
+}
+
+// Layout cache
+// Most text is identical from frame to frame, so finished glyph runs are kept around and looked up by content.
+// Runs are stored relative to the origin so that moving labels still hit.
+
+constexpr int LAYOUT_CACHE_MAX_GLYPHS = 1024; // longest run that will be laid out
+
+struct TextLayoutEntry {
+	u64 hash;
+	u32 font_id; // not the font's address, which a font loaded after it's freed could reuse
+	u32 salt; // anything outside of the text that affects the layout
+	char* text;
+	GlyphRenderData* glyphs;
+	i32 n_glyphs;
+	i32 glyph_capacity;
+	i32 text_capacity;
+	i32 lru_prev, lru_next; // towards the most / least recently used entries
+};
+
+struct TextLayoutCache {
+	TextLayoutEntry* entries;
+	i32* slots; // open addressing (linear probing) into entries; -1 is empty
+	u32 slot_mask;
+	i32 capacity;
+	i32 count;
+	i32 lru_head, lru_tail; // most / least recently used
+	GlyphRenderData* scratch;
+	TextCacheStats stats;
+};
 
-	//kern_hash_func_analysis();
+TextLayoutCache* make_text_layout_cache(int capacity) {
+	u32 n_slots = 16;
+	while (n_slots < (u32) capacity * 2) n_slots <<= 1; // keep the load factor at or under 50%
+	auto cache = new TextLayoutCache;
+	cache->entries = alloc0(TextLayoutEntry, capacity);
+	cache->slots = alloc(i32, n_slots);
+	memset(cache->slots, 0xFF, sizeof(i32) * n_slots);
+	cache->slot_mask = n_slots - 1;
+	cache->capacity = capacity;
+	cache->count = 0;
+	cache->lru_head = cache->lru_tail = -1;
+	cache->scratch = alloc(GlyphRenderData, LAYOUT_CACHE_MAX_GLYPHS);
+	cache->stats = {};
+	return cache;
+}
+
+void free_text_layout_cache(TextLayoutCache* cache) {
+	for (int i = 0; i < cache->count; i++) {
+		free(cache->entries[i].text);
+		free(cache->entries[i].glyphs);
+	}
+	free(cache->entries);
+	free(cache->slots);
+	free(cache->scratch);
+	delete cache;
+}
+
+static u64 hash_text(const Font* font, const char* text, u32 salt) {
+	// FNV-1a
+	u64 hash = 14695981039346656037ull ^ font->id ^ ((u64) salt << 32);
+	for (const char* c = text; *c; c++) {
+		hash ^= (u8) *c;
+		hash *= 1099511628211ull;
+	}
+	return hash;
+}
+
+static void lru_unlink(TextLayoutCache* cache, i32 index) {
+	auto& e = cache->entries[index];
+	if (e.lru_prev >= 0) cache->entries[e.lru_prev].lru_next = e.lru_next;
+	else cache->lru_head = e.lru_next;
+	if (e.lru_next >= 0) cache->entries[e.lru_next].lru_prev = e.lru_prev;
+	else cache->lru_tail = e.lru_prev;
+}
+
+static void lru_push_front(TextLayoutCache* cache, i32 index) {
+	auto& e = cache->entries[index];
+	e.lru_prev = -1;
+	e.lru_next = cache->lru_head;
+	if (cache->lru_head >= 0) cache->entries[cache->lru_head].lru_prev = index;
+	cache->lru_head = index;
+	if (cache->lru_tail < 0) cache->lru_tail = index;
+}
+
+static void remove_slot(TextLayoutCache* cache, u32 slot) {
+	// Backward shift deletion, so no tombstones are needed
+	u32 mask = cache->slot_mask;
+	u32 hole = slot;
+	for (u32 i = (slot + 1) & mask; cache->slots[i] >= 0; i = (i + 1) & mask) {
+		u32 home = cache->entries[cache->slots[i]].hash & mask;
+		if (((i - home) & mask) >= ((i - hole) & mask)) {
+			cache->slots[hole] = cache->slots[i];
+			hole = i;
+		}
+	}
+	cache->slots[hole] = -1;
+}
+
+static i32 evict_lru(TextLayoutCache* cache) {
+	i32 victim = cache->lru_tail;
+	assert(victim >= 0);
+	u32 slot = cache->entries[victim].hash & cache->slot_mask;
+	while (cache->slots[slot] != victim) slot = (slot + 1) & cache->slot_mask;
+	remove_slot(cache, slot);
+	lru_unlink(cache, victim);
+	cache->stats.evictions++;
+	return victim;
+}
+
+int layout_text_cached(TextLayoutCache* cache, const Font* font, const char* text, const GlyphRenderData** glyphs) {
+	u32 salt = text[0] == TEXT_CURSOR ? cursor_color : 0;
+	if (font->atlas) salt ^= font->atlas->generation * INVERSE_PHI32; // evictions invalidate cached layouts
+	u64 hash = hash_text(font, text, salt);
+	u32 slot = hash & cache->slot_mask;
+	for (i32 index; (index = cache->slots[slot]) >= 0; slot = (slot + 1) & cache->slot_mask) {
+		auto& e = cache->entries[index];
+		if (e.hash == hash && e.font_id == font->id && e.salt == salt && strcmp(e.text, text) == 0) {
+			if (cache->lru_head != index) {
+				lru_unlink(cache, index);
+				lru_push_front(cache, index);
+			}
+			cache->stats.hits++;
+			*glyphs = e.glyphs;
+			return e.n_glyphs;
+		}
+	}
+
+	// Miss: lay it out and take over an entry
+	cache->stats.misses++;
+	int n_glyphs = print_glyphs(font, cache->scratch, LAYOUT_CACHE_MAX_GLYPHS, text, 0.f, 0.f);
+	if (n_glyphs < 0) n_glyphs = 0; // cache failures too, so a bad string doesn't re-log every frame
+
+	i32 index;
+	if (cache->count < cache->capacity) {
+		index = cache->count++;
+	}
+	else {
+		index = evict_lru(cache);
+		// eviction may have shifted our empty slot
+		slot = hash & cache->slot_mask;
+		while (cache->slots[slot] >= 0) slot = (slot + 1) & cache->slot_mask;
+	}
+	auto& e = cache->entries[index];
+	int text_len = (int) strlen(text) + 1;
+	if (text_len > e.text_capacity) {
+		e.text = (char*) realloc(e.text, text_len);
+		e.text_capacity = text_len;
+	}
+	memcpy(e.text, text, text_len);
+	if (n_glyphs > e.glyph_capacity) {
+		e.glyphs = (GlyphRenderData*) realloc(e.glyphs, sizeof(GlyphRenderData) * n_glyphs);
+		e.glyph_capacity = n_glyphs;
+	}
+	memcpy(e.glyphs, cache->scratch, sizeof(GlyphRenderData) * n_glyphs);
+	e.hash = hash;
+	e.font_id = font->id;
+	e.salt = salt;
+	e.n_glyphs = n_glyphs;
+	cache->slots[slot] = index;
+	lru_push_front(cache, index);
+
+	*glyphs = e.glyphs;
+	return n_glyphs;
+}
+
+int print_glyphs_cached(TextLayoutCache* cache, const Font* font, GlyphRenderData* const buffer, size_t buf_size, const char* text, float x, float y, float scale) {
+	const GlyphRenderData* run;
+	int n_glyphs = layout_text_cached(cache, font, text, &run);
+	if (font->atlas) touch_atlas_glyphs(font->atlas, run, n_glyphs);
+	if ((size_t) n_glyphs > buf_size) {
+		ERR_LOG("WARNING: Unable to render the text \"%s\" with only %zd glyphs.", text, buf_size);
+		n_glyphs = buf_size;
+	}
+	for (int i = 0; i < n_glyphs; i++) {
+		buffer[i] = { run[i].x * scale + x, run[i].y * scale + y, run[i].glyph_id, run[i].rgba };
+	}
+	return n_glyphs;
+}
+
+TextCacheStats get_text_cache_stats(const TextLayoutCache* cache) {
+	return cache->stats;
+}
+
+
+// Parallel layout
+// The runs are split into contiguous chunks, one per worker, and each chunk is laid out into its own buffer.
+// A prefix sum over the run lengths then gives every run its place in the output, and the chunks copy themselves over.
+// A chunk's buffer is as big as the whole output, so a chunk can only run out of room where the output already has.
+
+constexpr int PARALLEL_TEXT_MIN_CHUNK = 8; // runs; below this, waking up another thread costs more than it saves
+
+struct ParallelTextChunk {
+	GlyphRenderData* glyphs;
+	TextLayoutCache* cache;
+	int first_run, end_run;
+};
+
+struct ParallelTextLayout {
+	WorkerPool* pool;
+	ParallelTextChunk* chunks;
+	int n_chunks_max;
+	int max_glyphs;
+	GlyphRenderData* serial_glyphs; // runs in dynamic fonts
+
+	// the current call
+	const TextRun* runs;
+	GlyphRenderData* buffer;
+	const GlyphRenderData** run_glyphs; // where each run was laid out
+	int* run_offsets; // where each run goes in the output
+	int* counts;
+	int max_runs;
+};
+
+ParallelTextLayout* make_parallel_text_layout(WorkerPool* pool, int max_glyphs, int cache_capacity) {
+	auto layout = new ParallelTextLayout;
+	layout->pool = pool;
+	layout->n_chunks_max = get_worker_count(pool);
+	layout->chunks = alloc(ParallelTextChunk, layout->n_chunks_max);
+	for (int i = 0; i < layout->n_chunks_max; i++) {
+		layout->chunks[i].glyphs = alloc(GlyphRenderData, max_glyphs);
+		layout->chunks[i].cache = make_text_layout_cache(cache_capacity);
+	}
+	layout->max_glyphs = max_glyphs;
+	layout->serial_glyphs = alloc(GlyphRenderData, max_glyphs);
+	layout->run_glyphs = nullptr;
+	layout->run_offsets = nullptr;
+	layout->max_runs = 0;
+	return layout;
+}
+
+void free_parallel_text_layout(ParallelTextLayout* layout) {
+	for (int i = 0; i < layout->n_chunks_max; i++) {
+		free(layout->chunks[i].glyphs);
+		free_text_layout_cache(layout->chunks[i].cache);
+	}
+	free(layout->chunks);
+	free(layout->serial_glyphs);
+	free(layout->run_glyphs);
+	free(layout->run_offsets);
+	delete layout;
+}
+
+static void lay_out_chunk(void* user, int index) {
+	auto layout = (ParallelTextLayout*) user;
+	auto& chunk = layout->chunks[index];
+	int n_glyphs = 0;
+	for (int i = chunk.first_run; i < chunk.end_run; i++) {
+		const auto& run = layout->runs[i];
+		if (run.font->atlas) continue; // already done on the calling thread
+		int count = print_glyphs_cached(chunk.cache, run.font, chunk.glyphs + n_glyphs, layout->max_glyphs - n_glyphs, run.text, run.x, run.y, run.scale);
+		layout->run_glyphs[i] = chunk.glyphs + n_glyphs;
+		layout->counts[i] = count;
+		n_glyphs += count;
+	}
+}
+
+static void copy_chunk(void* user, int index) {
+	auto layout = (ParallelTextLayout*) user;
+	const auto& chunk = layout->chunks[index];
+	for (int i = chunk.first_run; i < chunk.end_run; i++) {
+		memcpy(layout->buffer + layout->run_offsets[i], layout->run_glyphs[i], sizeof(GlyphRenderData) * layout->counts[i]);
+	}
+}
+
+// Leaves the buffer as it was if it can't grow, so the old size is still usable
+template <typename T>
+static bool grow_buffer(T** buffer, size_t n) {
+	T* grown = (T*) realloc(*buffer, sizeof(T) * n);
+	if (!grown) return false;
+	*buffer = grown;
+	return true;
+}
+
+int print_glyphs_parallel(ParallelTextLayout* layout, TextLayoutCache* serial_cache, const TextRun* runs, int n_runs, GlyphRenderData* const buffer, size_t buf_size, int* counts) {
+	if (n_runs <= 0) return 0;
+	bool grown = true;
+	if (n_runs > layout->max_runs) {
+		grown = grow_buffer(&layout->run_glyphs, n_runs) && grow_buffer(&layout->run_offsets, n_runs);
+		if (grown) layout->max_runs = n_runs;
+	}
+	if (grown && buf_size > (size_t) layout->max_glyphs) {
+		// Each worker might end up with all of it
+		for (int i = 0; grown && i < layout->n_chunks_max; i++) {
+			grown = grow_buffer(&layout->chunks[i].glyphs, buf_size);
+		}
+		grown = grown && grow_buffer(&layout->serial_glyphs, buf_size);
+		if (grown) layout->max_glyphs = (int) buf_size;
+	}
+	if (!grown) {
+		ERR_LOG("Out of memory laying out %d text runs (%zu glyphs)", n_runs, buf_size);
+		memset(counts, 0, sizeof(int) * n_runs);
+		return 0;
+	}
+	layout->runs = runs;
+	layout->buffer = buffer;
+	layout->counts = counts;
+
+	int n_chunks = clamp(n_runs / PARALLEL_TEXT_MIN_CHUNK, 1, layout->n_chunks_max);
+	for (int c = 0; c < n_chunks; c++) {
+		layout->chunks[c].first_run = (int) ((i64) n_runs * c / n_chunks);
+		layout->chunks[c].end_run = (int) ((i64) n_runs * (c + 1) / n_chunks);
+	}
+
+	// Dynamic fonts touch the atlas (and OpenGL), so they stay on this thread
+	int serial_glyphs = 0;
+	for (int i = 0; i < n_runs; i++) {
+		const auto& run = runs[i];
+		if (!run.font->atlas) continue;
+		int count = print_glyphs_cached(serial_cache, run.font, layout->serial_glyphs + serial_glyphs, layout->max_glyphs - serial_glyphs, run.text, run.x, run.y, run.scale);
+		layout->run_glyphs[i] = layout->serial_glyphs + serial_glyphs;
+		counts[i] = count;
+		serial_glyphs += count;
+	}
+
+	run_jobs(layout->pool, lay_out_chunk, layout, n_chunks);
+
+	// Prefix sum; anything past buf_size is cut off just like print_glyphs_cached would have
+	int n_glyphs = 0;
+	for (int i = 0; i < n_runs; i++) {
+		int count = min(counts[i], (int) buf_size - n_glyphs);
+		if (count < counts[i]) {
+			ERR_LOG("WARNING: Unable to render the text \"%s\" with only %d glyphs.", runs[i].text, (int) buf_size - n_glyphs);
+		}
+		counts[i] = count;
+		layout->run_offsets[i] = n_glyphs;
+		n_glyphs += count;
+	}
+	run_jobs(layout->pool, copy_chunk, layout, n_chunks);
+	return n_glyphs;
 }
@@ -15,13 +15,103 @@ struct FontDims {
 	i32 line_height;
 };
 
+/// Distance field fonts (fontsrc.py --sdf) stay sharp at any scale. scale is 0 for bitmap fonts.
+struct FontSdf {
+	i32 scale; // atlas texels per font pixel
+	i32 padding; // atlas texels around each glyph
+};
+
+/// Decode one UTF-8 sequence and advance past it. Malformed input decodes to U+FFFD and consumes at least one byte.
+char32_t decode_utf8(const char** text);
+/// Length of the all-ASCII prefix of text, stopping at the first non-ASCII byte or the terminator.
+/// Reads at most length bytes, 16 at a time while it can.
+size_t ascii_prefix_length(const char* text, size_t length);
+
 int print_glyphs(const Font* font, GlyphRenderData* const buffer, size_t buf_size, const char* text, float x, float y);
+/// Same as print_glyphs, but word-wraps to lines no wider than max_width
+int print_glyphs_wrapped(const Font* font, GlyphRenderData* const buffer, size_t buf_size, const char* text, float x, float y, i32 max_width);
+
+struct TextExtents {
+	i32 width, height;
+	int n_lines; // -1 if the text has a bad control code
+};
+struct TextLine {
+	int start, end; // byte range in the text; end stops before the whitespace or newline that broke the line
+	i32 width;
+};
+/// The box print_glyphs (or print_glyphs_wrapped, for max_width > 0) would fill, without producing any glyphs
+TextExtents measure_text(const Font* font, const char* text, i32 max_width = 0);
+/// Break text into lines no wider than max_width, or only at newlines if max_width <= 0. Long words are broken mid-word.
+/// Writes up to max_lines lines and returns how many there are in total, or -1 if the text has a bad control code.
+int wrap_text(const Font* font, const char* text, i32 max_width, TextLine* lines, int max_lines);
+
+struct TextLayoutCache;
+struct TextCacheStats {
+	u64 hits, misses, evictions;
+};
+TextLayoutCache* make_text_layout_cache(int capacity);
+void free_text_layout_cache(TextLayoutCache* cache);
+/// Lay out text through an LRU cache. The run is relative to (0, 0) and stays valid until the next call on this cache.
+int layout_text_cached(TextLayoutCache* cache, const Font* font, const char* text, const GlyphRenderData** glyphs);
+/// Same as print_glyphs, but reuses the cached layout when the text was seen recently.
+/// scale spreads the glyphs out for text that will be drawn bigger or smaller than the font's size.
+int print_glyphs_cached(TextLayoutCache* cache, const Font* font, GlyphRenderData* const buffer, size_t buf_size, const char* text, float x, float y, float scale = 1.f);
+TextCacheStats get_text_cache_stats(const TextLayoutCache* cache);
+
+struct WorkerPool;
+struct TextRun {
+	const Font* font;
+	const char* text;
+	float x, y;
+	float scale;
+};
+struct ParallelTextLayout;
+/// Per-worker glyph buffers and layout caches for print_glyphs_parallel. The buffers grow to fit the largest buf_size asked for.
+ParallelTextLayout* make_parallel_text_layout(WorkerPool* pool, int max_glyphs, int cache_capacity);
+void free_parallel_text_layout(ParallelTextLayout* layout);
+/// Lay out the runs on the worker pool. The output is the same as calling print_glyphs_cached on each run in turn,
+/// packing them into buffer; counts[i] gets how many glyphs run i ended up with. Returns the total.
+/// Dynamic fonts rasterize as they lay out, so their runs are done on the calling thread with serial_cache.
+/// If the buffers can't grow to fit, nothing is laid out: every count is 0.
+int print_glyphs_parallel(ParallelTextLayout* layout, TextLayoutCache* serial_cache, const TextRun* runs, int n_runs, GlyphRenderData* const buffer, size_t buf_size, int* counts);
+/// One rasterized glyph: 8-bit coverage, pitch bytes per row. The pixels only need to stay valid until the rasterizer returns again.
+struct GlyphBitmap {
+	i32 width, height, pitch;
+	const u8* pixels;
+	i32 advance, offset_x, offset_y;
+};
+/// Produces glyphs for a dynamic font on demand. Returns false if the font has no glyph for the codepoint.
+typedef bool (*GlyphRasterizer)(void* user, char32_t codepoint, GlyphBitmap* out);
+struct GlyphAtlasStats {
+	u32 resident_glyphs, pages_in_use, max_pages;
+	u64 rasterized, evicted_pages;
+};
+/// Make a font whose glyphs are rasterized the first time they are printed, for character sets too big to bake.
+/// The atlas holds at most atlas_budget bytes of page_size x page_size pages; the least recently used page is evicted when it fills up.
+Font* make_dynamic_font(GlyphRasterizer rasterize, void* user, i32 space_width, i32 line_height, size_t atlas_budget, i32 page_size = 512);
+void free_dynamic_font(Font* font);
+GlyphAtlasStats get_glyph_atlas_stats(const Font* font);
+/// Marks the start of a frame's text layout. Atlas pages used since the last call won't be evicted.
+void begin_text_frame();
+
+/// Load a font converted with `fontsrc.py -f binary`. The file stays mapped for as long as the font is loaded.
+Font* load_font(const char* filename);
+/// First half of load_font: maps and validates the file without touching OpenGL, so it can run on any thread.
+Font* prepare_font(const char* filename);
+/// Second half of load_font: creates the font's textures. Call on the render thread.
+bool upload_font(Font* font);
+void free_font(Font* font);
+
 FontDims get_font_dimensions(const Font& font);
+FontSdf get_font_sdf(const Font& font);
 int bind_font_glyph_atlas(Font& font, int slot = 0);
 int bind_font_glyph_table(Font& font, int slot = 0);
 
+extern Font simple_font;
 void init_simple_font();
 
+/// Text that starts with TEXT_CURSOR, a byte offset and TEXT_CURSOR_END gets a cursor drawn before that byte of the rest
 constexpr char TEXT_CURSOR      = '\01';
 constexpr char TEXT_CURSOR_END  = '\02';
-constexpr int TEXT_CURSOR_RADIX = 10;
\ No newline at end of file
+constexpr int TEXT_CURSOR_RADIX = 10;
+constexpr char32_t REPLACEMENT_CHARACTER = 0xFFFD;
\ No newline at end of file
@@ -2,9 +2,13 @@
 #include <glfw3.h>
 #include <cstdio>
 #include <cassert>
+#include <cstring>
+#include <algorithm>
 
 #include "texture.h"
 #include "stb_image.h"
+#include "hotreload.h"
+#include "stats.h"
 
 static uint32_t bindingNumber = 0;
 
@@ -75,6 +79,7 @@ struct Texture {
 		boundTextures[slot] = { this, bindingNumber++, 1 };
 		glActiveTexture(GL_TEXTURE0 + slot);
 		glBindTexture(gl_type, tex_handle);
+		count_stat(STAT_TEXTURE_BINDS);
 		return slot;
 	}
 
@@ -92,61 +97,223 @@ Texture* make_texture(GLuint tex, GLenum type) {
 	return new Texture(tex, type);
 }
 
+void free_texture(Texture* tex) {
+	if (tex->bound_slot >= 0) tex->evict();
+	glDeleteTextures(1, &tex->tex_handle);
+	delete tex;
+}
+
+// Color index images are kept at 2 bits per pixel (4 pixels per byte, leftmost pixel in the low bits)
+// both on disk and in VRAM. The shaders only ever look at the bottom two bits of an index, so nothing is lost.
+
+constexpr char PACKED_MAGIC[4] = { '2', 'B', 'P', 'P' };
+constexpr u16 PACKED_VERSION = 1;
+// Beyond what any GL 3.3 driver will take in a texture array, and small enough that sizes can't overflow
+constexpr u32 MAX_PACKED_DIMENSION = 16384;
+constexpr u32 MAX_PACKED_LAYERS = 2048;
+
+struct PackedImageHeader {
+	char magic[4];
+	u16 version;
+	u16 reserved;
+	u32 width, height, layers; // in pixels, not bytes
+};
+
+struct PackedImage {
+	int width, height, layers;
+	unsigned char* data;
+};
+
+static inline int packed_row_size(int width) {
+	return (width + 3) / 4;
+}
+
+static inline size_t packed_size(int width, int height, int layers) {
+	return (size_t) packed_row_size(width) * height * layers;
+}
+
+static unsigned char* pack_2bpp(const unsigned char* indices, int width, int height, int layers) {
+	int row_size = packed_row_size(width);
+	unsigned char* packed = new unsigned char[packed_size(width, height, layers)]();
+	for (int row = 0; row < height * layers; row++) {
+		const unsigned char* src = indices + row * width;
+		unsigned char* dest = packed + row * row_size;
+		for (int x = 0; x < width; x++) {
+			dest[x >> 2] |= (src[x] & 3) << ((x & 3) * 2);
+		}
+	}
+	return packed;
+}
+
+/// Returns false if the file isn't in the packed format (or can't be read)
+static bool read_packed_file(const char* filename, PackedImage* out) {
+	FILE* file = fopen(filename, "rb");
+	if (!file) return false;
+	PackedImageHeader header;
+	if (fread(&header, sizeof(header), 1, file) != 1 || memcmp(header.magic, PACKED_MAGIC, 4) != 0) {
+		fclose(file);
+		return false;
+	}
+	if (header.version != PACKED_VERSION) {
+		ERR_LOG("'%s' has unsupported packed image version %d", filename, header.version);
+		fclose(file);
+		return false;
+	}
+	if (header.width == 0 || header.height == 0 || header.layers == 0
+		|| header.width > MAX_PACKED_DIMENSION || header.height > MAX_PACKED_DIMENSION || header.layers > MAX_PACKED_LAYERS) {
+		ERR_LOG("'%s' has invalid dimensions %ux%ux%u", filename, header.width, header.height, header.layers);
+		fclose(file);
+		return false;
+	}
+	// Check the file actually holds the payload the header claims before allocating for it
+	size_t size = packed_size(header.width, header.height, header.layers);
+	long payload_start = ftell(file);
+	if (payload_start < 0 || fseek(file, 0, SEEK_END) != 0) {
+		fclose(file);
+		return false;
+	}
+	long file_size = ftell(file);
+	if (file_size < payload_start || (size_t) (file_size - payload_start) < size) {
+		ERR_LOG("'%s' is truncated", filename);
+		fclose(file);
+		return false;
+	}
+	fseek(file, payload_start, SEEK_SET);
+	unsigned char* data = new unsigned char[size];
+	if (fread(data, 1, size, file) != size) {
+		ERR_LOG("'%s' is truncated", filename);
+		delete[] data;
+		fclose(file);
+		return false;
+	}
+	fclose(file);
+	*out = { (int) header.width, (int) header.height, (int) header.layers, data };
+	return true;
+}
+
+static bool write_packed_file(const char* filename, const PackedImage& image) {
+	FILE* file = fopen(filename, "wb");
+	if (!file) return false;
+	PackedImageHeader header = {
+		{ PACKED_MAGIC[0], PACKED_MAGIC[1], PACKED_MAGIC[2], PACKED_MAGIC[3] },
+		PACKED_VERSION, 0,
+		(u32) image.width, (u32) image.height, (u32) image.layers
+	};
+	size_t size = packed_size(image.width, image.height, image.layers);
+	bool ok = fwrite(&header, sizeof(header), 1, file) == 1 && fwrite(image.data, 1, size, file) == size;
+	fclose(file);
+	return ok;
+}
+
+/// Upload packed index data as a texture array. data may be null to just reserve the memory.
+static GLuint create_index_array(int width, int height, int layers, const unsigned char* packed, GLint wrap) {
+	GLuint tex_handle;
+	glGenTextures(1, &tex_handle);
+	glBindTexture(GL_TEXTURE_2D_ARRAY, tex_handle);
+
+	glPixelStorei(GL_UNPACK_ALIGNMENT, 1); // packed rows are rarely a multiple of 4 bytes
+	glTexImage3D(GL_TEXTURE_2D_ARRAY, 0, GL_R8UI, packed_row_size(width), height, layers, 0, GL_RED_INTEGER, GL_UNSIGNED_BYTE, packed);
+	count_stat(STAT_TEXTURE_UPLOAD_BYTES, packed_size(width, height, layers));
+
+	glTexParameteri(GL_TEXTURE_2D_ARRAY, GL_TEXTURE_MIN_FILTER, GL_NEAREST);
+	glTexParameteri(GL_TEXTURE_2D_ARRAY, GL_TEXTURE_MAG_FILTER, GL_NEAREST);
+	glTexParameteri(GL_TEXTURE_2D_ARRAY, GL_TEXTURE_MAX_LEVEL, 0);
+	glTexParameteri(GL_TEXTURE_2D_ARRAY, GL_TEXTURE_WRAP_S, wrap);
+	glTexParameteri(GL_TEXTURE_2D_ARRAY, GL_TEXTURE_WRAP_T, wrap);
+	return tex_handle;
+}
+
+// Only the red channel is used as a color index
+static unsigned char* extract_color_indices(const unsigned char* image_data, int width, int height, int n_channels, int dest_width, int dest_height) {
+	unsigned char* index_data = new unsigned char[dest_width * dest_height]();
+	for (int y = 0; y < height; y++) {
+		for (int x = 0; x < width; x++) {
+			index_data[y * dest_width + x] = image_data[(y * width + x) * n_channels];
+		}
+	}
+	return index_data;
+}
+
 struct Tileset {
 	Texture tex;
+	// Kept around for reloading
+	char* source_file;
+	i32 tile_size, offset_x, offset_y, spacing_x, spacing_y;
 };
 
-Tileset* load_tileset(const char* image_file, int tile_size, int offset_x, int offset_y, int spacing_x, int spacing_y) {
+static bool slice_tileset(const char* image_file, PackedImage* out, int tile_size, int offset_x, int offset_y, int spacing_x, int spacing_y) {
 	stbi_set_flip_vertically_on_load(false);
 	int width, height, n_channels;
 	unsigned char *image_data = stbi_load(image_file, &width, &height, &n_channels, 0);
-
-	if (image_data) {
-		int tiles_horiz = (width - offset_x + spacing_x) / (tile_size + spacing_x);
-		int tiles_vert = (height - offset_y + spacing_x) / (tile_size + spacing_y);
-		unsigned char* tile_data = new unsigned char[tiles_horiz * tiles_vert * width * height];
-		unsigned char* data_ptr = tile_data;
-		for (int top = offset_y; top + tile_size <= height; top += tile_size + spacing_y) { // row major tile iteration
-			for (int left = offset_x; left + tile_size <= width; left += tile_size + spacing_x) {
-				// for each tile...
-				for (int y = 0; y < tile_size; y++) {
-					for (int x = 0; x < tile_size; x++) {
-						*data_ptr++ = image_data[
-							((top + y) * width + (left + x)) * n_channels
-						];
-						/*if (data_ptr[-1]) {
-							printf("%d ", data_ptr[-1] % 4);
-						}
-						else { printf(". "); }*/
-					}
-					//printf("\n");
+	if (!image_data) return false;
+
+	int tiles_horiz = (width - offset_x + spacing_x) / (tile_size + spacing_x);
+	int tiles_vert = (height - offset_y + spacing_y) / (tile_size + spacing_y);
+	unsigned char* tile_data = new unsigned char[tiles_horiz * tiles_vert * tile_size * tile_size];
+	unsigned char* data_ptr = tile_data;
+	for (int top = offset_y; top + tile_size <= height; top += tile_size + spacing_y) { // row major tile iteration
+		for (int left = offset_x; left + tile_size <= width; left += tile_size + spacing_x) {
+			// for each tile...
+			for (int y = 0; y < tile_size; y++) {
+				for (int x = 0; x < tile_size; x++) {
+					*data_ptr++ = image_data[
+						((top + y) * width + (left + x)) * n_channels
+					];
 				}
-				//printf("\n");
 			}
 		}
+	}
 
-		GLuint tex_handle;
-		glGenTextures(1, &tex_handle);
-		glBindTexture(GL_TEXTURE_2D_ARRAY, tex_handle);
-
-		glTexImage3D(GL_TEXTURE_2D_ARRAY, 0, GL_R8UI, tile_size, tile_size, tiles_horiz * tiles_vert, 0, GL_RED_INTEGER, GL_UNSIGNED_BYTE, tile_data);
-
-		glTexParameteri(GL_TEXTURE_2D_ARRAY, GL_TEXTURE_MIN_FILTER, GL_NEAREST);
-		glTexParameteri(GL_TEXTURE_2D_ARRAY, GL_TEXTURE_MAG_FILTER, GL_NEAREST);
-		glTexParameteri(GL_TEXTURE_2D_ARRAY, GL_TEXTURE_MAX_LEVEL, 0);
-		glTexParameteri(GL_TEXTURE_2D_ARRAY, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
-		glTexParameteri(GL_TEXTURE_2D_ARRAY, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
+	*out = { tile_size, tile_size, tiles_horiz * tiles_vert, pack_2bpp(tile_data, tile_size, tile_size, tiles_horiz * tiles_vert) };
+	delete[] tile_data;
+	stbi_image_free(image_data);
+	return true;
+}
 
-		delete[] tile_data;
-		stbi_image_free(image_data);
-		return new Tileset{
-			Texture(tex_handle, GL_TEXTURE_2D_ARRAY)
-		};
+static bool read_tileset(const char* image_file, PackedImage* tiles, int tile_size, int offset_x, int offset_y, int spacing_x, int spacing_y) {
+	if (read_packed_file(image_file, tiles)) {
+		if (tiles->width != tile_size || tiles->height != tile_size) {
+			ERR_LOG("'%s' holds %dx%d tiles, not %d", image_file, tiles->width, tiles->height, tile_size);
+		}
+		return true;
 	}
-	else {
-		printf("Unable to load texture '%s'\n", image_file);
+	return slice_tileset(image_file, tiles, tile_size, offset_x, offset_y, spacing_x, spacing_y);
+}
+
+Tileset* load_tileset(const char* image_file, int tile_size, int offset_x, int offset_y, int spacing_x, int spacing_y) {
+	PackedImage tiles;
+	if (!read_tileset(image_file, &tiles, tile_size, offset_x, offset_y, spacing_x, spacing_y)) {
+		ERR_LOG("Unable to load texture '%s'", image_file);
 		return nullptr;
 	}
+
+	GLuint tex_handle = create_index_array(tiles.width, tiles.height, tiles.layers, tiles.data, GL_CLAMP_TO_EDGE);
+
+	delete[] tiles.data;
+	return new Tileset{
+		Texture(tex_handle, GL_TEXTURE_2D_ARRAY),
+		strdup(image_file),
+		tile_size, offset_x, offset_y, spacing_x, spacing_y
+	};
+}
+
+bool export_packed_tileset(const char* image_file, const char* out_file, int tile_size, int offset_x, int offset_y, int spacing_x, int spacing_y) {
+	PackedImage tiles;
+	if (!slice_tileset(image_file, &tiles, tile_size, offset_x, offset_y, spacing_x, spacing_y)) {
+		ERR_LOG("Unable to load texture '%s'", image_file);
+		return false;
+	}
+	bool ok = write_packed_file(out_file, tiles);
+	delete[] tiles.data;
+	return ok;
+}
+
+void free_tileset(Tileset* ts) {
+	if (ts->tex.bound_slot >= 0) ts->tex.evict();
+	glDeleteTextures(1, &ts->tex.tex_handle);
+	unwatch_file(ts->source_file, ts);
+	free(ts->source_file);
+	delete ts;
 }
 
 int bind(Tileset* ts, int slot) {
@@ -154,67 +321,254 @@ int bind(Tileset* ts, int slot) {
 }
 
 struct Spritesheet {
+	Texture* tex; // either owned by this sheet or by the pool it was loaded into
+	i32 sheet_index; // layer within the texture array
+	char* source_file;
+	SpritesheetPool* pool = nullptr;
+};
+
+struct SpritesheetPool {
 	Texture tex;
+	i32 width, height;
+	i32 n_sheets;
+	i32 max_sheets;
 };
 
-Spritesheet* load_spritesheet(const char* image_file) {
+/// Read a spritesheet from either a packed file or a regular image, padding it out to at least min_width x min_height
+static bool read_spritesheet(const char* image_file, PackedImage* out, int min_width = 0, int min_height = 0) {
+	if (read_packed_file(image_file, out)) {
+		if (out->layers != 1) {
+			ERR_LOG("'%s' has %d layers; only the first is used as a spritesheet", image_file, out->layers);
+		}
+		if (out->width >= min_width && out->height >= min_height) return true;
+		// Re-pad into the larger size
+		int row_size = packed_row_size(out->width);
+		int dest_row_size = packed_row_size(max(out->width, min_width));
+		unsigned char* padded = new unsigned char[packed_size(max(out->width, min_width), max(out->height, min_height), 1)]();
+		for (int y = 0; y < out->height; y++) {
+			memcpy(padded + y * dest_row_size, out->data + y * row_size, row_size);
+		}
+		delete[] out->data;
+		*out = { max(out->width, min_width), max(out->height, min_height), 1, padded };
+		return true;
+	}
+
 	stbi_set_flip_vertically_on_load(false);
 	int width, height, n_channels;
 	unsigned char *image_data = stbi_load(image_file, &width, &height, &n_channels, 0);
+	if (!image_data) return false;
+
+	int dest_width = max(width, min_width);
+	int dest_height = max(height, min_height);
+	unsigned char* index_data = extract_color_indices(image_data, width, height, n_channels, dest_width, dest_height);
+	*out = { dest_width, dest_height, 1, pack_2bpp(index_data, dest_width, dest_height, 1) };
+	delete[] index_data;
+	stbi_image_free(image_data);
+	return true;
+}
 
-	if (image_data) {
-		unsigned char* spritesheet_data = new unsigned char[width * height];
-		for (int i = 0; i < width * height; i++) {
-			spritesheet_data[i] = image_data[i * n_channels];
-		}
-		GLuint tex_handle;
-		glGenTextures(1, &tex_handle);
-		glBindTexture(GL_TEXTURE_RECTANGLE, tex_handle);
+Spritesheet* load_spritesheet(const char* image_file) {
+	PackedImage sheet;
+	if (!read_spritesheet(image_file, &sheet)) {
+		ERR_LOG("Unable to load texture '%s'", image_file);
+		return nullptr;
+	}
+	// A lone spritesheet is a single-layer array so that the sprite shader only needs one sampler type.
+	GLuint tex_handle = create_index_array(sheet.width, sheet.height, 1, sheet.data, GL_CLAMP_TO_BORDER);
+
+	delete[] sheet.data;
+	return new Spritesheet{
+		new Texture(tex_handle, GL_TEXTURE_2D_ARRAY),
+		0,
+		strdup(image_file)
+	};
+}
 
-		glTexImage2D(GL_TEXTURE_RECTANGLE, 0, GL_R8UI, width, height, 0, GL_RED_INTEGER, GL_UNSIGNED_BYTE, spritesheet_data);
+bool export_packed_spritesheet(const char* image_file, const char* out_file) {
+	PackedImage sheet;
+	if (!read_spritesheet(image_file, &sheet)) {
+		ERR_LOG("Unable to load texture '%s'", image_file);
+		return false;
+	}
+	bool ok = write_packed_file(out_file, sheet);
+	delete[] sheet.data;
+	return ok;
+}
 
-		glTexParameteri(GL_TEXTURE_RECTANGLE, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_BORDER);
-		glTexParameteri(GL_TEXTURE_RECTANGLE, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_BORDER);
-		glTexParameteri(GL_TEXTURE_RECTANGLE, GL_TEXTURE_MIN_FILTER, GL_NEAREST);
-		glTexParameteri(GL_TEXTURE_RECTANGLE, GL_TEXTURE_MAG_FILTER, GL_NEAREST);
+SpritesheetPool* make_spritesheet_pool(int width, int height, int max_sheets) {
+	GLint max_layers;
+	glGetIntegerv(GL_MAX_ARRAY_TEXTURE_LAYERS, &max_layers);
+	if (max_sheets > max_layers) {
+		ERR_LOG("Spritesheet pool of %d sheets exceeds the limit of %d; clamping.", max_sheets, max_layers);
+		max_sheets = max_layers;
+	}
+	GLuint tex_handle = create_index_array(width, height, max_sheets, nullptr, GL_CLAMP_TO_BORDER);
+	return new SpritesheetPool{
+		Texture(tex_handle, GL_TEXTURE_2D_ARRAY),
+		width, height,
+		0,
+		max_sheets
+	};
+}
 
-		delete[] spritesheet_data;
-		stbi_image_free(image_data);
-		return new Spritesheet{
-			Texture(tex_handle, GL_TEXTURE_RECTANGLE)
-		};
+Spritesheet* load_spritesheet(SpritesheetPool* pool, const char* image_file) {
+	if (pool->n_sheets >= pool->max_sheets) {
+		ERR_LOG("Spritesheet pool is full; unable to load '%s'", image_file);
+		return nullptr;
 	}
-	else {
-		printf("Unable to load texture '%s'\n", image_file);
+	// Pad out to the full layer so that leftovers from other sheets don't show through
+	PackedImage sheet;
+	if (!read_spritesheet(image_file, &sheet, pool->width, pool->height)) {
+		ERR_LOG("Unable to load texture '%s'", image_file);
 		return nullptr;
 	}
+	if (sheet.width > pool->width || sheet.height > pool->height) {
+		ERR_LOG("Spritesheet '%s' (%dx%d) is too large for its pool (%dx%d)", image_file, sheet.width, sheet.height, pool->width, pool->height);
+		delete[] sheet.data;
+		return nullptr;
+	}
+	int layer = pool->n_sheets++;
+
+	glBindTexture(GL_TEXTURE_2D_ARRAY, pool->tex.tex_handle);
+	glPixelStorei(GL_UNPACK_ALIGNMENT, 1);
+	glTexSubImage3D(GL_TEXTURE_2D_ARRAY, 0, 0, 0, layer, packed_row_size(pool->width), pool->height, 1, GL_RED_INTEGER, GL_UNSIGNED_BYTE, sheet.data);
+	count_stat(STAT_TEXTURE_UPLOAD_BYTES, packed_size(pool->width, pool->height, 1));
+
+	delete[] sheet.data;
+	return new Spritesheet{
+		&pool->tex,
+		layer,
+		strdup(image_file),
+		pool
+	};
+}
+
+void free_spritesheet(Spritesheet* ss) {
+	if (ss->pool == nullptr) {
+		if (ss->tex->bound_slot >= 0) ss->tex->evict();
+		glDeleteTextures(1, &ss->tex->tex_handle);
+		delete ss->tex;
+	}
+	// Pooled sheets leave their layer in place; it is reclaimed along with the pool.
+	unwatch_file(ss->source_file, ss);
+	free(ss->source_file);
+	delete ss;
+}
+
+void free_spritesheet_pool(SpritesheetPool* pool) {
+	if (pool->tex.bound_slot >= 0) pool->tex.evict();
+	glDeleteTextures(1, &pool->tex.tex_handle);
+	delete pool;
+}
+
+// Hot reloading: decode on the watcher thread, upload into the existing texture on the render thread
+
+static void bind_for_upload(Texture& tex) {
+	// Go through the binding cache so it doesn't lose track of what is bound where
+	int slot = tex.bind(TEX_AUTO);
+	glActiveTexture(GL_TEXTURE0 + slot);
+	glPixelStorei(GL_UNPACK_ALIGNMENT, 1);
+}
+
+static void discard_packed_image(const char*, void*, void* prepared) {
+	auto image = (PackedImage*) prepared;
+	delete[] image->data;
+	delete image;
+}
+
+static void* prepare_tileset_reload(const char* path, void* user) {
+	auto ts = (Tileset*) user;
+	auto tiles = new PackedImage;
+	if (read_tileset(path, tiles, ts->tile_size, ts->offset_x, ts->offset_y, ts->spacing_x, ts->spacing_y)) {
+		return tiles;
+	}
+	delete tiles;
+	return nullptr;
+}
+
+static void apply_tileset_reload(const char*, void* user, void* prepared) {
+	auto ts = (Tileset*) user;
+	auto tiles = (PackedImage*) prepared;
+	bind_for_upload(ts->tex);
+	// Respecify rather than sub-upload in case tiles were added or removed
+	glTexImage3D(GL_TEXTURE_2D_ARRAY, 0, GL_R8UI, packed_row_size(tiles->width), tiles->height, tiles->layers, 0, GL_RED_INTEGER, GL_UNSIGNED_BYTE, tiles->data);
+	count_stat(STAT_TEXTURE_UPLOAD_BYTES, packed_size(tiles->width, tiles->height, tiles->layers));
+	delete[] tiles->data;
+	delete tiles;
+}
+
+void watch_tileset(Tileset* ts) {
+	watch_file(ts->source_file, apply_tileset_reload, ts, prepare_tileset_reload, discard_packed_image);
+}
+
+static void* prepare_spritesheet_reload(const char* path, void* user) {
+	auto ss = (Spritesheet*) user;
+	auto sheet = new PackedImage;
+	bool ok = ss->pool
+		? read_spritesheet(path, sheet, ss->pool->width, ss->pool->height)
+		: read_spritesheet(path, sheet);
+	if (ok && ss->pool && (sheet->width > ss->pool->width || sheet->height > ss->pool->height)) {
+		ERR_LOG("Spritesheet '%s' (%dx%d) is too large for its pool (%dx%d)", path, sheet->width, sheet->height, ss->pool->width, ss->pool->height);
+		delete[] sheet->data;
+		ok = false;
+	}
+	if (ok) return sheet;
+	delete sheet;
+	return nullptr;
+}
+
+static void apply_spritesheet_reload(const char*, void* user, void* prepared) {
+	auto ss = (Spritesheet*) user;
+	auto sheet = (PackedImage*) prepared;
+	bind_for_upload(*ss->tex);
+	if (ss->pool) {
+		glTexSubImage3D(GL_TEXTURE_2D_ARRAY, 0, 0, 0, ss->sheet_index, packed_row_size(sheet->width), sheet->height, 1, GL_RED_INTEGER, GL_UNSIGNED_BYTE, sheet->data);
+		count_stat(STAT_TEXTURE_UPLOAD_BYTES, packed_size(sheet->width, sheet->height, 1));
+	}
+	else {
+		glTexImage3D(GL_TEXTURE_2D_ARRAY, 0, GL_R8UI, packed_row_size(sheet->width), sheet->height, 1, 0, GL_RED_INTEGER, GL_UNSIGNED_BYTE, sheet->data);
+		count_stat(STAT_TEXTURE_UPLOAD_BYTES, packed_size(sheet->width, sheet->height, 1));
+	}
+	delete[] sheet->data;
+	delete sheet;
+}
+
+void watch_spritesheet(Spritesheet* ss) {
+	watch_file(ss->source_file, apply_spritesheet_reload, ss, prepare_spritesheet_reload, discard_packed_image);
 }
 
 int bind(Spritesheet* ss, int slot) {
-	return ss->tex.bind(slot);
+	return ss->tex->bind(slot);
 }
 
+Texture* get_texture(Spritesheet* ss) {
+	return ss->tex;
+}
+
+int sheet_index(Spritesheet* ss) {
+	return ss->sheet_index;
+}
+
+constexpr int MAX_CSETS = 256; // csets are packed into 8 bits everywhere else
+constexpr int DIRTY_WORDS = MAX_CSETS / 64;
+
 struct Palette {
 	Texture tex;
 	Color* color_data;
 	GLuint color_buffer;
 	int n_csets;
 	int cset_size;
+	u64 dirty[DIRTY_WORDS] = {}; // one bit per cset that needs to be re-uploaded
 };
 
-Palette* make_palette(std::initializer_list<std::initializer_list<Color>> color_data) {
-	auto csets = color_data.size();
-	auto cset_size = color_data.begin()->size();
-	auto colors = alloc(Color, csets * cset_size);
-	int i = 0;
-	auto r_end = color_data.end();
-	for (auto row = color_data.begin(); row != r_end; row++) {
-		assert(row->size() == cset_size && "Initializer list for palette is jagged!");
-		auto c_end = row->end();
-		for (auto cell = row->begin(); cell != c_end; cell++) {
-			colors[i++] = *cell;
-		}
+static inline void mark_dirty(Palette* p, int first_cset, int n) {
+	for (int cset = first_cset; cset < first_cset + n; cset++) {
+		BITSET(p->dirty[cset >> 6], cset & 0x3F);
 	}
+}
+
+static Palette* create_palette(Color* colors, int csets, int cset_size) {
+	assert(csets <= MAX_CSETS && "Palette has too many csets");
 
 	GLuint color_buffer;
 	glGenBuffers(1, &color_buffer);
@@ -230,16 +584,249 @@ Palette* make_palette(std::initializer_list<std::initializer_list<Color>> color_
 		Texture(tex_handle, GL_TEXTURE_BUFFER),
 		colors,
 		color_buffer,
-		(int) csets,
-		(int) cset_size
+		csets,
+		cset_size
 	};
 }
 
+Palette* make_palette(int csets, int cset_size) {
+	return create_palette(alloc0(Color, csets * cset_size), csets, cset_size);
+}
+
+Palette* make_palette(std::initializer_list<std::initializer_list<Color>> color_data) {
+	auto csets = color_data.size();
+	auto cset_size = color_data.begin()->size();
+	auto colors = alloc(Color, csets * cset_size);
+	int i = 0;
+	auto r_end = color_data.end();
+	for (auto row = color_data.begin(); row != r_end; row++) {
+		assert(row->size() == cset_size && "Initializer list for palette is jagged!");
+		auto c_end = row->end();
+		for (auto cell = row->begin(); cell != c_end; cell++) {
+			colors[i++] = *cell;
+		}
+	}
+	return create_palette(colors, (int) csets, (int) cset_size);
+}
+
+Palette* copy_palette(const Palette* src) {
+	auto n_colors = src->n_csets * src->cset_size;
+	auto colors = alloc(Color, n_colors);
+	memcpy(colors, src->color_data, sizeof(Color) * n_colors);
+	return create_palette(colors, src->n_csets, src->cset_size);
+}
+
+void free_palette(Palette* p) {
+	if (p->tex.bound_slot >= 0) p->tex.evict();
+	glDeleteTextures(1, &p->tex.tex_handle);
+	glDeleteBuffers(1, &p->color_buffer);
+	free(p->color_data);
+	delete p;
+}
+
+Color get_color(Palette* p, int cset, int index) {
+	assert(cset < p->n_csets && index < p->cset_size);
+	return p->color_data[cset * p->cset_size + index];
+}
+
+void set_color(Palette* p, int cset, int index, Color color) {
+	assert(cset < p->n_csets && index < p->cset_size);
+	p->color_data[cset * p->cset_size + index] = color;
+	mark_dirty(p, cset, 1);
+}
+
+const Color* get_cset(Palette* p, int cset) {
+	assert(cset < p->n_csets);
+	return &p->color_data[cset * p->cset_size];
+}
+
+void set_cset(Palette* p, int cset, const Color* colors) {
+	assert(cset < p->n_csets);
+	memcpy(&p->color_data[cset * p->cset_size], colors, sizeof(Color) * p->cset_size);
+	mark_dirty(p, cset, 1);
+}
+
+int n_csets(Palette* p) {
+	return p->n_csets;
+}
+
+int cset_size(Palette* p) {
+	return p->cset_size;
+}
+
 int bind(Palette* p, int slot) {
 	return p->tex.bind(slot);
 }
 
 void sync(Palette* p) {
-	glBindBuffer(GL_TEXTURE_BUFFER, p->color_buffer);
-	glBufferSubData(GL_TEXTURE_BUFFER, 0, sizeof(Color) * p->n_csets * p->cset_size, p->color_data);
+	// Upload each run of consecutive dirty csets with a single call
+	const int cset_bytes = sizeof(Color) * p->cset_size;
+	bool bound = false;
+	int cset = 0;
+	while (cset < p->n_csets) {
+		if (p->dirty[cset >> 6] == 0) { // skip clean words wholesale
+			cset = (cset + 64) & ~0x3F;
+			continue;
+		}
+		if (!BITOF(p->dirty[cset >> 6], cset & 0x3F)) {
+			cset++;
+			continue;
+		}
+		int run_end = cset + 1;
+		while (run_end < p->n_csets && BITOF(p->dirty[run_end >> 6], run_end & 0x3F)) run_end++;
+
+		if (!bound) {
+			glBindBuffer(GL_TEXTURE_BUFFER, p->color_buffer);
+			bound = true;
+		}
+		glBufferSubData(GL_TEXTURE_BUFFER, cset * cset_bytes, (run_end - cset) * cset_bytes, &p->color_data[cset * p->cset_size]);
+		count_stat(STAT_BUFFER_UPLOAD_BYTES, (run_end - cset) * cset_bytes);
+		cset = run_end;
+	}
+	memset(p->dirty, 0, sizeof(p->dirty));
+}
+
+// Palette animation
+
+// Blend kernels work on raw channel bytes with an 8-bit fixed-point weight so that the loops vectorize.
+static void blend_colors(Color* dest, const Color* from, const Color* to, int n_colors, u32 weight) {
+	auto d = (u8*) dest;
+	auto a = (const u8*) from;
+	auto b = (const u8*) to;
+	const u32 inv = 256 - weight;
+	for (int i = 0; i < n_colors * 4; i++) {
+		d[i] = (u8) ((a[i] * inv + b[i] * weight) >> 8);
+	}
+}
+
+static void blend_colors(Color* dest, const Color* from, Color to, int n_colors, u32 weight) {
+	auto d = (u8*) dest;
+	auto a = (const u8*) from;
+	const u32 inv = 256 - weight;
+	const u32 target[4] = { to.r * weight, to.g * weight, to.b * weight, to.a * weight };
+	for (int i = 0; i < n_colors * 4; i++) {
+		d[i] = (u8) ((a[i] * inv + target[i & 3]) >> 8);
+	}
+}
+
+static inline u32 blend_weight(float t) {
+	return (u32) (clamp(t) * 256.f);
+}
+
+void lerp_palette(Palette* dest, const Palette* from, const Palette* to, float t, int first_cset, int n) {
+	if (n < 0) n = dest->n_csets - first_cset;
+	assert(dest->cset_size == from->cset_size && dest->cset_size == to->cset_size);
+	assert(first_cset + n <= dest->n_csets && first_cset + n <= from->n_csets && first_cset + n <= to->n_csets);
+	auto offset = first_cset * dest->cset_size;
+	blend_colors(dest->color_data + offset, from->color_data + offset, to->color_data + offset, n * dest->cset_size, blend_weight(t));
+	mark_dirty(dest, first_cset, n);
+}
+
+void fade_palette(Palette* dest, const Palette* from, Color target, float t, int first_cset, int n) {
+	if (n < 0) n = dest->n_csets - first_cset;
+	assert(dest->cset_size == from->cset_size);
+	assert(first_cset + n <= dest->n_csets && first_cset + n <= from->n_csets);
+	auto offset = first_cset * dest->cset_size;
+	blend_colors(dest->color_data + offset, from->color_data + offset, target, n * dest->cset_size, blend_weight(t));
+	mark_dirty(dest, first_cset, n);
+}
+
+void cycle_colors(Palette* p, int cset, int first, int count, int shift) {
+	assert(cset < p->n_csets && first + count <= p->cset_size);
+	if (count <= 1) return;
+	shift %= count;
+	if (shift < 0) shift += count;
+	if (shift == 0) return;
+	Color* colors = &p->color_data[cset * p->cset_size + first];
+	std::rotate(colors, colors + (count - shift), colors + count);
+	mark_dirty(p, cset, 1);
+}
+
+struct PaletteAnimation {
+	enum { CYCLE, FADE, LERP } type;
+	int first_cset, n_csets;
+	float elapsed;
+	float duration; // for cycles, the time it takes to advance by one color
+	// CYCLE
+	int first_color, n_colors;
+	// FADE
+	Color target = {};
+	// LERP
+	const Palette* to = nullptr;
+};
+
+struct PaletteAnimator {
+	Palette* target;
+	const Palette* base;
+	std::vector<PaletteAnimation> animations = {};
+	u64 touched[DIRTY_WORDS] = {};
+};
+
+PaletteAnimator* make_palette_animator(Palette* target, const Palette* base) {
+	assert(target->n_csets == base->n_csets && target->cset_size == base->cset_size);
+	return new PaletteAnimator{ target, base };
+}
+
+void free_palette_animator(PaletteAnimator* anim) {
+	delete anim;
+}
+
+void animate_cycle(PaletteAnimator* anim, int cset, int first, int count, float step_time) {
+	anim->animations.push_back({ PaletteAnimation::CYCLE, cset, 1, 0.f, step_time, first, count });
+}
+
+void animate_fade(PaletteAnimator* anim, int first_cset, int n_csets, Color target, float duration) {
+	anim->animations.push_back({ PaletteAnimation::FADE, first_cset, n_csets, 0.f, duration, 0, 0, target });
+}
+
+void animate_lerp(PaletteAnimator* anim, const Palette* to, int first_cset, int n_csets, float duration) {
+	anim->animations.push_back({ PaletteAnimation::LERP, first_cset, n_csets, 0.f, duration, 0, 0, {}, to });
+}
+
+void clear_palette_animations(PaletteAnimator* anim) {
+	anim->animations.clear();
+}
+
+void step_palette_animator(PaletteAnimator* anim, float dt) {
+	Palette* p = anim->target;
+	const Palette* base = anim->base;
+	auto cset_size = p->cset_size;
+
+	// Every animated cset is rebuilt from the base each frame, so collect them all up front
+	memset(anim->touched, 0, sizeof(anim->touched));
+	for (auto& a : anim->animations) {
+		a.elapsed += dt;
+		for (int cset = a.first_cset; cset < a.first_cset + a.n_csets; cset++) {
+			BITSET(anim->touched[cset >> 6], cset & 0x3F);
+		}
+	}
+	for (int cset = 0; cset < p->n_csets; cset++) {
+		if (!BITOF(anim->touched[cset >> 6], cset & 0x3F)) continue;
+		int run_end = cset + 1;
+		while (run_end < p->n_csets && BITOF(anim->touched[run_end >> 6], run_end & 0x3F)) run_end++;
+		memcpy(&p->color_data[cset * cset_size], &base->color_data[cset * cset_size], sizeof(Color) * (run_end - cset) * cset_size);
+		mark_dirty(p, cset, run_end - cset);
+		cset = run_end;
+	}
+
+	// Animations are applied in the order they were added and stack on top of one another
+	for (auto& a : anim->animations) {
+		auto offset = a.first_cset * cset_size;
+		auto n_colors = a.n_csets * cset_size;
+		switch (a.type) {
+		case PaletteAnimation::CYCLE:
+			if (a.duration > 0.f) {
+				cycle_colors(p, a.first_cset, a.first_color, a.n_colors, (int) (a.elapsed / a.duration));
+			}
+			break;
+		case PaletteAnimation::FADE: {
+			float t = a.duration > 0.f ? a.elapsed / a.duration : 1.f;
+			blend_colors(p->color_data + offset, p->color_data + offset, a.target, n_colors, blend_weight(t));
+		} break;
+		case PaletteAnimation::LERP: {
+			float t = a.duration > 0.f ? a.elapsed / a.duration : 1.f;
+			blend_colors(p->color_data + offset, p->color_data + offset, a.to->color_data + offset, n_colors, blend_weight(t));
+		} break;
+		}
+	}
 }
@@ -15,12 +15,26 @@ int bind(Texture* tex, int slot = TEX_AUTO);
 struct Tileset;
 Tileset* load_tileset(const char* image_file, int tile_size, int offset_x = 0, int offset_y = 0, int spacing_x = 0, int spacing_y = 0);
 void free_tileset(Tileset* ts);
+/// Slice an image into tiles and save it in the packed 2bpp format, which load_tileset also accepts
+bool export_packed_tileset(const char* image_file, const char* out_file, int tile_size, int offset_x = 0, int offset_y = 0, int spacing_x = 0, int spacing_y = 0);
 int bind(Tileset* tileset, int slot = TEX_AUTO);
+/// Reload the tileset in place whenever its source file changes (see hotreload.h)
+void watch_tileset(Tileset* tileset);
 
 struct Spritesheet;
 Spritesheet* load_spritesheet(const char* image_file);
 void free_spritesheet(Spritesheet* ss);
 int bind(Spritesheet* spritesheet, int slot = TEX_AUTO);
+void watch_spritesheet(Spritesheet* spritesheet);
+bool export_packed_spritesheet(const char* image_file, const char* out_file);
+Texture* get_texture(Spritesheet* spritesheet);
+int sheet_index(Spritesheet* spritesheet);
+
+/// A group of same-sized spritesheets that share one texture array, so sprites from any of them can be drawn together.
+struct SpritesheetPool;
+SpritesheetPool* make_spritesheet_pool(int width, int height, int max_sheets);
+Spritesheet* load_spritesheet(SpritesheetPool* pool, const char* image_file);
+void free_spritesheet_pool(SpritesheetPool* pool);
 
 struct Color {
 	u8 r, g, b;
@@ -38,4 +52,24 @@ void set_cset(Palette* palette, int cset, const Color* colors);
 int n_csets(Palette* palette);
 int cset_size(Palette* palette);
 int bind(Palette* palette, int slot = TEX_AUTO);
+/// Uploads only the csets that changed since the last sync
 void sync(Palette* palette);
+Palette* copy_palette(const Palette* palette);
+
+// Bulk palette effects. Each writes (1 - t) * from + t * target into dest for the given range of csets;
+// n = -1 means "through the last cset". dest may be the same palette as from.
+void lerp_palette(Palette* dest, const Palette* from, const Palette* to, float t, int first_cset = 0, int n = -1);
+void fade_palette(Palette* dest, const Palette* from, Color target, float t, int first_cset = 0, int n = -1);
+/// Rotate colors [first, first + count) of a cset forward by shift places
+void cycle_colors(Palette* palette, int cset, int first, int count, int shift = 1);
+
+/// Drives time-based cycles, fades and lerps on a palette, rebuilding animated csets from a base palette every step.
+struct PaletteAnimator;
+PaletteAnimator* make_palette_animator(Palette* target, const Palette* base);
+void free_palette_animator(PaletteAnimator* anim);
+void animate_cycle(PaletteAnimator* anim, int cset, int first, int count, float step_time);
+void animate_fade(PaletteAnimator* anim, int first_cset, int n_csets, Color target, float duration);
+void animate_lerp(PaletteAnimator* anim, const Palette* to, int first_cset, int n_csets, float duration);
+void clear_palette_animations(PaletteAnimator* anim);
+/// Advance all animations by dt seconds. Call sync() on the target afterwards.
+void step_palette_animator(PaletteAnimator* anim, float dt);
@@ -0,0 +1,107 @@
+#include <vector>
+#include <mutex>
+#include <thread>
+#include <atomic>
+#include <condition_variable>
+
+#include "common.h"
+#include "workers.h"
+
+constexpr int WORKER_THREADS_MAX = 15;
+
+struct WorkerPool {
+	std::vector<std::thread> threads;
+	std::mutex mutex;
+	std::condition_variable wake; // a batch of jobs is ready, or the pool is shutting down
+	std::condition_variable done; // the last job of the batch finished
+	u64 generation = 0; // bumped for each run_jobs
+	bool stopping = false;
+	int busy = 0; // workers that may still touch the current batch
+
+	// the current batch; workers copy these under the lock
+	WorkerJob job = nullptr;
+	void* user = nullptr;
+	int n_jobs = 0;
+	std::atomic<int> next_job{ 0 };
+	int unfinished = 0; // jobs not finished yet
+};
+
+static void take_jobs(WorkerPool* pool, WorkerJob job, void* user, int n_jobs) {
+	int finished = 0;
+	for (int i; (i = pool->next_job.fetch_add(1, std::memory_order_relaxed)) < n_jobs; finished++) {
+		job(user, i);
+	}
+	std::lock_guard<std::mutex> lock(pool->mutex);
+	pool->unfinished -= finished;
+	pool->busy--;
+	if (pool->unfinished == 0 || pool->busy == 0) pool->done.notify_all();
+}
+
+static void worker_main(WorkerPool* pool) {
+	u64 seen = 0;
+	for (;;) {
+		WorkerJob job;
+		void* user;
+		int n_jobs;
+		{
+			std::unique_lock<std::mutex> lock(pool->mutex);
+			pool->wake.wait(lock, [&] { return pool->stopping || pool->generation != seen; });
+			if (pool->stopping) return;
+			seen = pool->generation;
+			job = pool->job;
+			user = pool->user;
+			n_jobs = pool->n_jobs;
+			pool->busy++;
+		}
+		take_jobs(pool, job, user, n_jobs);
+	}
+}
+
+WorkerPool* make_worker_pool(int n_threads) {
+	if (n_threads <= 0) n_threads = (int) std::thread::hardware_concurrency() - 1;
+	n_threads = clamp(n_threads, 0, WORKER_THREADS_MAX);
+	auto pool = new WorkerPool;
+	pool->threads.reserve(n_threads);
+	for (int i = 0; i < n_threads; i++) {
+		pool->threads.emplace_back(worker_main, pool);
+	}
+	return pool;
+}
+
+void free_worker_pool(WorkerPool* pool) {
+	{
+		std::lock_guard<std::mutex> lock(pool->mutex);
+		pool->stopping = true;
+	}
+	pool->wake.notify_all();
+	for (auto& thread : pool->threads) thread.join();
+	delete pool;
+}
+
+int get_worker_count(const WorkerPool* pool) {
+	return (int) pool->threads.size() + 1;
+}
+
+void run_jobs(WorkerPool* pool, WorkerJob job, void* user, int n_jobs) {
+	if (n_jobs <= 0) return;
+	if (n_jobs == 1 || pool->threads.empty()) {
+		for (int i = 0; i < n_jobs; i++) job(user, i);
+		return;
+	}
+	{
+		// A worker that woke up late for the last batch may still be on its way out
+		std::unique_lock<std::mutex> lock(pool->mutex);
+		pool->done.wait(lock, [&] { return pool->busy == 0; });
+		pool->job = job;
+		pool->user = user;
+		pool->n_jobs = n_jobs;
+		pool->next_job.store(0, std::memory_order_relaxed);
+		pool->unfinished = n_jobs;
+		pool->busy = 1; // the caller
+		pool->generation++;
+	}
+	pool->wake.notify_all();
+	take_jobs(pool, job, user, n_jobs);
+	std::unique_lock<std::mutex> lock(pool->mutex);
+	pool->done.wait(lock, [&] { return pool->unfinished == 0; });
+}
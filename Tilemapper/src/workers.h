@@ -0,0 +1,15 @@
+#pragma once
+
+// A small pool of threads for fanning one frame's worth of independent jobs out across cores.
+// run_jobs blocks until every job is done, and the calling thread takes jobs too.
+
+struct WorkerPool;
+/// Runs once for each index in [0, n_jobs), on whichever thread gets to it first
+typedef void (*WorkerJob)(void* user, int index);
+
+/// Start n_threads worker threads; 0 picks one per core, minus one for the caller.
+WorkerPool* make_worker_pool(int n_threads = 0);
+void free_worker_pool(WorkerPool* pool);
+/// Threads that run jobs, counting the one calling run_jobs
+int get_worker_count(const WorkerPool* pool);
+void run_jobs(WorkerPool* pool, WorkerJob job, void* user, int n_jobs);